@@ -1,3 +1,19 @@
+/*
+ * message_reader summary:
+ *
+ * message_reader <device> <channel> reads the message of a channel and prints it.
+ * message_reader <device> <channel> --stream [--length-delimited] [--batch N] [--count N] [--max-length BYTES] [--queue DEPTH | --broadcast DEPTH] drains
+ * the queue of a channel continuously to stdout, untill --count messages were read or it's stopped by SIGINT or SIGTERM: every message
+ * is printed as a line (or, with --length-delimited, prefixed by its length as a 4 bytes little endian integer). Without --batch a
+ * message is read per read, with --batch N up to N messages are dequeued by a single MSG_SLOT_BATCH_READ, and stdout is flushed once per
+ * call. The reads don't block: when the queue is empty the reader waits for a message with poll. --queue DEPTH gives the channel its
+ * queue (MSG_SLOT_QUEUE); a channel without a queue holds a single message, which every read would return again. --broadcast DEPTH
+ * makes it a broadcast channel instead (MSG_SLOT_BROADCAST), so every reader gets every message that's written after it started; the
+ * batch ioctls don't read broadcast channels, so it excludes --batch.
+ * At the end of a stream a summary is printed to stderr as one JSON object (message_stream.h): the messages and bytes that were read,
+ * the calls, the waits for an empty queue, the throughput and the latency percentiles of the calls.
+ */
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -7,14 +23,75 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
 
  #include "message_slot.h"
+#include "message_stream.h"
+
+#define MAX_LENGTH_DEFAULT 65536
+
+typedef struct stream{ /* the options and the summary of a stream */
+    unsigned long channel_id;
+    int length_delimited;
+    int batch; /* messages per MSG_SLOT_BATCH_READ, 0 if the messages are read one by one */
+    unsigned long long count; /* messages to read, 0 untill stopped */
+    unsigned int max_length;
+    unsigned int depth;
+    unsigned int broadcast_depth;
+    StreamStats stats;
+}Stream;
+
+int read_message(int argc, char** argv);
+int parse_stream(int argc, char** argv, Stream* stream);
+int stream_messages(int fd, Stream* stream);
+int read_messages(int fd, Stream* stream, char* buffers, struct msg_slot_batch_entry* entries, int count);
+int print_message(Stream* stream, const char* message, unsigned int length);
+void handle_stop(int signum);
+
+static volatile sig_atomic_t stop = 0;
 
 int main(int argc, char** argv){
-    if (argc!=3){
-        fprintf(stderr, "Not enough arguments were given\n");
+    struct sigaction stop_action;
+    Stream stream;
+    int ipf, res;
+    if (argc==3){
+        return read_message(argc, argv);
+    }
+    if (argc < 4 || parse_stream(argc, argv, &stream)==-1){
+        fprintf(stderr, "Usage: %s <device> <channel>\n"
+                        "       %s <device> <channel> --stream [--length-delimited] [--batch N] [--count N] [--max-length BYTES] [--queue DEPTH | --broadcast DEPTH]\n",
+                argv[0], argv[0]);
+        return -1;
+    }
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop; /* without SA_RESTART, so a waiting poll returns */
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+    ipf=open(argv[1],O_RDONLY | O_NONBLOCK);
+    if (ipf==-1){
+        fprintf(stderr,"%s\n",strerror(errno));
         return -1;
     }
+    stream.stats.start = stream_now();
+    res = stream_messages(ipf, &stream);
+    close(ipf);
+    stream_print_summary(&stream.stats);
+    return res;
+}
+
+/*
+ * handle_stop - stops the stream after the current call
+ */
+void handle_stop(int signum){
+    stop = 1;
+}
+
+/*
+ * read_message - reads the message of the channel of the command line and prints it
+ */
+int read_message(int argc, char** argv){
     int ipf=open(argv[1],O_RDONLY);
     if (ipf==-1){
         fprintf(stderr,"%s\n",strerror(errno));
@@ -34,4 +111,181 @@ int main(int argc, char** argv){
     close(ipf);
     printf("%s\n",buffer);
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * parse_stream - parses the channel and the options of a stream, returns 0 if successfull, else -1
+ */
+int parse_stream(int argc, char** argv, Stream* stream){
+    int i, streaming = 0;
+    memset(stream, 0, sizeof(Stream));
+    stream->channel_id = strtoul(argv[2], NULL, 10);
+    stream->max_length = MAX_LENGTH_DEFAULT;
+    if (stream->channel_id==0){
+        return -1;
+    }
+    for (i=3 ; i < argc ; i++){
+        if (strcmp(argv[i], "--stream")==0){
+            streaming = 1;
+        }
+        else if (strcmp(argv[i], "--length-delimited")==0){
+            stream->length_delimited = 1;
+        }
+        else if (strcmp(argv[i], "--batch")==0 && i+1 < argc){
+            stream->batch = (int) strtol(argv[++i], NULL, 10);
+            if (stream->batch < 1 || stream->batch > MSG_SLOT_BATCH_MAX){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--count")==0 && i+1 < argc){
+            stream->count = strtoull(argv[++i], NULL, 10);
+            if (stream->count==0){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--max-length")==0 && i+1 < argc){
+            stream->max_length = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (stream->max_length < 1 || stream->max_length > MSG_SLOT_MESSAGE_LIMIT){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--queue")==0 && i+1 < argc){
+            stream->depth = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (stream->depth < 1 || stream->depth > MSG_SLOT_QUEUE_MAX_DEPTH){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--broadcast")==0 && i+1 < argc){
+            stream->broadcast_depth = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (stream->broadcast_depth < 1 || stream->broadcast_depth > MSG_SLOT_BROADCAST_MAX_DEPTH){
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+    if (stream->broadcast_depth!=0 && (stream->depth!=0 || stream->batch!=0)){
+        return -1;
+    }
+    return streaming ? 0 : -1;
+}
+
+/*
+ * stream_messages - reads the messages of the channel untill --count were read or the stream is stopped, and waits with poll while the
+ * queue is empty. Returns 0 if successfull, else -1
+ */
+int stream_messages(int fd, Stream* stream){
+    struct msg_slot_queue_config config = { stream->depth, 0, MSG_SLOT_QUEUE_BLOCK };
+    struct msg_slot_broadcast_config broadcast = { stream->broadcast_depth };
+    struct msg_slot_broadcast_stats broadcast_stats;
+    struct msg_slot_batch_entry* entries;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int calls = stream->batch ? stream->batch : 1, res = 0, count;
+    char* buffers;
+    config.capacity = (unsigned long long)stream->depth * MSG_SLOT_MESSAGE_LIMIT > UINT32_MAX ? UINT32_MAX : stream->depth * MSG_SLOT_MESSAGE_LIMIT; /* like message_sender's */
+    if (ioctl(fd, MSG_SLOT_CHANNEL, stream->channel_id)==-1 || (stream->depth!=0 && ioctl(fd, MSG_SLOT_QUEUE, &config)==-1) ||
+        (stream->broadcast_depth!=0 && ioctl(fd, MSG_SLOT_BROADCAST, &broadcast)==-1)){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    buffers = (char*)malloc((size_t)calls * stream->max_length);
+    entries = (struct msg_slot_batch_entry*)calloc(calls, sizeof(struct msg_slot_batch_entry));
+    if (buffers==NULL || entries==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        free(buffers);
+        free(entries);
+        return -1;
+    }
+    while (!stop && (stream->count==0 || stream->stats.messages < stream->count)){
+        count = stream->count!=0 && stream->count - stream->stats.messages < (unsigned long long)calls ? stream->count - stream->stats.messages : calls;
+        res = read_messages(fd, stream, buffers, entries, count);
+        if (res==-1){
+            break;
+        }
+        if (fflush(stdout)==EOF){
+            fprintf(stderr, "%s\n", strerror(errno));
+            res = -1;
+            break;
+        }
+        if (res==0){ /* the queue is empty */
+            stream->stats.waits++;
+            if (poll(&pfd, 1, -1)==-1 && errno!=EINTR){
+                fprintf(stderr, "%s\n", strerror(errno));
+                res = -1;
+                break;
+            }
+        }
+    }
+    if (stream->broadcast_depth!=0 && ioctl(fd, MSG_SLOT_BROADCAST_STATS, &broadcast_stats)==0 && broadcast_stats.missed!=0){
+        fprintf(stderr, "missed %llu messages that were overwritten\n", (unsigned long long)broadcast_stats.missed);
+        stream->stats.failed+=broadcast_stats.missed;
+    }
+    free(buffers);
+    free(entries);
+    return res==-1 ? -1 : 0;
+}
+
+/*
+ * read_messages - reads up to count messages with a single call and prints them, returns how many were read, or -1 if it failed
+ */
+int read_messages(int fd, Stream* stream, char* buffers, struct msg_slot_batch_entry* entries, int count){
+    struct msg_slot_batch batch = { (__u64)(uintptr_t)entries, count, 0 };
+    unsigned long long start = stream_now();
+    ssize_t res;
+    int i, read_count = 0;
+    if (stream->batch==0){
+        res = read(fd, buffers, stream->max_length);
+        stream_record_call(&stream->stats, start);
+        if (res==-1){
+            if (errno==EWOULDBLOCK || errno==EINTR){
+                return 0;
+            }
+            fprintf(stderr, "%s\n", strerror(errno));
+            stream->stats.failed++;
+            return -1;
+        }
+        return print_message(stream, buffers, res)==-1 ? -1 : 1;
+    }
+    for (i=0 ; i < count ; i++){
+        entries[i].channel_id = stream->channel_id;
+        entries[i].buffer = (__u64)(uintptr_t)(buffers + (size_t)i * stream->max_length);
+        entries[i].length = stream->max_length;
+    }
+    if (ioctl(fd, MSG_SLOT_BATCH_READ, &batch)==-1){
+        stream_record_call(&stream->stats, start);
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    stream_record_call(&stream->stats, start);
+    for (i=0 ; i < count ; i++){ /* in the order they were dequeued, a message may follow an entry that found the queue empty */
+        if (entries[i].status==-EWOULDBLOCK){
+            continue;
+        }
+        if (entries[i].status < 0){ /* -ENOSPC: the message is longer than --max-length and stays queued */
+            fprintf(stderr, "%s\n", strerror(-entries[i].status));
+            stream->stats.failed++;
+            return -1;
+        }
+        if (print_message(stream, buffers + (size_t)i * stream->max_length, entries[i].status)==-1){
+            return -1;
+        }
+        read_count++;
+    }
+    return read_count;
+}
+
+/*
+ * print_message - writes the message to stdout, returns 0 if successfull, else -1
+ */
+int print_message(Stream* stream, const char* message, unsigned int length){
+    uint8_t prefix[4] = { length & 0xff, (length >> 8) & 0xff, (length >> 16) & 0xff, length >> 24 };
+    if ((stream->length_delimited && fwrite(prefix, 1, sizeof(prefix), stdout)!=sizeof(prefix)) || fwrite(message, 1, length, stdout)!=length ||
+        (!stream->length_delimited && putchar('\n')==EOF)){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    stream->stats.messages++;
+    stream->stats.bytes+=length;
+    return 0;
+}
@@ -1,3 +1,19 @@
+/*
+ * message_sender summary:
+ *
+ * message_sender <device> <channel> <message> writes a single message to a channel.
+ * message_sender <device> <channel>[,<channel>...] --stream [--length-delimited] [--batch N] [--queue DEPTH | --broadcast DEPTH] streams messages from stdin
+ * over a single open file: every non-empty line (or, with --length-delimited, every message that is prefixed by its length as a 4 bytes little
+ * endian integer) is written to every channel of the list. With --batch N, N messages are collected and written to all the channels
+ * with a single MSG_SLOT_BATCH_WRITE; a single channel without --batch is written with write. --queue DEPTH gives the channels a queue
+ * that blocks the writers when it's full (MSG_SLOT_QUEUE), so a reader drains every message instead of the last one. A batch entry that
+ * finds a full queue is written again with a blocking write, and so are the later entries of its channel, so no message is lost or
+ * reordered. --broadcast DEPTH makes the channels broadcast ones instead (MSG_SLOT_BROADCAST), whose every message is read by every
+ * message_reader that was started on them before.
+ * At the end of a stream a summary is printed to stderr as one JSON object (message_stream.h): the messages that were written to a
+ * channel, their bytes, the calls, the throughput and the latency percentiles of the calls.
+ */
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -7,27 +23,72 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
- 
+#include <stdint.h>
+
  #include "message_slot.h"
+#include "message_stream.h"
+
+#define MAX_CHANNELS 64
+#define MAX_LENGTH MSG_SLOT_MESSAGE_LIMIT
+
+typedef struct stream{ /* the options and the summary of a stream */
+    unsigned long channels[MAX_CHANNELS];
+    int num_channels;
+    int length_delimited;
+    int batch; /* messages per MSG_SLOT_BATCH_WRITE, 0 if the messages are written one by one */
+    unsigned int depth;
+    unsigned int broadcast_depth;
+    StreamStats stats; /* a message counts once per channel */
+}Stream;
+
+int send_message(int argc, char** argv);
+int parse_stream(int argc, char** argv, Stream* stream);
+int stream_messages(int fd, Stream* stream);
+int bind_channel(int fd, unsigned long channel_id);
+char* next_message(Stream* stream, unsigned int* length);
+int write_batch(int fd, Stream* stream, char** messages, unsigned int* lengths, int count);
 
 int main(int argc, char** argv){
-    if (argc!=4){
-        fprintf(stderr, "Not enough arguments were given\n");
+    Stream stream;
+    int opf, res;
+    if (argc==4 && strncmp(argv[3], "--", 2)!=0){
+        return send_message(argc, argv);
+    }
+    if (argc < 4 || parse_stream(argc, argv, &stream)==-1){
+        fprintf(stderr, "Usage: %s <device> <channel> <message>\n"
+                        "       %s <device> <channel>[,<channel>...] --stream [--length-delimited] [--batch N] [--queue DEPTH | --broadcast DEPTH]\n",
+                argv[0], argv[0]);
         return -1;
     }
+    opf=open(argv[1],O_WRONLY);
+    if (opf==-1){
+        fprintf(stderr,"%s\n",strerror(errno));
+        return -1;
+    }
+    stream.stats.start = stream_now();
+    res = stream_messages(opf, &stream);
+    close(opf);
+    stream_print_summary(&stream.stats);
+    return res==-1 || stream.stats.failed!=0 ? -1 : 0;
+}
+
+/*
+ * send_message - writes the message of the command line to the channel
+ */
+int send_message(int argc, char** argv){
     int opf=open(argv[1],O_WRONLY);
     if (opf==-1){
         fprintf(stderr,"%s\n",strerror(errno));
         return -1;
     }
-   
+
     if (ioctl(opf,MSG_SLOT_CHANNEL, (unsigned int)strtoul(argv[2],NULL,10))==-1){ /* set channel id to the specified one*/
         close(opf);
         fprintf(stderr,"%s\n",strerror(errno));
         return -1;
     }
     int bytes_written=write(opf,argv[3],strlen(argv[3]));
-    if (bytes_written==-1) { 
+    if (bytes_written==-1) {
         close(opf);
         fprintf(stderr,"%s\n",strerror(errno));
         return -1;
@@ -35,4 +96,209 @@ int main(int argc, char** argv){
     close(opf);
     printf("Successfully wrote %d bytes to %s\n",bytes_written,argv[1]); /* print status message?*/
     return 0;
-}   
+}
+
+/*
+ * parse_stream - parses the channel list and the options of a stream, returns 0 if successfull, else -1
+ */
+int parse_stream(int argc, char** argv, Stream* stream){
+    char *list = argv[2], *end;
+    int i, streaming = 0;
+    memset(stream, 0, sizeof(Stream));
+    while (stream->num_channels < MAX_CHANNELS){
+        stream->channels[stream->num_channels] = strtoul(list, &end, 10);
+        if (end==list || stream->channels[stream->num_channels]==0 || (*end!=',' && *end!='\0')){
+            return -1;
+        }
+        stream->num_channels++;
+        if (*end=='\0'){
+            break;
+        }
+        list = end + 1;
+    }
+    if (*end!='\0'){ /* more than MAX_CHANNELS */
+        return -1;
+    }
+    for (i=3 ; i < argc ; i++){
+        if (strcmp(argv[i], "--stream")==0){
+            streaming = 1;
+        }
+        else if (strcmp(argv[i], "--length-delimited")==0){
+            stream->length_delimited = 1;
+        }
+        else if (strcmp(argv[i], "--batch")==0 && i+1 < argc){
+            stream->batch = (int) strtol(argv[++i], NULL, 10);
+            if (stream->batch < 1 || stream->batch * stream->num_channels > MSG_SLOT_BATCH_MAX){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--queue")==0 && i+1 < argc){
+            stream->depth = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (stream->depth < 1 || stream->depth > MSG_SLOT_QUEUE_MAX_DEPTH){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--broadcast")==0 && i+1 < argc){
+            stream->broadcast_depth = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (stream->broadcast_depth < 1 || stream->broadcast_depth > MSG_SLOT_BROADCAST_MAX_DEPTH){
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+    if (stream->broadcast_depth!=0 && stream->depth!=0){
+        return -1;
+    }
+    if (stream->batch==0 && stream->num_channels > 1){ /* a message is written to all the channels with one call */
+        stream->batch = 1;
+    }
+    return streaming ? 0 : -1;
+}
+
+/*
+ * bind_channel - binds the file to the channel, returns 0 if successfull, else -1
+ */
+int bind_channel(int fd, unsigned long channel_id){
+    if (ioctl(fd, MSG_SLOT_CHANNEL, channel_id)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * stream_messages - writes the messages of stdin untill its end, returns 0 if successfull, else -1
+ */
+int stream_messages(int fd, Stream* stream){
+    struct msg_slot_queue_config config = { stream->depth, 0, MSG_SLOT_QUEUE_BLOCK };
+    struct msg_slot_broadcast_config broadcast = { stream->broadcast_depth };
+    char* messages[MSG_SLOT_BATCH_MAX];
+    unsigned int lengths[MSG_SLOT_BATCH_MAX];
+    unsigned long long start;
+    int i, count = 0, res = 0;
+    config.capacity = (unsigned long long)stream->depth * MAX_LENGTH > UINT32_MAX ? UINT32_MAX : stream->depth * MAX_LENGTH; /* only depth bounds it */
+    for (i=0 ; i < stream->num_channels && (stream->depth!=0 || stream->broadcast_depth!=0) ; i++){
+        if (bind_channel(fd, stream->channels[i])==-1){
+            return -1;
+        }
+        if (stream->depth!=0 ? ioctl(fd, MSG_SLOT_QUEUE, &config)==-1 : ioctl(fd, MSG_SLOT_BROADCAST, &broadcast)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (stream->batch==0 && bind_channel(fd, stream->channels[0])==-1){ /* the file stays bound to the single channel */
+        return -1;
+    }
+    while (res==0 && (messages[count] = next_message(stream, &lengths[count]))!=NULL){
+        if (stream->batch==0){
+            start = stream_now();
+            if (write(fd, messages[0], lengths[0])==-1){
+                fprintf(stderr, "%s\n", strerror(errno));
+                stream->stats.failed++;
+            }
+            else {
+                stream->stats.messages++;
+                stream->stats.bytes+=lengths[0];
+            }
+            stream_record_call(&stream->stats, start);
+            free(messages[0]);
+            continue;
+        }
+        if (++count==stream->batch){
+            res = write_batch(fd, stream, messages, lengths, count);
+            count = 0;
+        }
+    }
+    if (res==0 && count!=0){
+        res = write_batch(fd, stream, messages, lengths, count);
+    }
+    return res;
+}
+
+/*
+ * next_message - reads the next message of stdin and fills its length, returns it (to be freed) or NULL at the end of stdin. Empty
+ * lines are skipped, a channel doesn't take an empty message
+ */
+char* next_message(Stream* stream, unsigned int* length){
+    char* message = NULL;
+    size_t size = 0;
+    ssize_t res;
+    uint8_t prefix[4];
+    if (!stream->length_delimited){
+        do {
+            res = getline(&message, &size, stdin);
+            if (res <= 0){
+                free(message);
+                return NULL;
+            }
+            *length = message[res - 1]=='\n' ? res - 1 : res;
+        } while (*length==0);
+        return message;
+    }
+    if (fread(prefix, 1, sizeof(prefix), stdin)!=sizeof(prefix)){
+        return NULL;
+    }
+    *length = prefix[0] | (prefix[1] << 8) | (prefix[2] << 16) | ((unsigned int)prefix[3] << 24);
+    if (*length > MAX_LENGTH){
+        fprintf(stderr, "a message of %u bytes is longer than %d\n", *length, MAX_LENGTH);
+        return NULL;
+    }
+    message = (char*)malloc(*length + 1);
+    if (message==NULL || fread(message, 1, *length, stdin)!=*length){
+        free(message);
+        return NULL;
+    }
+    return message;
+}
+
+/*
+ * write_batch - writes count messages to every channel with one MSG_SLOT_BATCH_WRITE, and the entries that found a full queue with a
+ * blocking write each. MSG_SLOT_BATCH_ORDERED skips the later entries of a channel that found its queue full, so they're written in
+ * order after it. Frees the messages, returns 0 if successfull, else -1
+ */
+int write_batch(int fd, Stream* stream, char** messages, unsigned int* lengths, int count){
+    struct msg_slot_batch_entry entries[MSG_SLOT_BATCH_MAX];
+    struct msg_slot_batch batch = { (__u64)(uintptr_t)entries, 0, MSG_SLOT_BATCH_ORDERED };
+    unsigned long long start;
+    int i, j, res = 0;
+    for (i=0 ; i < count ; i++){
+        for (j=0 ; j < stream->num_channels ; j++){
+            entries[batch.count].channel_id = stream->channels[j];
+            entries[batch.count].buffer = (__u64)(uintptr_t)messages[i];
+            entries[batch.count].length = lengths[i];
+            batch.count++;
+        }
+    }
+    start = stream_now();
+    if (ioctl(fd, MSG_SLOT_BATCH_WRITE, &batch)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        res = -1;
+    }
+    stream_record_call(&stream->stats, start);
+    for (i=0 ; i < (int)batch.count && res==0 ; i++){
+        if (entries[i].status==-EAGAIN){ /* the queue is full, or an earlier entry found it full, waits for room in entry order */
+            if (bind_channel(fd, entries[i].channel_id)==-1){
+                res = -1;
+                break;
+            }
+            start = stream_now();
+            entries[i].status = write(fd, messages[i / stream->num_channels], entries[i].length)==-1 ? -errno : (__s32)entries[i].length;
+            stream_record_call(&stream->stats, start);
+            stream->stats.waits++;
+        }
+        if (entries[i].status < 0){
+            fprintf(stderr, "channel %llu: %s\n", (unsigned long long)entries[i].channel_id, strerror(-entries[i].status));
+            stream->stats.failed++;
+        }
+        else {
+            stream->stats.messages++;
+            stream->stats.bytes+=entries[i].length;
+        }
+    }
+    for (i=0 ; i < count ; i++){
+        free(messages[i]);
+    }
+    return res;
+}
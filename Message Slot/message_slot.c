@@ -1,3 +1,4 @@
+#ifndef MSG_SLOT_USERSPACE /* the kernel module, else the core alone is built as a userspace library against message_slot_shim.h */
 #undef __KERNEL__
 #define __KERNEL__
 
@@ -11,217 +12,1507 @@
 #include <linux/string.h> 
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
 MODULE_LICENSE("GPL");
+#define CREATE_TRACE_POINTS
+#include "message_slot_trace.h"
+#endif
 #include "message_slot.h"
 
+static unsigned int max_message_size = 65536;
+module_param(max_message_size, uint, 0644);
+MODULE_PARM_DESC(max_message_size, "the largest message a write accepts, up to 4 MiB (" __stringify(MSG_SLOT_MESSAGE_LIMIT) " bytes)");
 
-int check_if_slot_exists(unsigned int minor_number);
-int allocate_msg_slot(int minor_number);
-Channel* get_or_create_channel(Slot* slot,int channel_id);
-Slot* get_slot(int minor_number);
-Channel* allocate_channel(Slot *slot,int channel_id);
-Channel* get_channel(Slot* slot, int channel_id);
-void free_all_slots_and_channels(Slot* slot);
-void add_channel_to_slot(Slot* slot,Channel* new_channel,int channel_id);
-void free_all_channels(Channel* channels);
+static unsigned long default_memory_limit = 0;
+module_param(default_memory_limit, ulong, 0644);
+MODULE_PARM_DESC(default_memory_limit, "the memory limit in bytes of a new slot, 0 means no limit (see MSG_SLOT_MEMORY_LIMIT)");
 
+#define CHANNEL_MEMORY (sizeof(Channel) + nr_cpu_ids * sizeof(ChannelStats)) /* charged to the slot, like everything below */
+#define RING_MEMORY(size) (sizeof(Ring) + MSG_SLOT_RING_DATA_OFFSET + (size))
+#define MESSAGES_MEMORY(depth) ((size_t)(depth) * sizeof(Message*)) /* of a queue or a broadcast log */
+
+/* the messages are allocated from a cache of the smallest class they fit in, bigger ones from kvmalloc */
+static const unsigned int size_classes[MESSAGE_SIZE_CLASSES] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+static struct kmem_cache* message_caches[MESSAGE_SIZE_CLASSES];
+
+static Module module={ /* the slots are indexed by minor number and the channels of a slot by channel id, so a lookup doesn't depend on how many there are */
+    .slots = XARRAY_INIT(module.slots, 0),
+};
+
+#ifndef MSG_SLOT_USERSPACE
 static int majorNumber;
-static Module* module=NULL;
 
 //===================================== DEVICE FUNCTIONS ==============================================//
 static int device_open(struct inode* inode, struct file*  file ){
-    int res, temp;
     unsigned int minor=iminor(inode);
-    if (minor<0) return -EINVAL;
-    file->private_data=NULL;
-    res=check_if_slot_exists(minor);
-    if (res==0){ /* msg_slot already exists for the minor number */
-        return 0;
+    int res=0;
+    if (get_slot(minor)==NULL){ /* no msg_slot exists for the minor number yet */
+        res=allocate_msg_slot(minor);
     }
-    if (res==2){ /*first call to open for the specific major number, so allocate module and a msg_slot node */
-        module=kmalloc(sizeof(Module), GFP_KERNEL); /* module allocation */
-        if (module==NULL){
-            return -1;
-        }
-        module->slots=NULL;
+    if (res!=0){
+        return res;
     }
-    temp = allocate_msg_slot(minor);
-    if (temp==-1){
-        return -1;
-    }
-    return 0;
+    file->private_data=kzalloc(sizeof(FileContext), GFP_KERNEL); /* not bound to a channel yet */
+    return file->private_data==NULL ? -ENOMEM : 0;
+}
+
+/* takes a reference to the channel the file is bound to, or returns NULL if it isn't bound. The file's own reference may be dropped
+ * by a concurrent MSG_SLOT_CHANNEL, and the channel reclaimed, while the call uses it */
+static Channel* file_channel(FileContext* context){
+    Channel* channel;
+    rcu_read_lock();
+    do { /* a channel whose last reference was dropped was rebound, so the pointer is read again */
+        channel=READ_ONCE(context->channel);
+    } while (channel!=NULL && !refcount_inc_not_zero(&channel->refs));
+    rcu_read_unlock();
+    return channel;
 }
 
 static ssize_t device_read(struct file* file,char __user* buffer,size_t length, loff_t* offset ){
-    Channel* temp = (Channel*)file->private_data;
+    FileContext* context = file->private_data;
+    Channel* temp = file_channel(context);
     Slot* slot = get_slot(iminor(file_inode(file)));
-    if (slot==NULL || temp==NULL){/* check if a device file with the specified minor has been created */
-        return -EINVAL;
+    ssize_t res=-EINVAL;
+    trace_message_slot_read(iminor(file_inode(file)), temp, length);
+    if (slot!=NULL && temp!=NULL){/* check if a device file with the specified minor has been created */
+        res=channel_read(temp, context, buffer, length, file->f_flags & O_NONBLOCK);
     }
-    if (temp->message_length==-1){ /* means no one wrote to the channel */
-        return -EWOULDBLOCK;
-    }
-    if (temp->message_length>length){
-        return -ENOSPC;
+    trace_message_slot_read_done(iminor(file_inode(file)), temp, res);
+    if (temp!=NULL){
+        put_channel(temp);
     }
-    if ( copy_to_user(buffer,temp->buffer, temp->message_length) ) { /* copy_to_user returns amount of bytes not successfully written */
-        return -EINVAL;
-    }
-    return (ssize_t)temp->message_length;
+    return res;
 }
 static int device_release( struct inode* inode,
                            struct file*  file){
+                               FileContext* context = file->private_data;
+                               if (context->channel!=NULL){ /* the last file of an idle channel reclaims it */
+                                   put_channel(context->channel);
+                               }
+                               kfree(context);
                                return 0;
 }
 static ssize_t device_write(struct file* file, const char __user* buffer, size_t length, loff_t* offset){
-    Channel* temp = (Channel*)file->private_data;
-	char prev_msg[BUFFER_SIZE];
+    FileContext* context = file->private_data;
+    Channel* temp = file_channel(context);
     Slot* slot = get_slot(iminor(file_inode(file))); /* check if a device file with the specified minor has been created */
-    if (slot==NULL || temp==NULL){
+    ssize_t res=-EINVAL;
+    trace_message_slot_write(iminor(file_inode(file)), temp, length);
+    if (slot!=NULL && temp!=NULL){
+        res=channel_write(temp, buffer, length, file->f_flags & O_NONBLOCK);
+    }
+    trace_message_slot_write_done(iminor(file_inode(file)), temp, res);
+    if (temp!=NULL){
+        put_channel(temp);
+    }
+    return res;
+}
+
+/* readable once the channel has a message, writable unless a queue that blocks its writers is full. The file must be bound to its
+ * channel before it's polled, and a channel isn't reclaimed while a poller waits on it */
+static __poll_t device_poll(struct file* file, poll_table* wait){
+    FileContext* context = file->private_data;
+    Channel* temp = file_channel(context);
+    __poll_t mask = 0;
+    if (temp==NULL){
+        return EPOLLERR;
+    }
+    poll_wait(file, &temp->readers, wait);
+    poll_wait(file, &temp->writers, wait);
+    if (channel_readable(temp, context)){
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (channel_writable(temp, 1)){
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
+    put_channel(temp);
+    return mask;
+}
+
+static void ring_vm_open(struct vm_area_struct* vma){
+    Ring* ring = vma->vm_private_data;
+    atomic_inc(&ring->mappings);
+}
+
+static void ring_vm_close(struct vm_area_struct* vma){
+    Ring* ring = vma->vm_private_data;
+    atomic_dec(&ring->mappings);
+}
+
+static const struct vm_operations_struct ring_vm_ops = {
+    .open           = ring_vm_open,
+    .close          = ring_vm_close,
+};
+
+/* maps the ring of the bound channel (MSG_SLOT_RING) from offset 0: its header page and data. The ring can't be removed while it's mapped */
+static int device_mmap(struct file* file, struct vm_area_struct* vma){
+    FileContext* context = file->private_data;
+    Channel* temp = file_channel(context);
+    Ring* ring;
+    int res;
+    if (temp==NULL){
         return -EINVAL;
     }
-    if (length<=0 || length>BUFFER_SIZE){
-        return -EMSGSIZE;
+    spin_lock(&temp->lock);
+    ring = rcu_dereference_protected(temp->ring, 1);
+    if (ring!=NULL){
+        atomic_inc(&ring->mappings);
     }
-	memcpy(prev_msg, temp->buffer , BUFFER_SIZE);
-    if (copy_from_user(temp->buffer,buffer,length)){ /* copy_from_user returns amount of bytes not successfully written */
-        memcpy(temp->buffer , prev_msg, BUFFER_SIZE); /* atomic writing to the channel */
+    spin_unlock(&temp->lock);
+    put_channel(temp); /* a channel with a ring isn't reclaimed, and the mapping holds the ring */
+    if (ring==NULL){
         return -EINVAL;
     }
-    temp->message_length=length;
-    return (ssize_t)length; /* this is the amount of bytes written because otherwise copy_from_user would have returned something bigger than 0 and we wouldn't have got here */
+    res = vma->vm_pgoff!=0 ? -EINVAL : remap_vmalloc_range(vma, ring->shared, 0);
+    if (res!=0){
+        atomic_dec(&ring->mappings);
+        return res;
+    }
+    vma->vm_private_data = ring;
+    vma->vm_ops = &ring_vm_ops;
+    return 0;
 }
 
-static long device_ioctl(struct file* file, unsigned int ioctl_command_id, unsigned long ioctl_param){
+/* the commands that apply to the bound channel */
+static long bound_channel_ioctl(Channel* channel, FileContext* context, unsigned int ioctl_command_id, unsigned long ioctl_param){
+    switch (ioctl_command_id){
+    case MSG_SLOT_QUEUE:
+        return queue_configure(channel, (struct msg_slot_queue_config __user*)ioctl_param);
+    case MSG_SLOT_QUEUE_STATS:
+        return queue_stats(channel, (struct msg_slot_queue_stats __user*)ioctl_param);
+    case MSG_SLOT_RING:
+        return ring_configure(channel, (struct msg_slot_ring_config __user*)ioctl_param);
+    case MSG_SLOT_RING_WAIT:
+        return ring_wait(channel, ioctl_param);
+    case MSG_SLOT_RING_NOTIFY:
+        wake_readers(channel);
+        wake_writers(channel);
+        return 0;
+    case MSG_SLOT_BROADCAST:
+        return broadcast_configure(channel, (struct msg_slot_broadcast_config __user*)ioctl_param);
+    case MSG_SLOT_BROADCAST_STATS:
+        return broadcast_stats(channel, context, (struct msg_slot_broadcast_stats __user*)ioctl_param);
+    default:
+        return -EINVAL;
+    }
+}
+
+static long channel_ioctl(struct file* file, unsigned int ioctl_command_id, unsigned long ioctl_param){
+    FileContext* context = file->private_data;
     Slot* slot;
-    if (ioctl_command_id!=MSG_SLOT_CHANNEL || ioctl_param<=0){
+    Channel *channel, *old;
+    long res;
+    switch (ioctl_command_id){ /* the commands that name their channels or apply to the slot */
+    case MSG_SLOT_BATCH_WRITE:
+    case MSG_SLOT_BATCH_READ:
+        return channel_batch(get_slot(iminor(file_inode(file))), (struct msg_slot_batch __user*)ioctl_param, ioctl_command_id==MSG_SLOT_BATCH_WRITE);
+    case MSG_SLOT_MEMORY_LIMIT:
+        return slot_configure_memory(get_slot(iminor(file_inode(file))), (struct msg_slot_memory_config __user*)ioctl_param);
+    case MSG_SLOT_MEMORY_STATS:
+        return slot_memory_stats(get_slot(iminor(file_inode(file))), (struct msg_slot_memory_stats __user*)ioctl_param);
+    }
+    if (ioctl_command_id!=MSG_SLOT_CHANNEL){ /* the other commands apply to the bound channel */
+        channel = file_channel(context);
+        if (channel==NULL){
+            return -EINVAL;
+        }
+        res = bound_channel_ioctl(channel, context, ioctl_command_id, ioctl_param);
+        put_channel(channel);
+        return res;
+    }
+    if (ioctl_param<=0){
         return -EINVAL;
     }
     slot = get_slot(iminor(file_inode(file)));
     if (slot==NULL){
         return -1;
     }  
-    file->private_data=get_or_create_channel(slot, ioctl_param);
-    if (file->private_data==NULL){
-        return -1;
-    }  
+    res=get_or_create_channel(slot, ioctl_param, &channel);
+    if (res!=0){
+        return res;
+    }
+    old=bind_file(context, channel); /* the file holds the reference, and starts at the channel's next broadcast message */
+    if (old!=NULL){
+        put_channel(old);
+    }
     return 0;
 }
 
+static long device_ioctl(struct file* file, unsigned int ioctl_command_id, unsigned long ioctl_param){
+    FileContext* context = file->private_data;
+    Channel* channel;
+    long res;
+    if (trace_message_slot_ioctl_enabled()){ /* a concurrent MSG_SLOT_CHANNEL may drop the bound channel, the event holds a reference */
+        channel=file_channel(context);
+        trace_message_slot_ioctl(iminor(file_inode(file)), channel, ioctl_command_id, ioctl_param);
+        if (channel!=NULL){
+            put_channel(channel);
+        }
+    }
+    res=channel_ioctl(file, ioctl_command_id, ioctl_param);
+    trace_message_slot_ioctl_done(iminor(file_inode(file)), ioctl_command_id, res);
+    return res;
+}
 
-int check_if_slot_exists(unsigned int minor_number){
-    Slot* temp;
-    if (module==NULL){ /* first open request for the specific major number */
-        return 2;
+//===================================== DEBUGFS ==============================================//
+static struct dentry* debugfs_root; /* message_slot/<minor>/memory and message_slot/<minor>/channels */
+
+typedef struct channels_cursor{ /* where a read of a slot's channels file is */
+    Slot* slot;
+    unsigned long channel_id; /* of the channel that is shown next */
+    int done;
+}ChannelsCursor;
+
+static const char* channel_mode(Channel* channel){
+    if (rcu_access_pointer(channel->ring)!=NULL){
+        return "ring";
     }
-    temp = module->slots;
-    if (temp==NULL){
+    if (channel->broadcast.depth!=0){
+        return "broadcast";
+    }
+    return channel->queue.depth!=0 ? "queue" : "single";
+}
+
+/* a line per channel, under the header that channels_seq_start shows first */
+static int channels_seq_show(struct seq_file* file, void* entry){
+    Channel* channel = entry;
+    ChannelStats stats, *cpu_stats;
+    unsigned long now = jiffies;
+    int cpu;
+    if (entry==SEQ_START_TOKEN){
+        seq_puts(file, "channel mode messages_written bytes_written messages_read bytes_read wouldblock nospace msgsize waits "
+                       "last_write_ms_ago last_read_ms_ago queued queued_bytes published\n");
+        return 0;
+    }
+    memset(&stats, 0, sizeof(stats));
+    for_each_possible_cpu(cpu){ /* each counter is exact, they aren't a snapshot of the same moment */
+        cpu_stats=per_cpu_ptr(channel->stats, cpu);
+        stats.messages_written+=READ_ONCE(cpu_stats->messages_written);
+        stats.bytes_written+=READ_ONCE(cpu_stats->bytes_written);
+        stats.messages_read+=READ_ONCE(cpu_stats->messages_read);
+        stats.bytes_read+=READ_ONCE(cpu_stats->bytes_read);
+        stats.wouldblock+=READ_ONCE(cpu_stats->wouldblock);
+        stats.nospace+=READ_ONCE(cpu_stats->nospace);
+        stats.msgsize+=READ_ONCE(cpu_stats->msgsize);
+        stats.waits+=READ_ONCE(cpu_stats->waits);
+    }
+    spin_lock(&channel->lock);
+    seq_printf(file, "%lu %s %llu %llu %llu %llu %llu %llu %llu %llu %u %u %u %u %llu\n", channel->channel_id, channel_mode(channel),
+               stats.messages_written, stats.bytes_written, stats.messages_read, stats.bytes_read, stats.wouldblock, stats.nospace,
+               stats.msgsize, stats.waits, jiffies_to_msecs(now - READ_ONCE(channel->last_write)),
+               jiffies_to_msecs(now - READ_ONCE(channel->last_read)), channel->queue.count, channel->queue.bytes, channel->broadcast.head);
+    spin_unlock(&channel->lock);
+    return 0;
+}
+
+/* the channels are walked under rcu_read_lock, from the channel id the previous part of the read stopped at, so a read doesn't hold
+ * the index's lock and a channel that is reclaimed meanwhile is still valid untill the stop. A read that is restarted (*pos 0)
+ * starts from the header */
+static void* channels_seq_start(struct seq_file* file, loff_t* pos){
+    ChannelsCursor* cursor = file->private;
+    rcu_read_lock();
+    if (*pos==0){
+        cursor->channel_id=0;
+        cursor->done=0;
+        return SEQ_START_TOKEN;
+    }
+    return cursor->done ? NULL : xa_find(&cursor->slot->channels, &cursor->channel_id, ULONG_MAX, XA_PRESENT);
+}
+
+static void* channels_seq_next(struct seq_file* file, void* entry, loff_t* pos){
+    ChannelsCursor* cursor = file->private;
+    Channel* channel;
+    (*pos)++;
+    channel = entry==SEQ_START_TOKEN ? xa_find(&cursor->slot->channels, &cursor->channel_id, ULONG_MAX, XA_PRESENT) :
+              xa_find_after(&cursor->slot->channels, &cursor->channel_id, ULONG_MAX, XA_PRESENT);
+    cursor->done = channel==NULL;
+    return channel;
+}
+
+static void channels_seq_stop(struct seq_file* file, void* entry){
+    rcu_read_unlock();
+}
+
+static const struct seq_operations channels_seq_ops = {
+    .start = channels_seq_start,
+    .next = channels_seq_next,
+    .stop = channels_seq_stop,
+    .show = channels_seq_show,
+};
+
+static int channels_open(struct inode* inode, struct file* file){
+    ChannelsCursor* cursor = __seq_open_private(file, &channels_seq_ops, sizeof(ChannelsCursor));
+    if (cursor==NULL){
+        return -ENOMEM;
+    }
+    cursor->slot=inode->i_private;
+    return 0;
+}
+
+static const struct file_operations channels_fops = {
+    .owner = THIS_MODULE,
+    .open = channels_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release_private,
+};
+
+static int slot_memory_show(struct seq_file* file, void* unused){
+    Slot* slot = file->private;
+    seq_printf(file, "memory %lld\nlimit %lu\nchannels %ld\nreclaimed %ld\n", percpu_counter_sum_positive(&slot->memory),
+               READ_ONCE(slot->memory_limit), atomic_long_read(&slot->nr_channels), atomic_long_read(&slot->reclaimed));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(slot_memory);
+
+/* debugfs is best effort: the slot works without its files, so a failed creation is reported and the slot goes on. A slot has a
+ * fixed set of files, the channels are shown by its channels file, so creating or reclaiming a channel doesn't touch debugfs and a
+ * channel id that is reused right after its reclaim can't collide with an old file */
+void slot_debugfs_create(Slot* slot){
+    char name[16];
+    struct dentry* memory;
+    struct dentry* channels;
+    snprintf(name, sizeof(name), "%u", slot->minor_number);
+    slot->debugfs=debugfs_create_dir(name, debugfs_root);
+    if (IS_ERR(slot->debugfs)){
+        printk(KERN_WARNING "message_slot: no debugfs directory for slot %u, error %ld\n", slot->minor_number, PTR_ERR(slot->debugfs));
+        return;
+    }
+    memory=debugfs_create_file("memory", 0444, slot->debugfs, slot, &slot_memory_fops);
+    channels=debugfs_create_file("channels", 0444, slot->debugfs, slot, &channels_fops);
+    if (IS_ERR(memory) || IS_ERR(channels)){
+        printk(KERN_WARNING "message_slot: missing debugfs files for slot %u, error %ld\n", slot->minor_number,
+               PTR_ERR(IS_ERR(memory) ? memory : channels));
+    }
+}
+#else /* the userspace build has no debugfs */
+void slot_debugfs_create(Slot* slot){
+    slot->debugfs=NULL;
+}
+#endif /* MSG_SLOT_USERSPACE */
+
+
+//===================================== CHANNEL FUNCTIONS ==============================================//
+/* A channel holds a single message that every read returns, untill MSG_SLOT_QUEUE gives it a queue: then every write enqueues a
+ * message and every read dequeues the oldest one. MSG_SLOT_BROADCAST gives it a log instead, that every file reads with its own cursor. A write copies the message into a new allocation and then swaps the channel's pointer
+ * to it under the channel's lock, so a message is never torn and a failed copy leaves the channel as it was. The readers of a single
+ * message take a reference to it under RCU instead of the lock, every queue operation takes the lock. */
+
+/* context is the reading file's, or NULL for a read without a cursor, which a broadcast channel refuses */
+ssize_t channel_read(Channel* channel, FileContext* context, char __user* buffer, size_t length, int nonblock){
+    ssize_t res;
+    while (1){
+        if (rcu_access_pointer(channel->ring)!=NULL){ /* its messages are read in place */
+            return -EBUSY;
+        }
+        if (READ_ONCE(channel->broadcast.depth)!=0){
+            res = context!=NULL ? broadcast_read(channel, context, buffer, length) : -EBUSY;
+        }
+        else {
+            res = READ_ONCE(channel->queue.depth)!=0 ? queue_read(channel, buffer, length) : single_read(channel, buffer, length);
+        }
+        if (res!=-EWOULDBLOCK || nonblock){
+            channel_account(channel, res, 0);
+            return res;
+        }
+        this_cpu_inc(channel->stats->waits);
+        if (wait_event_interruptible(channel->readers, channel_readable(channel, context))){
+            return -ERESTARTSYS; /* interrupted by a signal */
+        }
+    }
+}
+
+ssize_t channel_write(Channel* channel, const char __user* buffer, size_t length, int nonblock){
+    Message* message;
+    ssize_t res;
+    if (rcu_access_pointer(channel->ring)!=NULL){
+        return -EBUSY;
+    }
+    if (length<=0 || length>min_t(unsigned int, READ_ONCE(max_message_size), MSG_SLOT_MESSAGE_LIMIT)){
+        channel_account(channel, -EMSGSIZE, 1);
+        return -EMSGSIZE;
+    }
+    message=alloc_message(length);
+    if (message==NULL){
+        return -ENOMEM;
+    }
+    if (copy_from_user(message->data,buffer,length)){ /* copy_from_user returns amount of bytes not successfully written, the channel wasn't touched yet */
+        free_message(message);
+        return -EINVAL;
+    }
+    if (READ_ONCE(channel->broadcast.depth)!=0){ /* every mode charges the message to the slot when it stores it, or frees it */
+        res=broadcast_write(channel, message);
+    }
+    else if (READ_ONCE(channel->queue.depth)==0){
+        res=single_write(channel, message);
+    }
+    else {
+        res=queue_write(channel, message, nonblock);
+    }
+    res = res==0 ? (ssize_t)length : res; /* this is the amount of bytes written because otherwise copy_from_user would have returned something bigger than 0 and we wouldn't have got here */
+    channel_account(channel, res, 1);
+    return res;
+}
+
+/* whether an earlier entry of an ordered batch failed with -EAGAIN on the channel, and adds the channel if add is set. blocked is an
+ * open addressing set of 2^bits channel ids, at least twice the batch's entries, where 0 (never a channel id) is a free bucket */
+static int batch_channel_blocked(__u64* blocked, unsigned int bits, __u64 channel_id, int add){
+    unsigned int i = hash_64(channel_id, bits);
+    while (blocked[i]!=0){
+        if (blocked[i]==channel_id){
+            return 1;
+        }
+        i = (i + 1) & ((1U << bits) - 1);
+    }
+    if (add){
+        blocked[i]=channel_id;
+    }
+    return 0;
+}
+
+/* does every entry of the batch on its channel without blocking, fills in their status and returns how many succeeded */
+long channel_batch(Slot* slot, struct msg_slot_batch __user* user_batch, int write){
+    struct msg_slot_batch batch;
+    struct msg_slot_batch_entry* entries;
+    struct msg_slot_batch_entry __user* user_entries;
+    Channel* channel;
+    __u64* blocked = NULL;
+    ssize_t res;
+    long done = 0;
+    unsigned int i, bits;
+    if (slot==NULL){
+        return -EINVAL;
+    }
+    if (copy_from_user(&batch, user_batch, sizeof(batch))){
+        return -EFAULT;
+    }
+    if (batch.count==0 || batch.count>MSG_SLOT_BATCH_MAX || (batch.flags & ~MSG_SLOT_BATCH_ORDERED)!=0){
+        return -EINVAL;
+    }
+    user_entries = u64_to_user_ptr(batch.entries);
+    entries = kvmalloc_array(batch.count, sizeof(*entries), GFP_KERNEL);
+    if (entries==NULL){
+        return -ENOMEM;
+    }
+    if (copy_from_user(entries, user_entries, batch.count * sizeof(*entries))){
+        kvfree(entries);
+        return -EFAULT;
+    }
+    bits=1;
+    while ((1U << bits) < 2 * batch.count){
+        bits++;
+    }
+    if (batch.flags & MSG_SLOT_BATCH_ORDERED){
+        blocked = kvcalloc(1U << bits, sizeof(*blocked), GFP_KERNEL);
+        if (blocked==NULL){
+            kvfree(entries);
+            return -ENOMEM;
+        }
+    }
+    for (i=0 ; i < batch.count ; i++){
+        channel=NULL;
+        if (entries[i].channel_id==0){
+            res=-EINVAL;
+        }
+        else if (blocked!=NULL && batch_channel_blocked(blocked, bits, entries[i].channel_id, 0)){
+            res=-EAGAIN; /* not tried, an earlier entry of the channel would have blocked */
+        }
+        else if (write){
+            res=get_or_create_channel(slot, entries[i].channel_id, &channel);
+            res = res!=0 ? res : channel_write(channel, u64_to_user_ptr(entries[i].buffer), entries[i].length, 1);
+        }
+        else {
+            channel=get_channel(slot, entries[i].channel_id);
+            res = channel==NULL ? -EWOULDBLOCK : channel_read(channel, NULL, u64_to_user_ptr(entries[i].buffer), entries[i].length, 1);
+        }
+        if (channel!=NULL){
+            put_channel(channel);
+        }
+        if (res==-EAGAIN && blocked!=NULL){
+            batch_channel_blocked(blocked, bits, entries[i].channel_id, 1);
+        }
+        entries[i].status=(__s32)res;
+        done += res >= 0;
+    }
+    res = copy_to_user(user_entries, entries, batch.count * sizeof(*entries)) ? -EFAULT : done;
+    kvfree(blocked);
+    kvfree(entries);
+    return res;
+}
+
+/* whether a read by the file of context wouldn't block, or a consumer of the ring has a message */
+int channel_readable(Channel* channel, FileContext* context){
+    if (rcu_access_pointer(channel->ring)!=NULL){
+        return ring_ready(channel, 0);
+    }
+    if (READ_ONCE(channel->broadcast.depth)!=0){ /* a read without a cursor doesn't block but fails */
+        return context==NULL || READ_ONCE(context->cursor) < READ_ONCE(channel->broadcast.head);
+    }
+    if (READ_ONCE(channel->queue.depth)!=0){
+        return READ_ONCE(channel->queue.count)!=0;
+    }
+    return rcu_access_pointer(channel->message)!=NULL;
+}
+
+/* whether a write of length bytes wouldn't block, which it only does on a full queue with MSG_SLOT_QUEUE_BLOCK */
+int channel_writable(Channel* channel, size_t length){
+    Queue* queue = &channel->queue;
+    unsigned int bytes, capacity;
+    if (rcu_access_pointer(channel->ring)!=NULL){
+        return ring_ready(channel, length);
+    }
+    if (READ_ONCE(queue->depth)==0 || READ_ONCE(queue->policy)!=MSG_SLOT_QUEUE_BLOCK){
         return 1;
     }
-    while (temp!=NULL){
-        if (temp->minor_number==minor_number){
+    bytes = READ_ONCE(queue->bytes);
+    capacity = READ_ONCE(queue->capacity);
+    return READ_ONCE(queue->count) < READ_ONCE(queue->depth) && bytes<=capacity && length<=capacity - bytes; /* read racily, so checked */
+}
+
+/* counts a read or a write that returned res. The time of the last one is only stored when the jiffy changed, so the readers of a
+ * channel don't write to a shared cache line on every read */
+void channel_account(Channel* channel, ssize_t res, int write){
+    unsigned long now;
+    if (res>=0){
+        now=jiffies;
+        if (write){
+            this_cpu_inc(channel->stats->messages_written);
+            this_cpu_add(channel->stats->bytes_written, res);
+        }
+        else {
+            this_cpu_inc(channel->stats->messages_read);
+            this_cpu_add(channel->stats->bytes_read, res);
+        }
+        if (READ_ONCE(*(write ? &channel->last_write : &channel->last_read))!=now){
+            WRITE_ONCE(*(write ? &channel->last_write : &channel->last_read), now);
+        }
+    }
+    else if (res==-EWOULDBLOCK){
+        this_cpu_inc(channel->stats->wouldblock);
+    }
+    else if (res==-ENOSPC){
+        this_cpu_inc(channel->stats->nospace);
+    }
+    else if (res==-EMSGSIZE){
+        this_cpu_inc(channel->stats->msgsize);
+    }
+}
+
+/* wakes the readers and pollers of the channel only, and only if there are any */
+void wake_readers(Channel* channel){
+    if (wq_has_sleeper(&channel->readers)){
+        wake_up_interruptible_poll(&channel->readers, EPOLLIN | EPOLLRDNORM);
+    }
+}
+
+void wake_writers(Channel* channel){
+    if (wq_has_sleeper(&channel->writers)){
+        wake_up_interruptible_poll(&channel->writers, EPOLLOUT | EPOLLWRNORM);
+    }
+}
+
+//===================================== MESSAGE STORAGE ==============================================//
+Message* alloc_message(size_t length){
+    Message* message;
+    unsigned int size_class;
+    for (size_class=0 ; size_class < MESSAGE_SIZE_CLASSES && sizeof(Message) + length > size_classes[size_class] ; size_class++);
+    if (size_class < MESSAGE_SIZE_CLASSES){
+        message=kmem_cache_alloc(message_caches[size_class], GFP_KERNEL);
+    }
+    else {
+        message=kvmalloc(sizeof(Message) + length, GFP_KERNEL);
+    }
+    if (message==NULL){
+        return NULL;
+    }
+    refcount_set(&message->refs, 1);
+    message->slot=NULL;
+    message->size_class=size_class;
+    message->length=length;
+    return message;
+}
+
+/* the bytes the message takes, what's charged to its slot */
+size_t message_memory(Message* message){
+    return message->size_class < MESSAGE_SIZE_CLASSES ? size_classes[message->size_class] : sizeof(Message) + message->length;
+}
+
+/* charges the message to the channel's slot in place of the message it replaces (or NULL), whose charge it takes over, so a channel at
+ * its slot's limit can still replace its messages with ones of the same size. Called with the channel's lock held, returns 0 or -EDQUOT */
+static int charge_message(Channel* channel, Message* message, Message* replaced){
+    size_t credit = replaced!=NULL && replaced->slot!=NULL ? message_memory(replaced) : 0;
+    if (slot_charge_replace(channel->slot, message_memory(message), credit)!=0){
+        return -EDQUOT;
+    }
+    if (replaced!=NULL){
+        replaced->slot=NULL; /* the channel holds it, it isn't freed before the caller drops it */
+    }
+    message->slot=channel->slot; /* uncharged when it's freed */
+    return 0;
+}
+
+void free_message(Message* message){
+    if (message->slot!=NULL){
+        slot_uncharge(message->slot, message_memory(message));
+    }
+    if (message->size_class < MESSAGE_SIZE_CLASSES){
+        kmem_cache_free(message_caches[message->size_class], message);
+    }
+    else {
+        kvfree(message);
+    }
+}
+
+static void free_message_rcu(struct rcu_head* head){
+    free_message(container_of(head, Message, rcu));
+}
+
+/* drops a reference to a message that readers may have found under RCU, it's freed after they are done with rcu_read_lock */
+void put_message(Message* message){
+    if (message!=NULL && refcount_dec_and_test(&message->refs)){
+        call_rcu(&message->rcu, free_message_rcu);
+    }
+}
+
+int create_message_caches(void){
+    char name[32];
+    int i;
+    for (i=0 ; i < MESSAGE_SIZE_CLASSES ; i++){
+        snprintf(name, sizeof(name), "message_slot_%u", size_classes[i]);
+        message_caches[i]=kmem_cache_create(name, size_classes[i], 0, SLAB_HWCACHE_ALIGN, NULL);
+        if (message_caches[i]==NULL){
+            destroy_message_caches();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+void destroy_message_caches(void){
+    int i;
+    rcu_barrier(); /* the messages that wait for a grace period are freed first */
+    for (i=0 ; i < MESSAGE_SIZE_CLASSES ; i++){
+        kmem_cache_destroy(message_caches[i]); /* accepts NULL */
+        message_caches[i]=NULL;
+    }
+}
+
+//===================================== SINGLE MESSAGE AND QUEUE ==============================================//
+ssize_t single_read(Channel* channel, char __user* buffer, size_t length){
+    Message* message;
+    ssize_t res;
+    rcu_read_lock();
+    do { /* a message whose last reference is being dropped was replaced, so the pointer is read again */
+        message=rcu_dereference(channel->message);
+    } while (message!=NULL && !refcount_inc_not_zero(&message->refs));
+    rcu_read_unlock();
+    if (message==NULL){ /* means no one wrote to the channel */
+        return -EWOULDBLOCK;
+    }
+    if (message->length>length){
+        res=-ENOSPC;
+    }
+    else if ( copy_to_user(buffer,message->data, message->length) ) { /* copy_to_user returns amount of bytes not successfully written */
+        res=-EINVAL;
+    }
+    else {
+        res=(ssize_t)message->length;
+    }
+    put_message(message);
+    return res;
+}
+
+/* returns 0, or -EDQUOT and the message is freed */
+int single_write(Channel* channel, Message* message){
+    Message* old;
+    spin_lock(&channel->lock); /* the message is published at once by a pointer swap, so concurrent writers can't tear it */
+    if (charge_message(channel, message, rcu_dereference_protected(channel->message, lockdep_is_held(&channel->lock)))!=0){
+        spin_unlock(&channel->lock);
+        free_message(message);
+        return -EDQUOT;
+    }
+    old=rcu_replace_pointer(channel->message, message, lockdep_is_held(&channel->lock));
+    spin_unlock(&channel->lock);
+    put_message(old); /* the readers that hold the old message keep it untill they copied it */
+    wake_readers(channel);
+    return 0;
+}
+
+/* removes the oldest message of the queue, called with the channel's lock held */
+static Message* queue_pop(Queue* queue){
+    Message* message = queue->messages[queue->head];
+    queue->messages[queue->head] = NULL;
+    queue->head = queue->head + 1==queue->depth ? 0 : queue->head + 1;
+    WRITE_ONCE(queue->count, queue->count - 1);
+    WRITE_ONCE(queue->bytes, queue->bytes - message->length);
+    return message;
+}
+
+/* puts a message that was popped back at the head of the queue, called with the channel's lock held. Returns 0, or -ENOBUFS if the
+ * queue was removed, filled up or made smaller meanwhile, and then the message is lost */
+static int queue_unpop(Queue* queue, Message* message){
+    if (queue->depth==0 || queue->count==queue->depth || message->length>queue->capacity - queue->bytes){
+        return -ENOBUFS;
+    }
+    queue->head = queue->head==0 ? queue->depth - 1 : queue->head - 1;
+    queue->messages[queue->head] = message;
+    WRITE_ONCE(queue->count, queue->count + 1);
+    WRITE_ONCE(queue->bytes, queue->bytes + message->length);
+    return 0;
+}
+
+ssize_t queue_read(Channel* channel, char __user* buffer, size_t length){
+    Queue* queue = &channel->queue;
+    Message* message;
+    ssize_t res;
+    spin_lock(&channel->lock);
+    if (queue->depth==0){ /* the queue was removed meanwhile */
+        spin_unlock(&channel->lock);
+        return single_read(channel, buffer, length);
+    }
+    if (queue->count==0){
+        spin_unlock(&channel->lock);
+        return -EWOULDBLOCK;
+    }
+    if (queue->messages[queue->head]->length>length){ /* the message stays queued for a read with a bigger buffer */
+        spin_unlock(&channel->lock);
+        return -ENOSPC;
+    }
+    message=queue_pop(queue);
+    queue->dequeued++;
+    spin_unlock(&channel->lock);
+    wake_writers(channel);
+    if (copy_to_user(buffer, message->data, message->length)){ /* a faulting buffer doesn't lose the message, it's read again */
+        spin_lock(&channel->lock);
+        if (queue_unpop(queue, message)==0){
+            queue->dequeued--;
+            message=NULL;
+        }
+        spin_unlock(&channel->lock);
+        if (message==NULL){
+            wake_readers(channel);
+        }
+        else {
+            free_message(message);
+        }
+        return -EINVAL;
+    }
+    res=(ssize_t)message->length;
+    free_message(message);
+    return res;
+}
+
+int queue_write(Channel* channel, Message* message, int nonblock){
+    Queue* queue = &channel->queue;
+    Message* dropped;
+    int fits;
+    while (1){
+        spin_lock(&channel->lock);
+        if (queue->depth==0){ /* the queue was removed meanwhile */
+            spin_unlock(&channel->lock);
+            return single_write(channel, message);
+        }
+        if (message->length>queue->capacity){ /* would never fit */
+            spin_unlock(&channel->lock);
+            free_message(message);
+            return -EMSGSIZE;
+        }
+        fits = queue->count<queue->depth && message->length<=queue->capacity - queue->bytes; /* capacity isn't below bytes, so no wrap */
+        if (fits && charge_message(channel, message, NULL)==0){
+            queue->messages[queue->head + queue->count < queue->depth ? queue->head + queue->count : queue->head + queue->count - queue->depth] = message;
+            WRITE_ONCE(queue->count, queue->count + 1);
+            WRITE_ONCE(queue->bytes, queue->bytes + message->length);
+            queue->enqueued++;
+            spin_unlock(&channel->lock);
+            wake_readers(channel);
             return 0;
         }
-        temp=temp->next;
+        if (queue->policy==MSG_SLOT_QUEUE_DROP_OLDEST && queue->count!=0){ /* makes room, or memory, by dropping the oldest messages, one at a time */
+            dropped=queue_pop(queue);
+            queue->dropped++;
+            spin_unlock(&channel->lock);
+            free_message(dropped);
+            continue;
+        }
+        spin_unlock(&channel->lock);
+        if (fits){ /* the queue has room, its slot is at its memory limit */
+            free_message(message);
+            return -EDQUOT;
+        }
+        if (queue->policy==MSG_SLOT_QUEUE_FAIL){
+            free_message(message);
+            return -ENOBUFS;
+        }
+        if (nonblock){
+            free_message(message);
+            return -EAGAIN;
+        }
+        this_cpu_inc(channel->stats->waits);
+        if (wait_event_interruptible(channel->writers, channel_writable(channel, message->length))){
+            free_message(message);
+            return -ERESTARTSYS;
+        }
     }
-    return 1; /* the minor_number wasn't found, meaning there was no open request for the specific minor_number */
 }
 
-int allocate_msg_slot(int minor_number){
-    Slot* temp=kmalloc(sizeof(Slot), GFP_KERNEL);
-    if (temp==NULL){
-        return -1;
+/* gives the channel a queue, changes its limits, or removes it (depth 0). The queued messages are kept, so a queue that isn't empty
+ * can't be removed or made smaller than its content (-EBUSY). The single message of the channel is dropped on every change of mode */
+long queue_configure(Channel* channel, struct msg_slot_queue_config __user* user_config){
+    struct msg_slot_queue_config config;
+    Queue* queue = &channel->queue;
+    Message **messages = NULL, **old_messages, *old_message = NULL;
+    unsigned int i, old_depth;
+    long res;
+    if (copy_from_user(&config, user_config, sizeof(config))){
+        return -EFAULT;
+    }
+    if (config.depth>MSG_SLOT_QUEUE_MAX_DEPTH || config.policy>MSG_SLOT_QUEUE_DROP_OLDEST){
+        return -EINVAL;
+    }
+    if (config.capacity==0){
+        config.capacity=config.depth * BUFFER_SIZE;
     }
-    if (module->slots==NULL){
-        module->slots=temp;
-        temp->next=NULL; /* now there is only one node in module */
+    res=alloc_messages(channel->slot, config.depth, &messages);
+    if (res!=0){
+        return res;
     }
-    else{
-        temp->next=module->slots; /* LIFO*/
-        module->slots=temp;
+    spin_lock(&channel->lock);
+    if (queue->count>config.depth || queue->bytes>config.capacity || rcu_access_pointer(channel->ring)!=NULL || channel->broadcast.depth!=0){
+        spin_unlock(&channel->lock);
+        free_messages(channel->slot, messages, config.depth);
+        return -EBUSY;
     }
-    module->slots->minor_number=minor_number;
-    module->slots->channels=NULL;
+    for (i=0 ; i < queue->count ; i++){ /* the new ring starts at its first entry */
+        messages[i]=queue->messages[queue->head + i < queue->depth ? queue->head + i : queue->head + i - queue->depth];
+    }
+    if ((queue->depth==0)!=(config.depth==0)){
+        old_message=rcu_replace_pointer(channel->message, NULL, lockdep_is_held(&channel->lock));
+    }
+    old_messages=queue->messages;
+    old_depth=queue->depth;
+    queue->messages=messages;
+    queue->head=0;
+    WRITE_ONCE(queue->capacity, config.capacity);
+    WRITE_ONCE(queue->policy, config.policy);
+    WRITE_ONCE(queue->depth, config.depth);
+    spin_unlock(&channel->lock);
+    free_messages(channel->slot, old_messages, old_depth);
+    put_message(old_message);
+    wake_up_interruptible_all(&channel->readers); /* the blocked readers and writers check the channel again */
+    wake_up_interruptible_all(&channel->writers);
     return 0;
 }
 
-Slot* get_slot(int minor_number){
-    Slot* temp = module->slots;
-    if (temp==NULL){
-        return NULL;
+long queue_stats(Channel* channel, struct msg_slot_queue_stats __user* user_stats){
+    struct msg_slot_queue_stats stats;
+    Queue* queue = &channel->queue;
+    spin_lock(&channel->lock);
+    stats.enqueued=queue->enqueued;
+    stats.dequeued=queue->dequeued;
+    stats.dropped=queue->dropped;
+    stats.count=queue->count;
+    stats.bytes=queue->bytes;
+    spin_unlock(&channel->lock);
+    return copy_to_user(user_stats, &stats, sizeof(stats)) ? -EFAULT : 0;
+}
+
+//===================================== BROADCAST ==============================================//
+/* A broadcast channel keeps its last depth messages in a log, numbered by the order they were written, and every file reads them with
+ * its own cursor: the number of the next message it reads. A message is written once into the log and shared by its readers, each takes
+ * a reference to it under the channel's lock and copies it after unlocking, so a write never waits for the readers. A cursor that fell
+ * behind the log is moved to its oldest message when the file reads, and the messages it skipped are counted. */
+
+/* moves a cursor that fell behind the log to its oldest message, called with the channel's lock held */
+static void broadcast_catch_up(Broadcast* broadcast, FileContext* context){
+    if (context->cursor>broadcast->head){ /* subscribed before the channel was rebound, can't happen to a bound file */
+        context->cursor=broadcast->head;
+    }
+    if (context->cursor<broadcast->first){
+        context->missed+=broadcast->first - context->cursor;
+        broadcast->overruns+=broadcast->first - context->cursor;
+        WRITE_ONCE(context->cursor, broadcast->first);
+    }
+}
+
+/* binds the file to the channel, with the caller's reference to it, and subscribes it to the channel's next broadcast message. Returns
+ * the channel the file was bound to, whose reference the caller drops */
+Channel* bind_file(FileContext* context, Channel* channel){
+    Channel* old;
+    spin_lock(&channel->lock);
+    WRITE_ONCE(context->cursor, channel->broadcast.head);
+    context->missed=0;
+    old=xchg(&context->channel, channel); /* a concurrent bind of the same file drops the other old channel */
+    spin_unlock(&channel->lock);
+    return old;
+}
+
+ssize_t broadcast_read(Channel* channel, FileContext* context, char __user* buffer, size_t length){
+    Broadcast* broadcast = &channel->broadcast;
+    Message* message;
+    ssize_t res;
+    spin_lock(&channel->lock);
+    if (broadcast->depth==0){ /* the log was removed meanwhile */
+        spin_unlock(&channel->lock);
+        return READ_ONCE(channel->queue.depth)!=0 ? queue_read(channel, buffer, length) : single_read(channel, buffer, length);
+    }
+    broadcast_catch_up(broadcast, context);
+    if (context->cursor==broadcast->head){
+        spin_unlock(&channel->lock);
+        return -EWOULDBLOCK;
     }
-    while (temp!=NULL){
-        if (temp->minor_number==minor_number){
-            return temp;
+    message=broadcast->messages[context->cursor & (broadcast->depth - 1)];
+    if (message->length>length){ /* the cursor stays for a read with a bigger buffer */
+        spin_unlock(&channel->lock);
+        return -ENOSPC;
+    }
+    refcount_inc(&message->refs); /* the log holds a reference, so it can't drop to 0 */
+    WRITE_ONCE(context->cursor, context->cursor + 1);
+    spin_unlock(&channel->lock);
+    res = copy_to_user(buffer, message->data, message->length) ? -EINVAL : (ssize_t)message->length;
+    put_message(message);
+    return res;
+}
+
+/* returns 0, or -EDQUOT and the message is freed */
+int broadcast_write(Channel* channel, Message* message){
+    Broadcast* broadcast = &channel->broadcast;
+    Message** entry;
+    Message* old = NULL;
+    spin_lock(&channel->lock);
+    if (broadcast->depth==0){ /* the log was removed meanwhile */
+        spin_unlock(&channel->lock);
+        return single_write(channel, message);
+    }
+    entry=&broadcast->messages[broadcast->head & (broadcast->depth - 1)];
+    if (broadcast->head - broadcast->first==broadcast->depth){ /* the log is full, its oldest message is overwritten */
+        old=*entry;
+    }
+    if (charge_message(channel, message, old)!=0){
+        spin_unlock(&channel->lock);
+        free_message(message);
+        return -EDQUOT;
+    }
+    if (old!=NULL){
+        broadcast->first++;
+    }
+    *entry=message;
+    WRITE_ONCE(broadcast->head, broadcast->head + 1);
+    spin_unlock(&channel->lock);
+    put_message(old); /* the readers that are copying it keep it */
+    wake_readers(channel);
+    return 0;
+}
+
+/* gives the channel a log of depth messages, resizes it (keeping its newest messages) or removes it (depth 0). The numbering of the
+ * messages goes on, so the cursors of the subscribed files stay valid. The single message of the channel is dropped on every change of mode */
+long broadcast_configure(Channel* channel, struct msg_slot_broadcast_config __user* user_config){
+    struct msg_slot_broadcast_config config;
+    Broadcast* broadcast = &channel->broadcast;
+    Message **messages = NULL, **old_messages, *old_message = NULL;
+    unsigned long long i, first, old_first;
+    unsigned int old_depth;
+    long res;
+    if (copy_from_user(&config, user_config, sizeof(config))){
+        return -EFAULT;
+    }
+    if (config.depth>MSG_SLOT_BROADCAST_MAX_DEPTH || (config.depth!=0 && !is_power_of_2(config.depth))){
+        return -EINVAL;
+    }
+    res=alloc_messages(channel->slot, config.depth, &messages);
+    if (res!=0){
+        return res;
+    }
+    spin_lock(&channel->lock);
+    if (channel->queue.depth!=0 || rcu_access_pointer(channel->ring)!=NULL){
+        spin_unlock(&channel->lock);
+        free_messages(channel->slot, messages, config.depth);
+        return -EBUSY;
+    }
+    if ((broadcast->depth==0)!=(config.depth==0)){
+        old_message=rcu_replace_pointer(channel->message, NULL, lockdep_is_held(&channel->lock));
+    }
+    old_messages=broadcast->messages;
+    old_depth=broadcast->depth;
+    old_first=broadcast->first;
+    first = broadcast->head - old_first>config.depth ? broadcast->head - config.depth : old_first;
+    for (i=first ; i < broadcast->head ; i++){ /* the newest messages move to the new log */
+        messages[i & (config.depth - 1)]=old_messages[i & (old_depth - 1)];
+    }
+    broadcast->messages=messages;
+    broadcast->first=first;
+    WRITE_ONCE(broadcast->depth, config.depth);
+    spin_unlock(&channel->lock);
+    for (i=old_first ; i < first ; i++){ /* the ones that don't fit are dropped */
+        put_message(old_messages[i & (old_depth - 1)]);
+    }
+    free_messages(channel->slot, old_messages, old_depth);
+    put_message(old_message);
+    wake_up_interruptible_all(&channel->readers); /* the blocked readers and writers check the channel again */
+    wake_up_interruptible_all(&channel->writers);
+    return 0;
+}
+
+long broadcast_stats(Channel* channel, FileContext* context, struct msg_slot_broadcast_stats __user* user_stats){
+    struct msg_slot_broadcast_stats stats;
+    Broadcast* broadcast = &channel->broadcast;
+    memset(&stats, 0, sizeof(stats));
+    spin_lock(&channel->lock);
+    if (broadcast->depth!=0){ /* the messages the file already missed count as soon as they are overwritten */
+        broadcast_catch_up(broadcast, context);
+    }
+    stats.published=broadcast->head;
+    stats.cursor=context->cursor;
+    stats.lag=broadcast->head - context->cursor;
+    stats.missed=context->missed;
+    stats.overruns=broadcast->overruns;
+    stats.depth=broadcast->depth;
+    spin_unlock(&channel->lock);
+    return copy_to_user(user_stats, &stats, sizeof(stats)) ? -EFAULT : 0;
+}
+
+/* whether the ring has a message (space 0) or space free bytes, or the channel has no ring anymore. The ring's head and tail are
+ * written by the userspace producer and consumer, so they are only compared and never used as offsets */
+int ring_ready(Channel* channel, unsigned int space){
+    Ring* ring;
+    __u64 head, tail;
+    int ready = 1;
+    rcu_read_lock();
+    ring = rcu_dereference(channel->ring);
+    if (ring!=NULL){
+        head = READ_ONCE(ring->shared->head);
+        tail = READ_ONCE(ring->shared->tail);
+        ready = space==0 ? head!=tail : ring->size - (head - tail) >= space;
+    }
+    rcu_read_unlock();
+    return ready;
+}
+
+/* sets the flag of the waiting side, that tells the other side to MSG_SLOT_RING_NOTIFY */
+static void ring_set_waiting(Channel* channel, unsigned int space, __u32 waiting){
+    Ring* ring;
+    rcu_read_lock();
+    ring = rcu_dereference(channel->ring);
+    if (ring!=NULL){
+        WRITE_ONCE(*(space==0 ? &ring->shared->consumer_waiting : &ring->shared->producer_waiting), waiting);
+    }
+    rcu_read_unlock();
+}
+
+/* blocks the consumer untill the ring has a message (space 0), or the producer untill it has space free bytes */
+long ring_wait(Channel* channel, unsigned int space){
+    wait_queue_head_t* wait = space==0 ? &channel->readers : &channel->writers;
+    int res;
+    if (rcu_access_pointer(channel->ring)==NULL){
+        return -EINVAL;
+    }
+    ring_set_waiting(channel, space, 1);
+    smp_mb(); /* the flag is set before the ring is checked, and the other side moves the ring before it checks the flag */
+    res = wait_event_interruptible(*wait, ring_ready(channel, space));
+    ring_set_waiting(channel, space, 0);
+    return res ? -ERESTARTSYS : 0;
+}
+
+void free_ring(Ring* ring){
+    if (ring!=NULL){
+        vfree(ring->shared);
+        kfree(ring);
+    }
+}
+
+/* gives the channel a ring of size bytes that is mapped by mmap, resizes it (the messages are dropped) or removes it (size 0). While the
+ * channel has a ring, it isn't read and written by read and write, and it can't have a queue. A mapped ring can't be changed (-EBUSY) */
+long ring_configure(Channel* channel, struct msg_slot_ring_config __user* user_config){
+    struct msg_slot_ring_config config;
+    Ring *ring = NULL, *old;
+    Message* old_message;
+    if (copy_from_user(&config, user_config, sizeof(config))){
+        return -EFAULT;
+    }
+    if (config.size!=0 && (config.size<MSG_SLOT_RING_MIN_SIZE || config.size>MSG_SLOT_RING_MAX_SIZE || !is_power_of_2(config.size))){
+        return -EINVAL;
+    }
+    if (config.size!=0){
+        if (slot_charge(channel->slot, RING_MEMORY(config.size))!=0){
+            return -EDQUOT;
         }
-        temp=temp->next;
+        ring = kmalloc(sizeof(Ring), GFP_KERNEL);
+        if (ring==NULL){
+            slot_uncharge(channel->slot, RING_MEMORY(config.size));
+            return -ENOMEM;
+        }
+        ring->shared = vmalloc_user(MSG_SLOT_RING_DATA_OFFSET + config.size); /* zeroed, so head and tail start at 0 */
+        if (ring->shared==NULL){
+            kfree(ring);
+            slot_uncharge(channel->slot, RING_MEMORY(config.size));
+            return -ENOMEM;
+        }
+        ring->shared->size = config.size;
+        ring->size = config.size;
+        atomic_set(&ring->mappings, 0);
+    }
+    spin_lock(&channel->lock);
+    old = rcu_dereference_protected(channel->ring, lockdep_is_held(&channel->lock));
+    if (channel->queue.depth!=0 || channel->broadcast.depth!=0 || (old!=NULL && atomic_read(&old->mappings)!=0)){
+        spin_unlock(&channel->lock);
+        if (ring!=NULL){
+            slot_uncharge(channel->slot, RING_MEMORY(ring->size));
+        }
+        free_ring(ring);
+        return -EBUSY;
+    }
+    rcu_assign_pointer(channel->ring, ring);
+    old_message=rcu_replace_pointer(channel->message, NULL, lockdep_is_held(&channel->lock));
+    spin_unlock(&channel->lock);
+    put_message(old_message);
+    wake_up_interruptible_all(&channel->readers); /* the waiters check the channel again */
+    wake_up_interruptible_all(&channel->writers);
+    if (old!=NULL){
+        synchronize_rcu(); /* no waiter or poller looks at the old ring anymore */
+        slot_uncharge(channel->slot, RING_MEMORY(old->size));
+        free_ring(old);
     }
-    return NULL;
+    return 0;
 }
 
-void add_channel_to_slot(Slot* slot,Channel* new_channel,int channel_id){
-    Channel *temp;
-    if (slot->channels==NULL){
-        slot->channels=new_channel;
+//===================================== LIFECYCLE AND MEMORY ==============================================//
+/* A channel is referenced by its slot's index and by its users: the files that are bound to it and the calls that use it. A channel
+ * that is idle holds nothing a new channel with its id wouldn't, so when its last user drops its reference, or the shrinker finds it
+ * under memory pressure, it's removed from the index and freed after a grace period, since the lookups don't lock. The reclaimer drops
+ * the index's reference from 1 to 0 and erases the channel under the index's lock, so a channel with users is never reclaimed, and a
+ * lookup that finds a channel with no reference takes the lock once to see the outcome instead of waiting for it. The shrinker only
+ * detaches the channels, in reclaim context, and a work item frees them. */
+
+/* whether the channel holds nothing that would be lost if it were freed and created again: no message, queue, ring or broadcast log,
+ * and no waiter or poller, whose wait queue entries point into it */
+int channel_idle(Channel* channel){
+    return rcu_access_pointer(channel->message)==NULL && READ_ONCE(channel->queue.depth)==0 && rcu_access_pointer(channel->ring)==NULL &&
+           READ_ONCE(channel->broadcast.depth)==0 && !waitqueue_active(&channel->readers) && !waitqueue_active(&channel->writers);
+}
+
+static void free_channel_rcu(struct rcu_head* head){
+    free_channel(container_of(head, Channel, rcu));
+}
+
+/* removes an idle channel that only its slot holds from the slot's index, called under rcu_read_lock. Returns 1 if it was removed, and
+ * the caller reclaims it, 0 if it has a user or isn't idle. A detached channel isn't counted among the slot's channels anymore */
+int detach_channel(Channel* channel){
+    Slot* slot = channel->slot;
+    int res = 0;
+    xa_lock(&slot->channels);
+    if (refcount_dec_if_one(&channel->refs)){
+        smp_mb(); /* the changes of its last user are seen */
+        if (channel_idle(channel)){
+            __xa_erase(&slot->channels, channel->channel_id);
+            atomic_long_dec(&slot->nr_channels);
+            atomic_long_inc(&slot->reclaimed);
+            res = 1;
+        }
+        else {
+            refcount_set(&channel->refs, 1);
+        }
     }
-    else{
-        temp=slot->channels;
-        slot->channels=new_channel;
-        new_channel->next=temp;
+    xa_unlock(&slot->channels);
+    return res;
+}
+
+/* frees a channel that detach_channel removed, after a grace period */
+void reclaim_channel(Channel* channel){
+    call_rcu(&channel->rcu, free_channel_rcu);
+}
+
+/* reclaims a list of detached channels, linked by their reclaim_node */
+void reclaim_channels(struct llist_node* channels){
+    Channel *channel, *next;
+    llist_for_each_entry_safe(channel, next, channels, reclaim_node){
+        reclaim_channel(channel);
     }
 }
 
-Channel* get_or_create_channel(Slot* slot,int channel_id){
-    Channel *channel; Channel *new_channel;
-    if (slot==NULL) return NULL;
-    channel = get_channel(slot, channel_id);
-    if (channel==NULL){ /* no channel wih the specific channel_id exists yet */
-        new_channel=allocate_channel(slot,channel_id);
-        if (new_channel==NULL){ /* allocation failure */
-            return NULL;
+/* drops a reference to the channel, and reclaims it if it's idle and only the slot holds it */
+void put_channel(Channel* channel){
+    int reclaim;
+    rcu_read_lock(); /* once the reference is dropped another put may reclaim the channel, it isn't freed before the unlock */
+    refcount_dec(&channel->refs);
+    reclaim = refcount_read(&channel->refs)==1 && channel_idle(channel) && detach_channel(channel);
+    rcu_read_unlock();
+    if (reclaim){
+        reclaim_channel(channel);
+    }
+}
+
+/* detaches the idle channels among the next *nr_to_scan channels of the slot, from where its last scan stopped, adds them to detached
+ * for the caller to reclaim, and takes the channels it looked at from *nr_to_scan. Returns how many were detached. It doesn't sleep or
+ * free anything, so the shrinker calls it in reclaim context */
+unsigned long detach_idle_channels(Slot* slot, unsigned long* nr_to_scan, struct llist_head* detached){
+    Channel* channel;
+    unsigned long channel_id, cursor = 0, count = 0;
+    rcu_read_lock(); /* a channel that another put reclaims meanwhile isn't freed before the scan moves on */
+    xa_for_each_start(&slot->channels, channel_id, channel, READ_ONCE(slot->reclaim_cursor)){
+        if (*nr_to_scan==0){ /* the next scan goes on from this channel */
+            cursor=channel_id;
+            break;
+        }
+        (*nr_to_scan)--;
+        if (refcount_read(&channel->refs)==1 && channel_idle(channel) && detach_channel(channel)){
+            llist_add(&channel->reclaim_node, detached);
+            count++;
         }
-        add_channel_to_slot(slot, new_channel, channel_id);
-        return new_channel;
     }
-    return channel;
+    rcu_read_unlock();
+    WRITE_ONCE(slot->reclaim_cursor, cursor);
+    return count;
+}
+
+/* detaches and reclaims the idle channels among the next *nr_to_scan channels of the slot, like detach_idle_channels, in process context */
+unsigned long reclaim_idle_channels(Slot* slot, unsigned long* nr_to_scan){
+    LLIST_HEAD(detached);
+    unsigned long reclaimed = detach_idle_channels(slot, nr_to_scan, &detached);
+    reclaim_channels(llist_del_all(&detached));
+    return reclaimed;
 }
-Channel* get_channel(Slot* slot, int channel_id){
-    Channel* channel = slot->channels;
-    while (channel!=NULL){
-        if (channel->channel_id == channel_id){
-            return channel;
+
+/* charges size bytes to the slot, or fails with -EDQUOT if they would take it over its limit */
+int slot_charge(Slot* slot, size_t size){
+    return slot_charge_replace(slot, size, 0);
+}
+
+/* charges size bytes in place of replaced bytes that were charged before, so only a growth can fail with -EDQUOT */
+int slot_charge_replace(Slot* slot, size_t size, size_t replaced){
+    unsigned long limit = READ_ONCE(slot->memory_limit);
+    if (size>replaced && limit!=0 && (size - replaced>limit || percpu_counter_compare(&slot->memory, limit - (size - replaced))>0)){
+        return -EDQUOT;
+    }
+    if (size>=replaced){
+        percpu_counter_add(&slot->memory, size - replaced);
+    }
+    else {
+        percpu_counter_sub(&slot->memory, replaced - size);
+    }
+    return 0;
+}
+
+void slot_uncharge(Slot* slot, size_t size){
+    percpu_counter_sub(&slot->memory, size);
+}
+
+/* the message array of a queue or a broadcast log of depth messages, charged to the slot. Returns 0 (and NULL if depth is 0), -EDQUOT or -ENOMEM */
+long alloc_messages(Slot* slot, unsigned int depth, Message*** messages){
+    *messages=NULL;
+    if (depth==0){
+        return 0;
+    }
+    if (slot_charge(slot, MESSAGES_MEMORY(depth))!=0){
+        return -EDQUOT;
+    }
+    *messages=kvcalloc(depth, sizeof(Message*), GFP_KERNEL);
+    if (*messages==NULL){
+        slot_uncharge(slot, MESSAGES_MEMORY(depth));
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void free_messages(Slot* slot, Message** messages, unsigned int depth){
+    if (messages!=NULL){
+        kvfree(messages);
+        slot_uncharge(slot, MESSAGES_MEMORY(depth));
+    }
+}
+
+long slot_configure_memory(Slot* slot, struct msg_slot_memory_config __user* user_config){
+    struct msg_slot_memory_config config;
+    if (slot==NULL){
+        return -EINVAL;
+    }
+    if (copy_from_user(&config, user_config, sizeof(config))){
+        return -EFAULT;
+    }
+    WRITE_ONCE(slot->memory_limit, config.limit);
+    return 0;
+}
+
+long slot_memory_stats(Slot* slot, struct msg_slot_memory_stats __user* user_stats){
+    struct msg_slot_memory_stats stats;
+    if (slot==NULL){
+        return -EINVAL;
+    }
+    stats.memory=percpu_counter_sum_positive(&slot->memory);
+    stats.limit=READ_ONCE(slot->memory_limit);
+    stats.channels=atomic_long_read(&slot->nr_channels);
+    stats.reclaimed=atomic_long_read(&slot->reclaimed);
+    return copy_to_user(user_stats, &stats, sizeof(stats)) ? -EFAULT : 0;
+}
+
+int allocate_msg_slot(unsigned int minor_number){
+    int res;
+    Slot* temp=kmalloc(sizeof(Slot), GFP_KERNEL);
+    if (temp==NULL){
+        return -ENOMEM;
+    }
+    if (percpu_counter_init(&temp->memory, 0, GFP_KERNEL)!=0){
+        kfree(temp);
+        return -ENOMEM;
+    }
+    temp->minor_number=minor_number;
+    temp->memory_limit=READ_ONCE(default_memory_limit);
+    atomic_long_set(&temp->nr_channels, 0);
+    atomic_long_set(&temp->reclaimed, 0);
+    temp->reclaim_cursor=0;
+    xa_init(&temp->channels);
+    res=xa_insert(&module.slots, minor_number, temp, GFP_KERNEL);
+    if (res!=0){
+        percpu_counter_destroy(&temp->memory);
+        kfree(temp);
+    }
+    else {
+        slot_debugfs_create(temp);
+    }
+    return res==-EBUSY ? 0 : res; /* -EBUSY means a concurrent open of the same minor created the slot first */
+}
+
+/* the lookups are lockless: xa_load walks the index under rcu_read_lock. The slots are only freed when the module is removed, and the
+ * channels a grace period after they were reclaimed */
+Slot* get_slot(unsigned int minor_number){
+    return xa_load(&module.slots, minor_number);
+}
+
+/* returns 0 if the channel was added, -EBUSY if the slot already has a channel with the id, else -ENOMEM */
+int add_channel_to_slot(Slot* slot,Channel* new_channel, unsigned long channel_id){
+    return xa_insert(&slot->channels, channel_id, new_channel, GFP_KERNEL);
+}
+
+/* fills the channel with a reference for the caller, to be dropped with put_channel. Returns 0, or -EDQUOT if the slot is at its
+ * memory limit, else -ENOMEM */
+long get_or_create_channel(Slot* slot, unsigned long channel_id, Channel** channel){
+    Channel *new_channel = NULL;
+    long res = 0;
+    if (slot==NULL) return -EINVAL;
+    while ((*channel = get_channel(slot, channel_id))==NULL){ /* no channel wih the specific channel_id exists yet */
+        if (new_channel==NULL){
+            res=allocate_channel(slot, channel_id, &new_channel);
+            if (res!=0){
+                return res;
+            }
+        }
+        res=add_channel_to_slot(slot, new_channel, channel_id);
+        if (res==0){
+            atomic_long_inc(&slot->nr_channels);
+            *channel=new_channel;
+            return 0;
+        }
+        if (res!=-EBUSY){
+            break;
         }
-        channel=channel->next;
+        /* a concurrent ioctl created the channel first, both use its channel, unless it was reclaimed meanwhile */
+        res=0;
+    }
+    if (new_channel!=NULL){
+        free_channel(new_channel);
     }
-    return NULL;
+    return res;
 }
 
-Channel* allocate_channel(Slot *slot,int channel_id){
-    Channel* temp=kmalloc(sizeof(Channel),GFP_KERNEL);
-    if (temp==NULL) return NULL;
-    temp->next=NULL;
-    temp->message_length=-1;
+/* returns the channel with a reference for the caller, to be dropped with put_channel, or NULL if the slot has no such channel */
+Channel* get_channel(Slot* slot, unsigned long channel_id){
+    Channel* channel;
+    rcu_read_lock();
+    channel=xa_load(&slot->channels, channel_id);
+    if (channel!=NULL && !refcount_inc_not_zero(&channel->refs)){ /* it's being detached */
+        xa_lock(&slot->channels); /* after the detach, that either erased it or gave it back to the slot */
+        channel=xa_load(&slot->channels, channel_id);
+        if (channel!=NULL && !refcount_inc_not_zero(&channel->refs)){
+            channel=NULL;
+        }
+        xa_unlock(&slot->channels);
+    }
+    rcu_read_unlock();
+    return channel;
+}
+
+/* returns 0 and fills the channel, or -EDQUOT if the slot is at its memory limit, else -ENOMEM */
+long allocate_channel(Slot *slot, unsigned long channel_id, Channel** channel){
+    Channel* temp;
+    if (slot_charge(slot, CHANNEL_MEMORY)!=0) return -EDQUOT;
+    temp=kmalloc(sizeof(Channel),GFP_KERNEL);
+    if (temp==NULL){
+        slot_uncharge(slot, CHANNEL_MEMORY);
+        return -ENOMEM;
+    }
+    temp->stats=alloc_percpu(ChannelStats);
+    if (temp->stats==NULL){
+        kfree(temp);
+        slot_uncharge(slot, CHANNEL_MEMORY);
+        return -ENOMEM;
+    }
+    refcount_set(&temp->refs, 2); /* the slot's and the creator's */
+    temp->slot=slot;
+    temp->last_read=temp->last_write=jiffies;
+    spin_lock_init(&temp->lock);
+    init_waitqueue_head(&temp->readers);
+    init_waitqueue_head(&temp->writers);
+    memset(&temp->queue, 0, sizeof(Queue));
+    RCU_INIT_POINTER(temp->ring, NULL);
+    memset(&temp->broadcast, 0, sizeof(Broadcast));
+    RCU_INIT_POINTER(temp->message, NULL); /* an idle channel holds no message storage */
     temp->channel_id=channel_id;
-    return temp;
+    *channel=temp;
+    return 0;
 }
 
 
-void free_all_channels(Channel* channels){
+/* frees a channel and its messages and uncharges them, no one may use it anymore */
+void free_channel(Channel* channel){
+    Ring* ring = rcu_dereference_protected(channel->ring, 1);
+    unsigned long long i;
+    while (channel->queue.count!=0){
+        free_message(queue_pop(&channel->queue));
+    }
+    for (i=channel->broadcast.first ; i < channel->broadcast.head && channel->broadcast.depth!=0 ; i++){
+        put_message(channel->broadcast.messages[i & (channel->broadcast.depth - 1)]);
+    }
+    free_messages(channel->slot, channel->broadcast.messages, channel->broadcast.depth);
+    put_message(rcu_dereference_protected(channel->message, 1));
+    if (ring!=NULL){ /* every mapping was unmapped, they hold the file */
+        slot_uncharge(channel->slot, RING_MEMORY(ring->size));
+        free_ring(ring);
+    }
+    free_messages(channel->slot, channel->queue.messages, channel->queue.depth);
+    free_percpu(channel->stats);
+    slot_uncharge(channel->slot, CHANNEL_MEMORY);
+    kfree(channel);
+}
+
+void free_all_channels(Slot* slot){
     Channel *temp;
-    while (channels!=NULL){
-        temp=channels;
-        channels=channels->next;
-        kfree(temp);
+    unsigned long channel_id;
+    xa_for_each(&slot->channels, channel_id, temp){
+        free_channel(temp);
     }
+    xa_destroy(&slot->channels);
 }
-void free_all_slots_and_channels(Slot* slot){
+void free_all_slots_and_channels(void){
     Slot* temp;
-    while (slot!=NULL){
-        free_all_channels(slot->channels);
-        temp=slot;
-        slot=slot->next;
+    unsigned long minor;
+    xa_for_each(&module.slots, minor, temp){
+        free_all_channels(temp);
+    }
+    rcu_barrier(); /* the messages and reclaimed channels that wait for a grace period uncharge their slots first */
+    xa_for_each(&module.slots, minor, temp){
+        percpu_counter_destroy(&temp->memory);
         kfree(temp);
     }
+    xa_destroy(&module.slots);
 }
 
 
@@ -229,21 +1520,89 @@ void free_all_slots_and_channels(Slot* slot){
 
 
 
+#ifndef MSG_SLOT_USERSPACE
 //==================== DEVICE SETUP =========================//
 struct file_operations Fops = {
+    .owner          = THIS_MODULE, /* a mapping of a ring holds the file, and so the module */
     .read           = device_read,
     .write          = device_write,
     .open           = device_open,
     .release        = device_release,
+    .poll           = device_poll,
+    .mmap           = device_mmap,
     .unlocked_ioctl = device_ioctl,
 };
 
 
 
+/* under memory pressure the idle channels are reclaimed, a slot after the other from where the last scan stopped */
+static struct shrinker* channel_shrinker;
+static unsigned long reclaim_minor;
+static LLIST_HEAD(detached_channels); /* detached by the shrinker, not reclaimed yet */
+static struct workqueue_struct* reclaim_workqueue;
+static void reclaim_detached_channels(struct work_struct* work);
+static DECLARE_WORK(reclaim_work, reclaim_detached_channels);
+
+static unsigned long channel_shrinker_count(struct shrinker* shrinker, struct shrink_control* sc){
+    Slot* slot;
+    unsigned long minor, count = 0;
+    xa_for_each(&module.slots, minor, slot){
+        count+=atomic_long_read(&slot->nr_channels);
+    }
+    return count!=0 ? count : SHRINK_EMPTY;
+}
+
+/* the scan runs in reclaim context, where the allocating task may hold any lock, so it only detaches the idle channels, and they are
+ * reclaimed by a work item. The workqueue has a rescuer, so the reclaim goes on when no worker can be created under memory pressure */
+static void reclaim_detached_channels(struct work_struct* work){
+    reclaim_channels(llist_del_all(&detached_channels));
+}
+
+static unsigned long channel_shrinker_scan(struct shrinker* shrinker, struct shrink_control* sc){
+    Slot* slot;
+    unsigned long minor, nr_to_scan = sc->nr_to_scan, detached = 0;
+    xa_for_each_start(&module.slots, minor, slot, READ_ONCE(reclaim_minor)){
+        detached+=detach_idle_channels(slot, &nr_to_scan, &detached_channels);
+        if (nr_to_scan==0){ /* the slot may have more channels, the next scan goes on from it */
+            break;
+        }
+    }
+    WRITE_ONCE(reclaim_minor, nr_to_scan==0 ? minor : 0);
+    if (detached!=0){
+        queue_work(reclaim_workqueue, &reclaim_work);
+    }
+    sc->nr_scanned=sc->nr_to_scan - nr_to_scan;
+    return detached;
+}
+
 static int __init message_slot_init(void){
+    int res=create_message_caches();
+    if (res!=0){
+        printk(KERN_ERR "Module initialization failed!\n");
+        return res;
+    }
+    debugfs_root=debugfs_create_dir(DEVICE_NAME, NULL);
+    reclaim_workqueue=alloc_workqueue("message_slot_reclaim", WQ_MEM_RECLAIM, 0);
+    channel_shrinker = reclaim_workqueue!=NULL ? shrinker_alloc(0, DEVICE_NAME) : NULL;
+    if (channel_shrinker==NULL){
+        printk(KERN_ERR "Module initialization failed!\n");
+        if (reclaim_workqueue!=NULL){
+            destroy_workqueue(reclaim_workqueue);
+        }
+        debugfs_remove_recursive(debugfs_root);
+        destroy_message_caches();
+        return -ENOMEM;
+    }
+    channel_shrinker->count_objects=channel_shrinker_count;
+    channel_shrinker->scan_objects=channel_shrinker_scan;
+    shrinker_register(channel_shrinker);
     majorNumber=register_chrdev(0, DEVICE_NAME, &Fops);
     if (majorNumber < 0 ){
         printk(KERN_ERR "Module initialization failed!\n");
+        shrinker_free(channel_shrinker);
+        destroy_workqueue(reclaim_workqueue);
+        debugfs_remove_recursive(debugfs_root);
+        destroy_message_caches();
         return majorNumber;
     }
     printk(KERN_INFO "message_slot: registered major number %d\n", majorNumber);
@@ -251,15 +1610,15 @@ static int __init message_slot_init(void){
 } 
 
 static void __exit cleanup(void){
-    if (module!=NULL) {
-        if (module->slots!=NULL){
-            free_all_slots_and_channels(module->slots);
-        }
-        kfree(module);
-    }
+    shrinker_free(channel_shrinker); /* waits for a running scan */
+    destroy_workqueue(reclaim_workqueue); /* runs the pending work first, so every detached channel waits for a grace period */
+    debugfs_remove_recursive(debugfs_root); /* waits for the readers of the slots' files, before the channels are freed */
+    free_all_slots_and_channels();
     unregister_chrdev(majorNumber,DEVICE_NAME);
+    destroy_message_caches(); /* after the channels dropped their messages */
 }
 
 //-------------------------------
 module_init(message_slot_init);
 module_exit(cleanup);
+#endif /* MSG_SLOT_USERSPACE */
@@ -1,27 +1,387 @@
 #ifndef MESSAGE_SLOT_H
 #define MESSAGE_SLOT_H
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
+/* binds the file to a channel of its slot. A read of a channel that has no message yet blocks untill one is written, unless the file
+ * was opened with O_NONBLOCK (-EWOULDBLOCK). poll/epoll report EPOLLIN once the bound channel has a message, and with EPOLLET every new
+ * message wakes the poller, so bind the file before it's added to an epoll set */
 #define MSG_SLOT_CHANNEL _IOW(0, 0, unsigned long)
 #define DEVICE_NAME "message_slot"
-#define BUFFER_SIZE 128
+#define BUFFER_SIZE 128 /* the default size of a message, a write accepts up to the module's max_message_size parameter (64 KiB) */
+#define MSG_SLOT_MESSAGE_LIMIT (1 << 22) /* the bound of max_message_size */
 
-typedef struct channel{ /* linked list of the channels */
-    struct channel* next;
-    char buffer[BUFFER_SIZE];
-    int message_length;
-    int channel_id;
+/* policies of a write to a full queue */
+#define MSG_SLOT_QUEUE_BLOCK 0 /* waits for room, or fails with -EAGAIN if the file was opened with O_NONBLOCK */
+#define MSG_SLOT_QUEUE_FAIL 1 /* fails with -ENOBUFS */
+#define MSG_SLOT_QUEUE_DROP_OLDEST 2 /* drops the oldest messages untill the new one fits */
+#define MSG_SLOT_QUEUE_MAX_DEPTH 65536
+
+struct msg_slot_queue_config{
+    __u32 depth; /* messages the queue holds, 0 removes the queue */
+    __u32 capacity; /* bytes of all the queued messages, 0 means depth * BUFFER_SIZE */
+    __u32 policy; /* MSG_SLOT_QUEUE_* */
+};
+
+struct msg_slot_queue_stats{
+    __u64 enqueued;
+    __u64 dequeued; /* messages that were read */
+    __u64 dropped; /* by MSG_SLOT_QUEUE_DROP_OLDEST */
+    __u32 count; /* messages in the queue */
+    __u32 bytes;
+};
+
+/* gives the bound channel a FIFO queue of messages instead of a single one: a write enqueues a message (see the policies when the queue
+ * is full), and a read dequeues the oldest one or blocks while the queue is empty. A message that is bigger than the read's buffer stays
+ * queued (-ENOSPC), and so does one whose copy to the read's buffer faults. The messages are kept when the limits change, and a queue
+ * that isn't empty can't be removed or shrunk below its content (-EBUSY) */
+#define MSG_SLOT_QUEUE _IOW(0, 1, struct msg_slot_queue_config)
+#define MSG_SLOT_QUEUE_STATS _IOR(0, 2, struct msg_slot_queue_stats)
+
+/*
+ * A ring channel is shared by its producer and consumer through mmap, so messages are written and read in place and the kernel is only
+ * entered to wake a side that waits. MSG_SLOT_RING gives the bound channel a ring of size bytes (a power of 2), and mmap of the file maps
+ * it from offset 0: the struct msg_slot_ring page, followed by the data at MSG_SLOT_RING_DATA_OFFSET. Every message is a record: a
+ * struct msg_slot_ring_record header and the message, padded to 8 bytes. A record never wraps, the producer fills the end of the data
+ * with a MSG_SLOT_RING_PAD record instead. The ring has a single producer and a single consumer (concurrent producers serialize
+ * themselves), and while the channel has a ring, read and write fail with -EBUSY.
+ * MSG_SLOT_RING_WAIT blocks the consumer untill the ring has a message (argument 0), or the producer untill the ring has argument free
+ * bytes, and sets the side's *_waiting flag meanwhile. A side that moved head or tail issues a full barrier and MSG_SLOT_RING_NOTIFY if the
+ * other side is waiting. poll reports EPOLLIN while the ring has a message and EPOLLOUT while it has free space, a side that polls sets
+ * its *_waiting flag itself.
+ */
+#define MSG_SLOT_RING_DATA_OFFSET 4096
+#define MSG_SLOT_RING_MIN_SIZE 4096
+#define MSG_SLOT_RING_MAX_SIZE (1U << 30)
+#define MSG_SLOT_RING_PAD 1 /* flags of a record that fills the end of the data, it has no message */
+#define MSG_SLOT_RING_RECORD(length) (sizeof(struct msg_slot_ring_record) + (((length) + 7) & ~7U))
+
+struct msg_slot_ring_config{
+    __u32 size; /* bytes of data, 0 removes the ring */
+};
+
+struct msg_slot_ring{ /* the header page of a ring */
+    __u32 size; /* bytes of data, set by the kernel */
+    __u32 reserved;
+    __u64 head __attribute__((aligned(64))); /* bytes that were written, only the producer moves it */
+    __u32 consumer_waiting;
+    __u64 tail __attribute__((aligned(64))); /* bytes that were read, only the consumer moves it */
+    __u32 producer_waiting;
+};
+
+struct msg_slot_ring_record{
+    __u32 length; /* of the message, or of the padding */
+    __u32 flags;
+};
+
+#define MSG_SLOT_RING _IOW(0, 3, struct msg_slot_ring_config)
+#define MSG_SLOT_RING_WAIT _IO(0, 4)
+#define MSG_SLOT_RING_NOTIFY _IO(0, 5)
+
+/* reads or writes many channels of the slot in one call, without binding the file to them. Every entry is done like a read or write
+ * of its channel with O_NONBLOCK: a write creates the channel, a read of a channel without a message gets -EWOULDBLOCK. The entries
+ * are independent, the status of each is filled in, and the call returns how many entries succeeded */
+#define MSG_SLOT_BATCH_MAX 1024
+
+/* the flags of struct msg_slot_batch. They were reserved (0) when the batch ioctls were added, so a module from before a flag rejects
+ * it with -EINVAL, and a batch without flags behaves like it always did.
+ * MSG_SLOT_BATCH_ORDERED: once an entry of a channel fails with -EAGAIN, the later entries of the same channel are skipped with -EAGAIN,
+ * so a writer that writes the failed entries again in order keeps the order of every channel's messages */
+#define MSG_SLOT_BATCH_ORDERED 1
+
+struct msg_slot_batch_entry{
+    __u64 channel_id;
+    __u64 buffer; /* a pointer to the message, or to room for it */
+    __u32 length;
+    __s32 status; /* filled with the bytes that were read or written, or a negative errno */
+};
+
+struct msg_slot_batch{
+    __u64 entries; /* a pointer to count struct msg_slot_batch_entry */
+    __u32 count; /* at most MSG_SLOT_BATCH_MAX */
+    __u32 flags; /* 0 or MSG_SLOT_BATCH_ORDERED, the other bits are reserved */
+};
+
+#define MSG_SLOT_BATCH_WRITE _IOW(0, 6, struct msg_slot_batch)
+#define MSG_SLOT_BATCH_READ _IOW(0, 7, struct msg_slot_batch)
+
+/* makes the bound channel a broadcast one: its messages are kept in a log of the last depth messages (a power of 2) that every file
+ * bound to the channel reads with its own cursor. A file subscribes when it's bound (MSG_SLOT_CHANNEL) and reads every message that is
+ * written afterwards once, in order; a read blocks (or fails with -EWOULDBLOCK) once the file read them all, and poll reports EPOLLIN
+ * while it didn't. A file that falls more than depth messages behind skips the overwritten ones and counts them as missed. A message is
+ * stored once however many files read it. Depth 0 removes the log, and a channel with a queue or a ring can't be a broadcast one (-EBUSY).
+ * The batch ioctls have no cursor, they fail on a broadcast channel with -EBUSY */
+#define MSG_SLOT_BROADCAST_MAX_DEPTH 65536
+
+struct msg_slot_broadcast_config{
+    __u32 depth; /* messages the log holds, 0 removes the log */
+};
+
+struct msg_slot_broadcast_stats{ /* of the channel and the calling file */
+    __u64 published; /* messages that were written to the channel */
+    __u64 cursor; /* the number of the file's next message, messages are numbered from 0 */
+    __u64 lag; /* messages the file didn't read yet */
+    __u64 missed; /* messages the file skipped because they were overwritten */
+    __u64 overruns; /* the messages all the files skipped */
+    __u32 depth;
+    __u32 reserved;
+};
+
+#define MSG_SLOT_BROADCAST _IOW(0, 8, struct msg_slot_broadcast_config)
+#define MSG_SLOT_BROADCAST_STATS _IOR(0, 9, struct msg_slot_broadcast_stats)
+
+/* the memory of the file's slot, the file doesn't have to be bound. Everything a slot holds is charged to it: its channels, their
+ * messages (once they're written, untill they're overwritten, read from a queue or dropped), queues, broadcast logs and rings. A write or
+ * a configuration that would take the slot over its limit fails with -EDQUOT, and a new channel isn't created (MSG_SLOT_CHANNEL and a
+ * batch write entry fail with -EDQUOT). A message that replaces another, the single message of a channel or the oldest one of a full
+ * broadcast log, takes over its charge, and a queue that drops its oldest messages drops them to make room under the limit too.
+ * The limit is checked before a charge is added, so concurrent charges may take the slot over it by their own size. A channel that holds
+ * nothing (no message, queue, ring or broadcast log) and isn't bound to a file is freed when its last file is closed or rebound, or
+ * when the system is short of memory, and created again by the next MSG_SLOT_CHANNEL or write to it */
+struct msg_slot_memory_config{
+    __u64 limit; /* bytes, 0 means no limit. A limit below the slot's memory only fails the charges that follow */
+};
+
+struct msg_slot_memory_stats{
+    __u64 memory; /* bytes that are charged to the slot */
+    __u64 limit;
+    __u64 channels;
+    __u64 reclaimed; /* channels that were freed because they held nothing */
+};
+
+#define MSG_SLOT_MEMORY_LIMIT _IOW(0, 10, struct msg_slot_memory_config)
+#define MSG_SLOT_MEMORY_STATS _IOR(0, 11, struct msg_slot_memory_stats)
+
+#ifndef __KERNEL__
+/* the in place access of a mapped ring */
+#include <stddef.h>
+
+static inline char* msg_slot_ring_data(struct msg_slot_ring* ring){
+    return (char*)ring + MSG_SLOT_RING_DATA_OFFSET;
+}
+
+/* returns where the producer writes a message of length bytes (at most size / 2), or NULL if the ring has no room for it yet */
+static inline void* msg_slot_ring_reserve(struct msg_slot_ring* ring, __u32 length){
+    __u64 head = ring->head, tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    __u32 offset = head & (ring->size - 1), until_end = ring->size - offset;
+    struct msg_slot_ring_record* record;
+    if (MSG_SLOT_RING_RECORD(length) > until_end){ /* pads the end of the data and starts over */
+        if (ring->size - (head - tail) < until_end + MSG_SLOT_RING_RECORD(length)){
+            return NULL;
+        }
+        record = (struct msg_slot_ring_record*)(msg_slot_ring_data(ring) + offset);
+        record->length = until_end - sizeof(struct msg_slot_ring_record);
+        record->flags = MSG_SLOT_RING_PAD;
+        head += until_end;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        offset = 0;
+    }
+    else if (ring->size - (head - tail) < MSG_SLOT_RING_RECORD(length)){
+        return NULL;
+    }
+    return msg_slot_ring_data(ring) + offset + sizeof(struct msg_slot_ring_record);
+}
+
+/* the free bytes msg_slot_ring_reserve needs for a message of length bytes, what the producer waits for with MSG_SLOT_RING_WAIT */
+static inline __u32 msg_slot_ring_space_needed(struct msg_slot_ring* ring, __u32 length){
+    __u32 until_end = ring->size - (ring->head & (ring->size - 1));
+    return MSG_SLOT_RING_RECORD(length) > until_end ? until_end + MSG_SLOT_RING_RECORD(length) : MSG_SLOT_RING_RECORD(length);
+}
+
+/* publishes the message of length bytes that was written where msg_slot_ring_reserve returned */
+static inline void msg_slot_ring_commit(struct msg_slot_ring* ring, __u32 length){
+    struct msg_slot_ring_record* record = (struct msg_slot_ring_record*)(msg_slot_ring_data(ring) + (ring->head & (ring->size - 1)));
+    record->length = length;
+    record->flags = 0;
+    __atomic_store_n(&ring->head, ring->head + MSG_SLOT_RING_RECORD(length), __ATOMIC_RELEASE);
+}
+
+/* returns the oldest message and fills its length, or NULL if the ring is empty */
+static inline void* msg_slot_ring_peek(struct msg_slot_ring* ring, __u32* length){
+    __u64 tail = ring->tail, head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    struct msg_slot_ring_record* record;
+    while (tail!=head){
+        record = (struct msg_slot_ring_record*)(msg_slot_ring_data(ring) + (tail & (ring->size - 1)));
+        if (!(record->flags & MSG_SLOT_RING_PAD)){
+            *length = record->length;
+            return (char*)record + sizeof(struct msg_slot_ring_record);
+        }
+        tail += sizeof(struct msg_slot_ring_record) + record->length;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* frees the message that msg_slot_ring_peek returned */
+static inline void msg_slot_ring_release(struct msg_slot_ring* ring, __u32 length){
+    __atomic_store_n(&ring->tail, ring->tail + MSG_SLOT_RING_RECORD(length), __ATOMIC_RELEASE);
+}
+
+/* whether the producer (after moving head) has to MSG_SLOT_RING_NOTIFY the consumer, or the consumer (after moving tail) the producer */
+static inline int msg_slot_ring_consumer_waiting(struct msg_slot_ring* ring){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->consumer_waiting, __ATOMIC_RELAXED);
+}
+
+static inline int msg_slot_ring_producer_waiting(struct msg_slot_ring* ring){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->producer_waiting, __ATOMIC_RELAXED);
+}
+#endif /* __KERNEL__ */
+
+#if defined(__KERNEL__) || defined(MSG_SLOT_USERSPACE) /* the core of message_slot.c, in the module or in its userspace build */
+#ifdef __KERNEL__
+#include <linux/xarray.h>
+#include <linux/spinlock.h>
+#include <linux/refcount.h>
+#include <linux/wait.h>
+#include <linux/percpu_counter.h>
+#include <linux/llist.h>
+#else
+#include "message_slot_shim.h"
+#endif
+
+#define MESSAGE_SIZE_CLASSES 7 /* the caches of 64..4096 bytes messages, including the header */
+
+typedef struct message{ /* the single message of a channel or a queued one */
+    refcount_t refs; /* the channel's and the readers' that are copying it */
+    unsigned int length;
+    struct rcu_head rcu;
+    struct msg_slot* slot; /* that it's charged to, NULL untill it's stored */
+    unsigned char size_class; /* the cache it was allocated from, MESSAGE_SIZE_CLASSES if kvmalloc */
+    char data[];
+}Message;
+
+typedef struct queue{ /* the queue of a channel, a ring of depth messages */
+    Message** messages;
+    unsigned int depth; /* 0 if the channel holds a single message */
+    unsigned int capacity;
+    unsigned int policy;
+    unsigned int head; /* the oldest message */
+    unsigned int count;
+    unsigned int bytes;
+    unsigned long long enqueued;
+    unsigned long long dequeued;
+    unsigned long long dropped;
+}Queue;
+
+typedef struct ring{ /* the ring of a channel */
+    struct msg_slot_ring* shared; /* vmalloc_user memory: the header page and the data */
+    unsigned int size; /* the kernel's copy, the shared one can be changed by userspace */
+    atomic_t mappings;
+}Ring;
+
+typedef struct broadcast{ /* the log of a broadcast channel */
+    Message** messages; /* the message numbered n is messages[n & (depth - 1)] */
+    unsigned int depth; /* a power of 2, 0 if the channel isn't a broadcast one */
+    unsigned long long head; /* the number of the next message, kept when the log changes */
+    unsigned long long first; /* the oldest message of the log */
+    unsigned long long overruns;
+}Broadcast;
+
+typedef struct channel_stats{ /* the counters of a channel, per cpu so the readers don't share a cache line, summed by the slot's channels file */
+    __u64 messages_written;
+    __u64 bytes_written;
+    __u64 messages_read;
+    __u64 bytes_read;
+    __u64 wouldblock; /* reads that found no message, and writes that found a full queue with O_NONBLOCK (-EAGAIN) */
+    __u64 nospace; /* reads with a buffer smaller than the message (-ENOSPC) */
+    __u64 msgsize; /* writes longer than max_message_size or the queue's capacity (-EMSGSIZE) */
+    __u64 waits; /* reads and writes that blocked */
+}ChannelStats;
+
+typedef struct channel{ /* a channel of a slot, indexed by its id in the slot's channels */
+    refcount_t refs; /* the slot's, and its users': the bound files and the calls that use it. 0 once it's being reclaimed */
+    struct rcu_head rcu; /* it's freed after a grace period, the lookups don't lock */
+    struct llist_node reclaim_node; /* on the shrinker's list between its detach and its reclaim */
+    struct msg_slot* slot;
+    spinlock_t lock; /* serializes the writers and the queue, the readers of a single message don't take it */
+    wait_queue_head_t readers; /* readers that wait for a message, and the pollers of the channel */
+    wait_queue_head_t writers; /* writers that wait for room in the queue */
+    Message __rcu* message; /* the single message, NULL untill the first write */
+    unsigned long channel_id;
+    Queue queue;
+    Ring __rcu* ring; /* NULL unless MSG_SLOT_RING gave the channel a ring */
+    Broadcast broadcast;
+    ChannelStats __percpu* stats;
+    unsigned long last_read; /* in jiffies, of the last read or of the channel's creation */
+    unsigned long last_write;
 }Channel;
 
-typedef struct msg_slot { /* linked list of all the slots */
-    struct msg_slot* next;
+typedef struct file_context{ /* the private_data of an open file */
+    Channel* channel; /* the bound channel, NULL untill MSG_SLOT_CHANNEL */
+    unsigned long long cursor; /* the number of the next broadcast message the file reads, under the channel's lock */
+    unsigned long long missed;
+}FileContext;
+
+typedef struct msg_slot { /* a slot per minor number, indexed by the minor in the module's slots */
     unsigned int minor_number;
-    Channel* channels;
+    struct xarray channels;
+    struct dentry* debugfs; /* message_slot/<minor> */
+    struct percpu_counter memory; /* bytes, per cpu so the writers of different channels don't share a cache line */
+    unsigned long memory_limit; /* bytes, 0 if the slot has no limit */
+    atomic_long_t nr_channels;
+    atomic_long_t reclaimed;
+    unsigned long reclaim_cursor; /* the channel id the shrinker goes on from */
 }Slot;
 
 typedef struct msg_module{
-    Slot* slots;
+    struct xarray slots;
 }Module;
 
+int allocate_msg_slot(unsigned int minor_number);
+long get_or_create_channel(Slot* slot, unsigned long channel_id, Channel** channel);
+Slot* get_slot(unsigned int minor_number);
+long allocate_channel(Slot *slot, unsigned long channel_id, Channel** channel);
+Channel* get_channel(Slot* slot, unsigned long channel_id);
+void free_all_slots_and_channels(void);
+int add_channel_to_slot(Slot* slot,Channel* new_channel, unsigned long channel_id);
+void free_all_channels(Slot* slot);
+void free_channel(Channel* channel);
+void put_channel(Channel* channel);
+int detach_channel(Channel* channel);
+void reclaim_channel(Channel* channel);
+void reclaim_channels(struct llist_node* channels);
+int channel_idle(Channel* channel);
+unsigned long detach_idle_channels(Slot* slot, unsigned long* nr_to_scan, struct llist_head* detached);
+unsigned long reclaim_idle_channels(Slot* slot, unsigned long* nr_to_scan);
+int slot_charge(Slot* slot, size_t size);
+int slot_charge_replace(Slot* slot, size_t size, size_t replaced);
+void slot_uncharge(Slot* slot, size_t size);
+long alloc_messages(Slot* slot, unsigned int depth, Message*** messages);
+void free_messages(Slot* slot, Message** messages, unsigned int depth);
+long slot_configure_memory(Slot* slot, struct msg_slot_memory_config __user* user_config);
+long slot_memory_stats(Slot* slot, struct msg_slot_memory_stats __user* user_stats);
+void slot_debugfs_create(Slot* slot);
+ssize_t channel_read(Channel* channel, FileContext* context, char __user* buffer, size_t length, int nonblock);
+ssize_t channel_write(Channel* channel, const char __user* buffer, size_t length, int nonblock);
+int channel_readable(Channel* channel, FileContext* context);
+int channel_writable(Channel* channel, size_t length);
+void wake_readers(Channel* channel);
+void wake_writers(Channel* channel);
+void channel_account(Channel* channel, ssize_t res, int write);
+Message* alloc_message(size_t length);
+size_t message_memory(Message* message);
+void free_message(Message* message);
+void put_message(Message* message);
+int create_message_caches(void);
+void destroy_message_caches(void);
+ssize_t single_read(Channel* channel, char __user* buffer, size_t length);
+int single_write(Channel* channel, Message* message);
+ssize_t queue_read(Channel* channel, char __user* buffer, size_t length);
+int queue_write(Channel* channel, Message* message, int nonblock);
+long queue_configure(Channel* channel, struct msg_slot_queue_config __user* user_config);
+long queue_stats(Channel* channel, struct msg_slot_queue_stats __user* user_stats);
+long ring_configure(Channel* channel, struct msg_slot_ring_config __user* user_config);
+long ring_wait(Channel* channel, unsigned int space);
+int ring_ready(Channel* channel, unsigned int space);
+void free_ring(Ring* ring);
+long channel_batch(Slot* slot, struct msg_slot_batch __user* user_batch, int write);
+ssize_t broadcast_read(Channel* channel, FileContext* context, char __user* buffer, size_t length);
+int broadcast_write(Channel* channel, Message* message);
+long broadcast_configure(Channel* channel, struct msg_slot_broadcast_config __user* user_config);
+long broadcast_stats(Channel* channel, FileContext* context, struct msg_slot_broadcast_stats __user* user_stats);
+Channel* bind_file(FileContext* context, Channel* channel);
+#endif /* __KERNEL__ || MSG_SLOT_USERSPACE */
 
 #endif /* MESSAGE_SLOT */
\ No newline at end of file
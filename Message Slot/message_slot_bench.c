@@ -0,0 +1,439 @@
+/*
+ * message_slot_bench summary:
+ *
+ * Measures the per operation latency of a message slot device as the amount of channels grows, to show that the lookup of a channel
+ * doesn't depend on how many channels the slot has. The channels 1..N are created (and written once) for N = 1, 10, 100, ... up to
+ * --max-channels (10^6 by default), and at every step --ops operations (100000 by default) are done on channels that are picked at
+ * random, so the lookups don't benefit from the order the channels were created in:
+ * ioctl - binding the file to a channel, ioctl_write - binding and writing a message, ioctl_read - binding and reading it back,
+ * batch_write and batch_read - the same writes and reads done BATCH_LENGTH channels per MSG_SLOT_BATCH_WRITE / MSG_SLOT_BATCH_READ.
+ *
+ * With --threads T the scaling of concurrent channels is measured too: 1, 2, 4 ... T threads open the device, bind their own channel
+ * and do --ops writes and reads on it each, so the result shows whether the throughput grows with the threads.
+ *
+ * With --ring BYTES a channel gets a mapped ring of that size (MSG_SLOT_RING), and a producer thread passes --ops messages to the main
+ * thread through it in place, so the result shows the throughput of the ring against the one of write and read.
+ *
+ * Usage: message_slot_bench <device> [--max-channels N] [--ops N] [--threads T] [--ring BYTES]
+ * The results are printed to stdout as one JSON object with a result per step. The slot only reclaims a channel once it's idle, and
+ * every benchmarked channel holds a message, so a device file that was already benchmarked starts with its channels created.
+ * (build: gcc -O2 -pthread message_slot_bench.c -o message_slot_bench)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "message_slot.h"
+
+#define MAX_CHANNELS_DEFAULT 1000000
+#define OPS_DEFAULT 100000
+#define MESSAGE_LENGTH 64
+#define BENCH_SEED 0x4D534C4F54424E43ULL
+#define BATCH_LENGTH 64
+
+#define OP_IOCTL 0
+#define OP_IOCTL_WRITE 1
+#define OP_IOCTL_READ 2
+#define OP_BATCH_WRITE 3
+#define OP_BATCH_READ 4
+#define NUM_OPS 5
+
+static const char* op_names[NUM_OPS] = { "ioctl", "ioctl_write", "ioctl_read", "batch_write", "batch_read" };
+
+typedef struct thread_args{ /* a thread of the scaling run */
+    pthread_t thread;
+    const char* device;
+    unsigned long channel_id;
+    long ops;
+    int failed;
+}ThreadArgs;
+
+typedef struct ring_args{ /* the producer of the ring run */
+    pthread_t thread;
+    int fd;
+    struct msg_slot_ring* ring;
+    long ops;
+    long notifies;
+    int failed;
+}RingArgs;
+
+int parse_arguments(int argc, char** argv, unsigned long* max_channels, long* ops, int* threads, unsigned int* ring_size);
+int run_ring(const char* device, unsigned long channel_id, unsigned int ring_size, long ops);
+void* ring_producer(void* arg);
+int run_threads(const char* device, int threads, unsigned long first_id, long ops, double* ops_per_sec);
+void* thread_ops(void* arg);
+int create_channels(int fd, unsigned long from, unsigned long to);
+int run_ops(int fd, int op, const unsigned long* ids, long ops, double* nanoseconds);
+int run_batches(int fd, int op, const unsigned long* ids, long ops, double* nanoseconds);
+uint64_t next_random(uint64_t* state);
+double now_seconds();
+
+static char message[MESSAGE_LENGTH];
+static volatile unsigned int sink; /* keeps the reads of the ring run alive */
+
+/*
+ * main - creates the channels step by step and times the operations at every step
+ */
+int main(int argc, char** argv){
+    unsigned long max_channels = MAX_CHANNELS_DEFAULT, channels, created = 0, *ids;
+    long ops = OPS_DEFAULT, i;
+    uint64_t state = BENCH_SEED;
+    double start, setup, nanoseconds[NUM_OPS], ops_per_sec;
+    int fd, op, first = 1, threads = 0, t;
+    unsigned int ring_size = 0;
+    if (argc < 2 || parse_arguments(argc, argv, &max_channels, &ops, &threads, &ring_size)==-1){
+        fprintf(stderr, "Usage: %s <device> [--max-channels N] [--ops N] [--threads T] [--ring BYTES]\n", argv[0]);
+        return -1;
+    }
+    fd = open(argv[1], O_RDWR);
+    if (fd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    ids = (unsigned long*)malloc(ops * sizeof(unsigned long));
+    if (ids==NULL){
+        close(fd);
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset(message, 'm', sizeof(message));
+    printf("{\"device\": \"%s\", \"message_length\": %d, \"ops\": %ld, \"results\": [\n", argv[1], MESSAGE_LENGTH, ops);
+    for (channels=1 ; channels <= max_channels ; channels*=10){
+        start = now_seconds();
+        if (create_channels(fd, created + 1, channels)==-1){
+            free(ids);
+            close(fd);
+            return -1;
+        }
+        setup = channels > created ? (now_seconds() - start) * 1e9 / (channels - created) : 0;
+        created = channels;
+        for (i=0 ; i < ops ; i++){
+            ids[i] = 1 + next_random(&state) % channels;
+        }
+        for (op=0 ; op < NUM_OPS ; op++){
+            if (run_ops(fd, op, ids, ops, &nanoseconds[op])==-1){
+                free(ids);
+                close(fd);
+                return -1;
+            }
+        }
+        printf("%s  {\"channels\": %lu, \"create_ns\": %.1f", first ? "" : ",\n", channels, setup);
+        for (op=0 ; op < NUM_OPS ; op++){
+            printf(", \"%s_ns\": %.1f", op_names[op], nanoseconds[op]);
+        }
+        printf("}");
+        fflush(stdout);
+        first = 0;
+    }
+    printf("\n], \"scaling\": [\n");
+    for (t=1 ; t <= threads ; t*=2){ /* the channels after the ones of the steps, so each thread has a channel of its own */
+        if (run_threads(argv[1], t, created + 1, ops, &ops_per_sec)==-1){
+            free(ids);
+            close(fd);
+            return -1;
+        }
+        printf("%s  {\"threads\": %d, \"ops_per_sec\": %.0f}", t==1 ? "" : ",\n", t, ops_per_sec);
+        fflush(stdout);
+    }
+    printf("\n]");
+    if (ring_size!=0 && run_ring(argv[1], created + threads + 1, ring_size, ops)==-1){
+        free(ids);
+        close(fd);
+        return -1;
+    }
+    printf("}\n");
+    free(ids);
+    close(fd);
+    return 0;
+}
+
+/*
+ * parse_arguments - parses the options after the device: [--max-channels N] [--ops N] [--threads T] [--ring BYTES],
+ * returns 0 if successfull, else -1
+ */
+int parse_arguments(int argc, char** argv, unsigned long* max_channels, long* ops, int* threads, unsigned int* ring_size){
+    int i;
+    for (i=2 ; i < argc ; i++){
+        if (strcmp(argv[i], "--max-channels")==0 && i+1 < argc){
+            *max_channels = strtoul(argv[++i], NULL, 10);
+            if (*max_channels < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--ops")==0 && i+1 < argc){
+            *ops = strtol(argv[++i], NULL, 10);
+            if (*ops < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads")==0 && i+1 < argc){
+            *threads = (int) strtol(argv[++i], NULL, 10);
+            if (*threads < 1 || *threads > 1024){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--ring")==0 && i+1 < argc){
+            *ring_size = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (*ring_size < MSG_SLOT_RING_MIN_SIZE || *ring_size > MSG_SLOT_RING_MAX_SIZE || (*ring_size & (*ring_size - 1))!=0){
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * create_channels - creates the channels from..to by binding the file to each of them and writing a message, returns 0 if successfull, else -1
+ */
+int create_channels(int fd, unsigned long from, unsigned long to){
+    unsigned long id;
+    for (id=from ; id <= to ; id++){
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id)==-1 || write(fd, message, MESSAGE_LENGTH)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * run_ops - does an operation on every channel of ids and fills nanoseconds with the average time per operation,
+ * returns 0 if successfull, else -1
+ */
+int run_ops(int fd, int op, const unsigned long* ids, long ops, double* nanoseconds){
+    char buffer[BUFFER_SIZE];
+    double start = now_seconds();
+    long i;
+    if (op==OP_BATCH_WRITE || op==OP_BATCH_READ){
+        return run_batches(fd, op, ids, ops, nanoseconds);
+    }
+    for (i=0 ; i < ops ; i++){
+        if (ioctl(fd, MSG_SLOT_CHANNEL, ids[i])==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+        if ((op==OP_IOCTL_WRITE && write(fd, message, MESSAGE_LENGTH)==-1) || (op==OP_IOCTL_READ && read(fd, buffer, BUFFER_SIZE)==-1)){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+    }
+    *nanoseconds = (now_seconds() - start) * 1e9 / ops;
+    return 0;
+}
+
+/*
+ * run_batches - does the writes or reads of ids BATCH_LENGTH channels per ioctl and fills nanoseconds with the average time per
+ * channel, returns 0 if successfull, else -1
+ */
+int run_batches(int fd, int op, const unsigned long* ids, long ops, double* nanoseconds){
+    static char buffers[BATCH_LENGTH][BUFFER_SIZE];
+    struct msg_slot_batch_entry entries[BATCH_LENGTH];
+    struct msg_slot_batch batch = { (__u64)(uintptr_t)entries, 0, 0 };
+    double start = now_seconds();
+    long i;
+    int j;
+    for (i=0 ; i < ops ; i+=batch.count){
+        batch.count = ops - i < BATCH_LENGTH ? ops - i : BATCH_LENGTH;
+        for (j=0 ; j < (int)batch.count ; j++){
+            entries[j].channel_id = ids[i + j];
+            entries[j].buffer = (__u64)(uintptr_t)(op==OP_BATCH_WRITE ? message : buffers[j]);
+            entries[j].length = op==OP_BATCH_WRITE ? MESSAGE_LENGTH : BUFFER_SIZE;
+        }
+        errno = 0;
+        if (ioctl(fd, op==OP_BATCH_WRITE ? MSG_SLOT_BATCH_WRITE : MSG_SLOT_BATCH_READ, &batch)!=(int)batch.count){ /* every channel has a message */
+            fprintf(stderr, "%s\n", errno ? strerror(errno) : "a batch entry failed");
+            return -1;
+        }
+    }
+    *nanoseconds = (now_seconds() - start) * 1e9 / ops;
+    return 0;
+}
+
+/*
+ * run_threads - runs threads that write and read their own channels concurrently and fills ops_per_sec with the total throughput
+ * (a write and a read are two operations), returns 0 if successfull, else -1
+ */
+int run_threads(const char* device, int threads, unsigned long first_id, long ops, double* ops_per_sec){
+    ThreadArgs* args = (ThreadArgs*)calloc(threads, sizeof(ThreadArgs));
+    double start;
+    int i, started, failed = 0;
+    if (args==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    start = now_seconds();
+    for (started=0 ; started < threads ; started++){
+        args[started].device = device;
+        args[started].channel_id = first_id + started;
+        args[started].ops = ops;
+        errno = pthread_create(&args[started].thread, NULL, thread_ops, &args[started]);
+        if (errno!=0){
+            fprintf(stderr, "%s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+    }
+    for (i=0 ; i < started ; i++){
+        pthread_join(args[i].thread, NULL);
+        failed|=args[i].failed;
+    }
+    *ops_per_sec = 2.0 * ops * threads / (now_seconds() - start);
+    free(args);
+    return failed ? -1 : 0;
+}
+
+/*
+ * thread_ops - a thread of the scaling run: binds its own file to its channel and writes and reads it ops times
+ */
+void* thread_ops(void* arg){
+    ThreadArgs* args = (ThreadArgs*)arg;
+    char buffer[BUFFER_SIZE];
+    long i;
+    int fd = open(args->device, O_RDWR);
+    if (fd==-1 || ioctl(fd, MSG_SLOT_CHANNEL, args->channel_id)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        args->failed = 1;
+        if (fd!=-1){
+            close(fd);
+        }
+        return NULL;
+    }
+    for (i=0 ; i < args->ops ; i++){
+        if (write(fd, message, MESSAGE_LENGTH)==-1 || read(fd, buffer, BUFFER_SIZE)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            args->failed = 1;
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+/*
+ * run_ring - passes ops messages from a producer thread to the calling thread through the mapped ring of a channel, and prints the
+ * result as the "ring" member of the JSON object. Returns 0 if successfull, else -1
+ */
+int run_ring(const char* device, unsigned long channel_id, unsigned int ring_size, long ops){
+    struct msg_slot_ring_config config = { ring_size };
+    RingArgs args;
+    long i, notifies = 0;
+    double start, elapsed;
+    __u32 length;
+    char* data;
+    int failed = 0;
+    memset(&args, 0, sizeof(args));
+    args.ops = ops;
+    args.fd = open(device, O_RDWR);
+    if (args.fd==-1 || ioctl(args.fd, MSG_SLOT_CHANNEL, channel_id)==-1 || ioctl(args.fd, MSG_SLOT_RING, &config)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        if (args.fd!=-1){
+            close(args.fd);
+        }
+        return -1;
+    }
+    args.ring = (struct msg_slot_ring*)mmap(NULL, MSG_SLOT_RING_DATA_OFFSET + ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, args.fd, 0);
+    if (args.ring==MAP_FAILED){
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(args.fd);
+        return -1;
+    }
+    start = now_seconds();
+    errno = pthread_create(&args.thread, NULL, ring_producer, &args);
+    if (errno!=0){
+        fprintf(stderr, "%s\n", strerror(errno));
+        munmap(args.ring, MSG_SLOT_RING_DATA_OFFSET + ring_size);
+        close(args.fd);
+        return -1;
+    }
+    for (i=0 ; i < ops ; i++){ /* the consumer */
+        while ((data = (char*)msg_slot_ring_peek(args.ring, &length))==NULL){
+            if (ioctl(args.fd, MSG_SLOT_RING_WAIT, 0)==-1 && errno!=EINTR){
+                fprintf(stderr, "%s\n", strerror(errno));
+                failed = 1;
+                break;
+            }
+        }
+        if (data==NULL){
+            break;
+        }
+        sink+=(unsigned char)data[length - 1];
+        msg_slot_ring_release(args.ring, length);
+        if (msg_slot_ring_producer_waiting(args.ring)){
+            ioctl(args.fd, MSG_SLOT_RING_NOTIFY);
+            notifies++;
+        }
+    }
+    if (failed){ /* the producer may wait for room that never comes, it ends with the process */
+        return -1;
+    }
+    pthread_join(args.thread, NULL);
+    elapsed = now_seconds() - start;
+    failed|=args.failed;
+    munmap(args.ring, MSG_SLOT_RING_DATA_OFFSET + ring_size);
+    config.size = 0;
+    ioctl(args.fd, MSG_SLOT_RING, &config);
+    close(args.fd);
+    if (!failed){
+        printf(", \"ring\": {\"size\": %u, \"messages\": %ld, \"msgs_per_sec\": %.0f, \"gb_per_sec\": %.3f, \"notifies\": %ld}",
+               ring_size, ops, ops / elapsed, ops * (double)MESSAGE_LENGTH / elapsed / 1e9, notifies + args.notifies);
+    }
+    return failed ? -1 : 0;
+}
+
+/*
+ * ring_producer - writes the messages of the ring run in place, and waits for room when the ring is full
+ */
+void* ring_producer(void* arg){
+    RingArgs* args = (RingArgs*)arg;
+    char* data;
+    long i;
+    for (i=0 ; i < args->ops ; i++){
+        while ((data = (char*)msg_slot_ring_reserve(args->ring, MESSAGE_LENGTH))==NULL){
+            if (ioctl(args->fd, MSG_SLOT_RING_WAIT, msg_slot_ring_space_needed(args->ring, MESSAGE_LENGTH))==-1 && errno!=EINTR){
+                fprintf(stderr, "%s\n", strerror(errno));
+                args->failed = 1;
+                return NULL;
+            }
+        }
+        memcpy(data, message, MESSAGE_LENGTH);
+        msg_slot_ring_commit(args->ring, MESSAGE_LENGTH);
+        if (msg_slot_ring_consumer_waiting(args->ring)){
+            ioctl(args->fd, MSG_SLOT_RING_NOTIFY);
+            args->notifies++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * next_random - the next value of a splitmix64 stream
+ */
+uint64_t next_random(uint64_t* state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * now_seconds - monotonic time in seconds
+ */
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
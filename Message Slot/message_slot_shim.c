@@ -0,0 +1,177 @@
+/*
+ * message_slot_shim summary:
+ *
+ * The RCU and xarray of the userspace build of message_slot.c (see message_slot_shim.h), kept as simple as the harness allows.
+ * RCU: a reader counts itself in one of two counters, the one of the current phase. synchronize_rcu flips the phase and waits for the
+ * readers of the old one to leave, twice, so a reader that picked the old phase just before the flip is waited for too. call_rcu runs
+ * the callback right after a grace period, in the caller, so rcu_barrier has nothing to wait for.
+ * xarray: a sorted array of the entries, every call takes the xarray's mutex.
+ */
+
+#include <sched.h>
+
+#include "message_slot_shim.h"
+
+#define XA_MIN_CAPACITY 16
+
+struct xa_entry{
+    unsigned long index;
+    void* entry;
+};
+
+unsigned long shim_rcu_phase;
+unsigned long shim_rcu_readers[2];
+__thread unsigned long shim_rcu_reader_phase;
+__thread unsigned int shim_rcu_nesting;
+__thread struct xarray* shim_xa_locked;
+
+static pthread_mutex_t synchronize_lock = PTHREAD_MUTEX_INITIALIZER; /* one grace period at a time */
+
+//===================================== RCU ==============================================//
+void synchronize_rcu(void){
+    unsigned long phase;
+    int i;
+    pthread_mutex_lock(&synchronize_lock);
+    for (i=0 ; i < 2 ; i++){
+        phase = __atomic_fetch_xor(&shim_rcu_phase, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&shim_rcu_readers[phase], __ATOMIC_SEQ_CST)!=0){
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&synchronize_lock);
+}
+
+/* the callback runs at once after a grace period, so the caller must not be in a read side section */
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)){
+    if (shim_rcu_nesting!=0){
+        fprintf(stderr, "message_slot_shim: call_rcu in a read side section\n");
+        abort();
+    }
+    synchronize_rcu();
+    func(head);
+}
+
+void rcu_barrier(void){
+}
+
+//===================================== XARRAY ==============================================//
+void xa_init(struct xarray* xa){
+    pthread_mutex_init(&xa->lock, NULL);
+    xa->entries = NULL;
+    xa->count = 0;
+    xa->capacity = 0;
+}
+
+/* the position of the first entry with an index of at least index, with the lock held */
+static unsigned long xa_position(struct xarray* xa, unsigned long index){
+    unsigned long low = 0, high = xa->count, middle;
+    while (low < high){
+        middle = low + (high - low) / 2;
+        if (xa->entries[middle].index < index){
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* locks the xarray, unless the caller already holds its lock with xa_lock */
+static int xa_lock_unless_held(struct xarray* xa){
+    if (shim_xa_locked==xa){
+        return 0;
+    }
+    pthread_mutex_lock(&xa->lock);
+    return 1;
+}
+
+void* xa_load(struct xarray* xa, unsigned long index){
+    unsigned long position;
+    void* entry = NULL;
+    int locked = xa_lock_unless_held(xa);
+    position = xa_position(xa, index);
+    if (position < xa->count && xa->entries[position].index==index){
+        entry = xa->entries[position].entry;
+    }
+    if (locked){
+        pthread_mutex_unlock(&xa->lock);
+    }
+    return entry;
+}
+
+/* returns 0 if the entry was inserted, -EBUSY if the index already has one, else -ENOMEM */
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, int gfp){
+    struct xa_entry* entries;
+    unsigned long position, capacity;
+    int res = 0;
+    pthread_mutex_lock(&xa->lock);
+    position = xa_position(xa, index);
+    if (position < xa->count && xa->entries[position].index==index){
+        res = -EBUSY;
+    }
+    else if (xa->count==xa->capacity){
+        capacity = xa->capacity==0 ? XA_MIN_CAPACITY : xa->capacity * 2;
+        entries = realloc(xa->entries, capacity * sizeof(struct xa_entry));
+        if (entries==NULL){
+            res = -ENOMEM;
+        }
+        else {
+            xa->entries = entries;
+            xa->capacity = capacity;
+        }
+    }
+    if (res==0){
+        memmove(&xa->entries[position + 1], &xa->entries[position], (xa->count - position) * sizeof(struct xa_entry));
+        xa->entries[position].index = index;
+        xa->entries[position].entry = entry;
+        xa->count++;
+    }
+    pthread_mutex_unlock(&xa->lock);
+    return res;
+}
+
+/* removes the entry of the index and returns it */
+void* xa_erase(struct xarray* xa, unsigned long index){
+    void* entry;
+    xa_lock(xa);
+    entry = __xa_erase(xa, index);
+    xa_unlock(xa);
+    return entry;
+}
+
+void* __xa_erase(struct xarray* xa, unsigned long index){
+    unsigned long position = xa_position(xa, index);
+    void* entry;
+    if (position==xa->count || xa->entries[position].index!=index){
+        return NULL;
+    }
+    entry = xa->entries[position].entry;
+    xa->count--;
+    memmove(&xa->entries[position], &xa->entries[position + 1], (xa->count - position) * sizeof(struct xa_entry));
+    return entry;
+}
+
+/* the first entry with an index of at least *index, which is set to the entry's index */
+void* xa_find(struct xarray* xa, unsigned long* index){
+    unsigned long position;
+    void* entry = NULL;
+    int locked = xa_lock_unless_held(xa);
+    position = xa_position(xa, *index);
+    if (position < xa->count){
+        *index = xa->entries[position].index;
+        entry = xa->entries[position].entry;
+    }
+    if (locked){
+        pthread_mutex_unlock(&xa->lock);
+    }
+    return entry;
+}
+
+/* frees the array, not the entries. No one may use the xarray meanwhile, it's empty and usable afterwards */
+void xa_destroy(struct xarray* xa){
+    free(xa->entries);
+    xa->entries = NULL;
+    xa->count = 0;
+    xa->capacity = 0;
+}
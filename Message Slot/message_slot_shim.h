@@ -0,0 +1,331 @@
+#ifndef MESSAGE_SLOT_SHIM_H
+#define MESSAGE_SLOT_SHIM_H
+/* The kernel interfaces that the core of message_slot.c uses, for its userspace build (-DMSG_SLOT_USERSPACE, see the Makefile's lib
+ * target): the allocators are malloc, a user pointer is a plain pointer, a spinlock is a mutex and a wait queue is a condition variable.
+ * RCU and the xarray are in message_slot_shim.c: an RCU reader only bumps a counter, and the xarray is a sorted array behind a mutex.
+ * They are only as fast as a harness needs, the core's own locking is what message_slot_stress exercises. */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <linux/types.h>
+
+#define __user
+#define __rcu
+#define __init
+#define __exit
+#define GFP_KERNEL 0
+#define SLAB_HWCACHE_ALIGN 0
+#define KERN_ERR
+#define KERN_INFO
+#define ERESTARTSYS 512
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+#define __stringify_1(x) #x
+#define __stringify(x) __stringify_1(x)
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, value) __atomic_store_n(&(x), (value), __ATOMIC_RELAXED)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define xchg(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_SEQ_CST)
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+#define is_power_of_2(n) ((n)!=0 && ((n) & ((n) - 1))==0)
+#define GOLDEN_RATIO_64 0x61C8864680B583EBull
+#define hash_64(value, bits) ((unsigned int)(((uint64_t)(value) * GOLDEN_RATIO_64) >> (64 - (bits))))
+#define jiffies shim_jiffies() /* milliseconds, as if HZ were 1000 */
+#define jiffies_to_msecs(j) ((unsigned int)(j))
+
+static inline unsigned long shim_jiffies(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+#define u64_to_user_ptr(x) ((void*)(uintptr_t)(x))
+
+//===================================== MEMORY ==============================================//
+static inline void* kmalloc(size_t size, int flags){
+    return malloc(size);
+}
+
+static inline void* kvmalloc_array(size_t n, size_t size, int flags){
+    return size!=0 && n > SIZE_MAX / size ? NULL : malloc(n * size);
+}
+
+static inline void* kvcalloc(size_t n, size_t size, int flags){
+    return calloc(n, size);
+}
+
+static inline void* vmalloc_user(unsigned long size){
+    void* memory;
+    if (posix_memalign(&memory, 4096, size)!=0){
+        return NULL;
+    }
+    return memset(memory, 0, size);
+}
+
+#define kvmalloc kmalloc
+#define kfree free
+#define kvfree free
+#define vfree free
+
+/* a per cpu variable is a single one that every thread adds to atomically */
+#define __percpu
+#define alloc_percpu(type) ((type*)calloc(1, sizeof(type)))
+#define free_percpu free
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu) for ((cpu)=0 ; (cpu) < 1 ; (cpu)++)
+#define nr_cpu_ids 1
+#define this_cpu_add(var, n) __atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+
+struct percpu_counter{
+    long long count;
+};
+
+static inline int percpu_counter_init(struct percpu_counter* counter, long long value, int flags){
+    counter->count = value;
+    return 0;
+}
+
+#define percpu_counter_destroy(counter) ((void)(counter))
+#define percpu_counter_add(counter, n) ((void)__atomic_add_fetch(&(counter)->count, (n), __ATOMIC_RELAXED))
+#define percpu_counter_sub(counter, n) ((void)__atomic_sub_fetch(&(counter)->count, (n), __ATOMIC_RELAXED))
+
+static inline long long percpu_counter_sum_positive(struct percpu_counter* counter){
+    long long count = __atomic_load_n(&counter->count, __ATOMIC_RELAXED);
+    return count < 0 ? 0 : count;
+}
+
+static inline int percpu_counter_compare(struct percpu_counter* counter, long long value){
+    long long count = __atomic_load_n(&counter->count, __ATOMIC_RELAXED);
+    return count > value ? 1 : count < value ? -1 : 0;
+}
+
+struct kmem_cache{
+    size_t size;
+};
+
+static inline struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align, unsigned int flags, void* ctor){
+    struct kmem_cache* cache = malloc(sizeof(struct kmem_cache));
+    if (cache!=NULL){
+        cache->size = size;
+    }
+    return cache;
+}
+
+static inline void* kmem_cache_alloc(struct kmem_cache* cache, int flags){
+    return malloc(cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache* cache, void* object){
+    free(object);
+}
+
+#define kmem_cache_destroy free
+
+/* the user pointers of the userspace build are the caller's own memory */
+static inline unsigned long copy_to_user(void* to, const void* from, unsigned long n){
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void* to, const void* from, unsigned long n){
+    memcpy(to, from, n);
+    return 0;
+}
+
+//===================================== ATOMICS AND LOCKS ==============================================//
+typedef struct { int counter; } atomic_t;
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_inc(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec(v) __atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+typedef struct { long counter; } atomic_long_t;
+#define atomic_long_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_long_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_long_add_return(i, v) __atomic_add_fetch(&(v)->counter, (i), __ATOMIC_SEQ_CST)
+#define atomic_long_sub(i, v) ((void)__atomic_sub_fetch(&(v)->counter, (i), __ATOMIC_SEQ_CST))
+#define atomic_long_inc(v) ((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_long_dec(v) ((void)__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+
+typedef struct { int refs; } refcount_t;
+#define refcount_set(r, n) __atomic_store_n(&(r)->refs, (n), __ATOMIC_RELAXED)
+#define refcount_inc(r) __atomic_add_fetch(&(r)->refs, 1, __ATOMIC_RELAXED)
+#define refcount_dec(r) ((void)__atomic_sub_fetch(&(r)->refs, 1, __ATOMIC_RELEASE))
+#define refcount_read(r) __atomic_load_n(&(r)->refs, __ATOMIC_RELAXED)
+
+/* drops the last reference only, whoever succeeds owns the object */
+static inline int refcount_dec_if_one(refcount_t* r){
+    int one = 1;
+    return __atomic_compare_exchange_n(&r->refs, &one, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static inline int refcount_dec_and_test(refcount_t* r){
+    return __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL)==0;
+}
+
+static inline int refcount_inc_not_zero(refcount_t* r){
+    int refs = __atomic_load_n(&r->refs, __ATOMIC_RELAXED);
+    do {
+        if (refs==0){
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&r->refs, &refs, refs + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(lock) pthread_mutex_init((lock), NULL)
+#define spin_lock(lock) pthread_mutex_lock(lock)
+#define spin_unlock(lock) pthread_mutex_unlock(lock)
+#define lockdep_is_held(lock) 1
+
+//===================================== RCU ==============================================//
+struct rcu_head{
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+};
+
+extern unsigned long shim_rcu_phase; /* 0 or 1, flipped by synchronize_rcu */
+extern unsigned long shim_rcu_readers[2]; /* the readers that entered their outermost section in each phase */
+extern __thread unsigned long shim_rcu_reader_phase;
+extern __thread unsigned int shim_rcu_nesting;
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head));
+void rcu_barrier(void);
+
+/* counts the reader in the current phase, synchronize_rcu waits for the readers of the phase it flipped away from */
+static inline void rcu_read_lock(void){
+    if (shim_rcu_nesting++==0){
+        shim_rcu_reader_phase = __atomic_load_n(&shim_rcu_phase, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&shim_rcu_readers[shim_rcu_reader_phase], 1, __ATOMIC_SEQ_CST); /* before any pointer of the section is read */
+    }
+}
+
+static inline void rcu_read_unlock(void){
+    if (--shim_rcu_nesting==0){
+        __atomic_sub_fetch(&shim_rcu_readers[shim_rcu_reader_phase], 1, __ATOMIC_RELEASE);
+    }
+}
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_access_pointer(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define rcu_replace_pointer(p, v, c) __atomic_exchange_n(&(p), (v), __ATOMIC_ACQ_REL)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+//===================================== LOCKLESS LISTS ==============================================//
+struct llist_node{
+    struct llist_node* next;
+};
+
+struct llist_head{
+    struct llist_node* first;
+};
+
+#define LLIST_HEAD(name) struct llist_head name = { NULL }
+
+/* returns 1 if the list was empty */
+static inline int llist_add(struct llist_node* node, struct llist_head* head){
+    struct llist_node* first = __atomic_load_n(&head->first, __ATOMIC_RELAXED);
+    do {
+        node->next = first;
+    } while (!__atomic_compare_exchange_n(&head->first, &first, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return first==NULL;
+}
+
+#define llist_del_all(head) __atomic_exchange_n(&(head)->first, NULL, __ATOMIC_ACQUIRE)
+#define llist_entry_or_null(node, type, member) ((node)!=NULL ? container_of((node), type, member) : NULL)
+#define llist_for_each_entry_safe(pos, n, node, member)                                                                  \
+    for ((pos) = llist_entry_or_null((node), typeof(*(pos)), member) ;                                                  \
+         (pos)!=NULL && ((n) = llist_entry_or_null((pos)->member.next, typeof(*(pos)), member), 1) ; (pos) = (n))
+
+//===================================== WAIT QUEUES ==============================================//
+typedef struct wait_queue_head{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int sleepers;
+}wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t* wq){
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    wq->sleepers = 0;
+}
+
+static inline int wq_has_sleeper(wait_queue_head_t* wq){
+    smp_mb(); /* the waker's change is visible before the sleepers are checked, like the waiter's sleepers before its condition */
+    return __atomic_load_n(&wq->sleepers, __ATOMIC_RELAXED)!=0;
+}
+
+#define waitqueue_active(wq) (__atomic_load_n(&(wq)->sleepers, __ATOMIC_RELAXED)!=0)
+
+static inline void shim_wake_up(wait_queue_head_t* wq){
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wake_up_interruptible_poll(wq, mask) shim_wake_up(wq)
+#define wake_up_interruptible_all(wq) shim_wake_up(wq)
+
+/* a userspace waiter isn't interrupted by signals, so it always returns 0 */
+#define wait_event_interruptible(wq, condition) ({                     \
+    pthread_mutex_lock(&(wq).lock);                                     \
+    __atomic_add_fetch(&(wq).sleepers, 1, __ATOMIC_SEQ_CST);            \
+    while (!(condition)){                                               \
+        pthread_cond_wait(&(wq).cond, &(wq).lock);                      \
+    }                                                                   \
+    __atomic_sub_fetch(&(wq).sleepers, 1, __ATOMIC_RELAXED);            \
+    pthread_mutex_unlock(&(wq).lock);                                   \
+    0;                                                                  \
+})
+
+//===================================== XARRAY ==============================================//
+struct xa_entry;
+
+struct xarray{ /* the entries sorted by index, every call takes lock */
+    pthread_mutex_t lock;
+    struct xa_entry* entries;
+    unsigned long count;
+    unsigned long capacity;
+};
+
+#define XARRAY_INIT(name, flags) { .lock = PTHREAD_MUTEX_INITIALIZER, .entries = NULL, .count = 0, .capacity = 0 }
+
+extern __thread struct xarray* shim_xa_locked; /* the xarray whose lock the thread took with xa_lock, xa_load doesn't take it again */
+
+void xa_init(struct xarray* xa);
+void* xa_load(struct xarray* xa, unsigned long index);
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, int gfp);
+void* xa_erase(struct xarray* xa, unsigned long index);
+void* __xa_erase(struct xarray* xa, unsigned long index); /* with the lock held */
+void* xa_find(struct xarray* xa, unsigned long* index);
+void xa_destroy(struct xarray* xa);
+
+static inline void xa_lock(struct xarray* xa){
+    pthread_mutex_lock(&xa->lock);
+    shim_xa_locked = xa;
+}
+
+static inline void xa_unlock(struct xarray* xa){
+    shim_xa_locked = NULL;
+    pthread_mutex_unlock(&xa->lock);
+}
+
+#define xa_for_each_start(xa, index, entry, start) \
+    for ((index) = (start), (entry) = xa_find((xa), &(index)) ; (entry)!=NULL ; (entry) = ++(index)==0 ? NULL : xa_find((xa), &(index)))
+#define xa_for_each(xa, index, entry) xa_for_each_start(xa, index, entry, 0)
+
+#endif /* MESSAGE_SLOT_SHIM_H */
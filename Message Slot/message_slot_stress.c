@@ -0,0 +1,681 @@
+/*
+ * message_slot_stress summary:
+ *
+ * A benchmark and stress harness of the core of message_slot.c, built as a userspace library (libmessage_slot.a, see message_slot_shim.h),
+ * so it runs on any Linux machine without loading the module or root. For N = 1, 10, 100 ... --max-channels channels (10^4 by default)
+ * and T = 1, 2, 4 ... --threads (4 by default), a fresh slot gets N channels, and T producer threads write and T consumer threads read
+ * --ops messages each (100000 by default) on channels that are picked at random, all without blocking.
+ *
+ * Every message carries its channel, its producer, its sequence number and a checksum of its payload, so a consumer detects a torn or
+ * misrouted message (corrupt). With --queue DEPTH the channels get a queue of that depth with MSG_SLOT_QUEUE_FAIL, and after the threads
+ * are done the channels are drained, so every message that was written has to be read exactly once (lost otherwise).
+ *
+ * With --churn LIMIT the runs exercise the lifecycle of the channels instead: a fresh slot gets a memory limit of LIMIT bytes
+ * (MSG_SLOT_MEMORY_LIMIT), and for T = 1, 2, 4 ... --threads, T threads each do --ops cycles on channel ids that are picked at random
+ * among --max-channels: bind a file to the channel, which drops the file's previous channel, give it a queue of one message, write a
+ * message, read it back and remove the queue, so the channel is idle once it's dropped. A cycle that hits the memory limit (-EDQUOT)
+ * or another thread's message (-EBUSY) moves on, and a shrinker thread reclaims idle channels meanwhile. When the threads are done
+ * the channels are emptied and dropped, and the slot's memory (MSG_SLOT_MEMORY_STATS) has to be back to what it was before the run
+ * (leaked otherwise), with reclaimed channels.
+ *
+ * Usage: message_slot_stress [--max-channels N] [--threads T] [--ops N] [--length BYTES] [--queue DEPTH | --churn LIMIT]
+ * The results are printed to stdout as one JSON object with a result per run: the operations per second, the write and read latency
+ * percentiles, the reads of an empty queue and the writes to a full one. The exit status is 1 if a run had corrupt or lost messages,
+ * or leaked memory or reclaimed no channel.
+ * (build: make stress)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "message_slot.h"
+
+#define MAX_CHANNELS_DEFAULT 10000
+#define THREADS_DEFAULT 4
+#define OPS_DEFAULT 100000
+#define LENGTH_DEFAULT 64
+#define LATENCY_BUCKETS 40
+#define STRESS_SEED 0x4D53535452455353ULL
+#define STRESS_MINOR 0
+
+typedef struct message_header{ /* the start of every message */
+    uint64_t channel_id;
+    uint64_t sequence;
+    uint32_t producer;
+    uint32_t checksum; /* of the payload after the header */
+}MessageHeader;
+
+typedef struct worker{ /* a producer or consumer thread of a run */
+    pthread_t thread;
+    Slot* slot;
+    unsigned long channels;
+    long ops;
+    unsigned int length;
+    uint32_t id;
+    int producer;
+    uint64_t state; /* of its random stream */
+    unsigned long long done; /* messages written or read */
+    unsigned long long empty; /* reads of a channel without a message */
+    unsigned long long full; /* writes to a full queue */
+    unsigned long long corrupt;
+    unsigned long long quota; /* cycles that hit the slot's memory limit */
+    unsigned long long busy; /* cycles that found another thread's message in the queue */
+    unsigned long long failed; /* any other error */
+    unsigned long long latency[LATENCY_BUCKETS]; /* ops per power of 2 nanoseconds */
+}Worker;
+
+typedef struct shrinker{ /* the thread that reclaims idle channels during a churn run */
+    pthread_t thread;
+    Slot* slot;
+    int stop;
+    unsigned long long reclaimed;
+}Shrinker;
+
+int parse_arguments(int argc, char** argv, unsigned long* max_channels, int* threads, long* ops, unsigned int* length, unsigned int* depth,
+                    unsigned long* limit);
+int run(unsigned long channels, int threads, long ops, unsigned int length, unsigned int depth, int first);
+int run_churn(unsigned long channels, int threads, long ops, unsigned int length, unsigned long limit, int first);
+Slot* create_slot(unsigned long channels, unsigned int length, unsigned int depth);
+void* worker_ops(void* arg);
+void* worker_churn(void* arg);
+void* shrinker_ops(void* arg);
+unsigned long long empty_channels(Slot* slot, unsigned long channels, unsigned int length, unsigned long long* corrupt);
+unsigned long long slot_memory(Slot* slot, unsigned long long* reclaimed);
+void fill_message(char* buffer, unsigned int length, unsigned long channel_id, uint32_t producer, uint64_t sequence);
+int check_message(const char* buffer, ssize_t length, unsigned int expected, unsigned long channel_id);
+uint32_t checksum(const char* data, unsigned int length);
+unsigned long long drain(Slot* slot, unsigned long channels, unsigned int length, unsigned long long* corrupt);
+unsigned int latency_bucket(unsigned long long nanoseconds);
+unsigned long long latency_percentile(const unsigned long long* latency, double percentile);
+uint64_t next_random(uint64_t* state);
+unsigned long long now_nanoseconds();
+
+/*
+ * main - runs every amount of channels with every amount of threads and prints the results as JSON
+ */
+int main(int argc, char** argv){
+    unsigned long max_channels = MAX_CHANNELS_DEFAULT, channels;
+    unsigned long limit = 0;
+    unsigned int length = LENGTH_DEFAULT, depth = 0;
+    long ops = OPS_DEFAULT;
+    int threads = THREADS_DEFAULT, t, first = 1, status = 0, res;
+    if (parse_arguments(argc, argv, &max_channels, &threads, &ops, &length, &depth, &limit)==-1){
+        fprintf(stderr, "Usage: %s [--max-channels N] [--threads T] [--ops N] [--length BYTES] [--queue DEPTH | --churn LIMIT]\n", argv[0]);
+        return 1;
+    }
+    if (create_message_caches()!=0){
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        return 1;
+    }
+    printf("{\"length\": %u, \"ops\": %ld, \"queue\": %u, \"churn\": %lu, \"results\": [\n", length, ops, depth, limit);
+    for (t=1 ; limit!=0 && t <= threads ; t*=2){
+        res = run_churn(max_channels, t, ops, length, limit, first);
+        if (res==-1){
+            free_all_slots_and_channels();
+            destroy_message_caches();
+            return 1;
+        }
+        status|=res;
+        first = 0;
+    }
+    for (channels=1 ; limit==0 && channels <= max_channels ; channels*=10){
+        for (t=1 ; t <= threads ; t*=2){
+            res = run(channels, t, ops, length, depth, first);
+            if (res==-1){
+                free_all_slots_and_channels();
+                destroy_message_caches();
+                return 1;
+            }
+            status|=res;
+            first = 0;
+        }
+    }
+    printf("\n]}\n");
+    free_all_slots_and_channels();
+    destroy_message_caches();
+    return status;
+}
+
+/*
+ * parse_arguments - parses the command line: [--max-channels N] [--threads T] [--ops N] [--length BYTES] [--queue DEPTH | --churn LIMIT],
+ * returns 0 if successfull, else -1
+ */
+int parse_arguments(int argc, char** argv, unsigned long* max_channels, int* threads, long* ops, unsigned int* length, unsigned int* depth,
+                    unsigned long* limit){
+    int i;
+    for (i=1 ; i < argc ; i++){
+        if (strcmp(argv[i], "--max-channels")==0 && i+1 < argc){
+            *max_channels = strtoul(argv[++i], NULL, 10);
+            if (*max_channels < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads")==0 && i+1 < argc){
+            *threads = (int) strtol(argv[++i], NULL, 10);
+            if (*threads < 1 || *threads > 256){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--ops")==0 && i+1 < argc){
+            *ops = strtol(argv[++i], NULL, 10);
+            if (*ops < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--length")==0 && i+1 < argc){
+            *length = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (*length < sizeof(MessageHeader) || *length > 65536){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--queue")==0 && i+1 < argc){
+            *depth = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (*depth < 1 || *depth > MSG_SLOT_QUEUE_MAX_DEPTH){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--churn")==0 && i+1 < argc){
+            *limit = strtoul(argv[++i], NULL, 10);
+            if (*limit < 1){
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+    return *depth!=0 && *limit!=0 ? -1 : 0;
+}
+
+/*
+ * run - runs threads producers and threads consumers on a fresh slot of channels channels and prints the result,
+ * returns 0 if successfull, 1 if messages were corrupt or lost, else -1
+ */
+int run(unsigned long channels, int threads, long ops, unsigned int length, unsigned int depth, int first){
+    Worker* workers = (Worker*)calloc(2 * threads, sizeof(Worker));
+    Worker total;
+    Slot* slot;
+    unsigned long long start, elapsed, written = 0, read = 0, drained = 0, lost = 0, write_latency[LATENCY_BUCKETS] = { 0 };
+    int i, j, started, failed = 0;
+    if (workers==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    free_all_slots_and_channels(); /* the last run's slot */
+    slot = create_slot(channels, length, depth);
+    if (slot==NULL){
+        free(workers);
+        return -1;
+    }
+    start = now_nanoseconds();
+    for (started=0 ; started < 2 * threads ; started++){
+        workers[started].slot = slot;
+        workers[started].channels = channels;
+        workers[started].ops = ops;
+        workers[started].length = length;
+        workers[started].id = started;
+        workers[started].producer = started % 2==0;
+        workers[started].state = STRESS_SEED + started;
+        errno = pthread_create(&workers[started].thread, NULL, worker_ops, &workers[started]);
+        if (errno!=0){
+            fprintf(stderr, "%s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+    }
+    for (i=0 ; i < started ; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = now_nanoseconds() - start;
+    memset(&total, 0, sizeof(total));
+    for (i=0 ; i < started ; i++){
+        *(workers[i].producer ? &written : &read)+=workers[i].done;
+        total.empty+=workers[i].empty;
+        total.full+=workers[i].full;
+        total.corrupt+=workers[i].corrupt;
+        total.failed+=workers[i].failed;
+        for (j=0 ; j < LATENCY_BUCKETS ; j++){
+            *(workers[i].producer ? &write_latency[j] : &total.latency[j])+=workers[i].latency[j];
+        }
+    }
+    free(workers);
+    if (failed || total.failed!=0){
+        fprintf(stderr, "%llu operations failed\n", total.failed);
+        return -1;
+    }
+    if (depth!=0){ /* every message that was written is read by a consumer or left in its queue */
+        drained = drain(slot, channels, length, &total.corrupt);
+        lost = written - read - drained;
+    }
+    printf("%s  {\"channels\": %lu, \"threads\": %d, \"ops_per_sec\": %.0f, \"writes\": %llu, \"reads\": %llu, \"empty\": %llu, "
+           "\"full\": %llu, \"drained\": %llu, \"corrupt\": %llu, \"lost\": %llu, "
+           "\"write_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}, \"read_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}",
+           first ? "" : ",\n", channels, threads, 2.0 * ops * threads * 1e9 / elapsed, written, read, total.empty, total.full, drained,
+           total.corrupt, lost, latency_percentile(write_latency, 0.5), latency_percentile(write_latency, 0.99),
+           latency_percentile(write_latency, 0.999), latency_percentile(total.latency, 0.5), latency_percentile(total.latency, 0.99),
+           latency_percentile(total.latency, 0.999));
+    fflush(stdout);
+    return total.corrupt!=0 || lost!=0 ? 1 : 0;
+}
+
+/*
+ * run_churn - runs threads churn workers and a shrinker on a fresh slot with a memory limit, over channels channel ids, and prints the
+ * result. Returns 0 if successfull, 1 if messages were corrupt, memory leaked or no channel was reclaimed, else -1
+ */
+int run_churn(unsigned long channels, int threads, long ops, unsigned int length, unsigned long limit, int first){
+    Worker* workers = (Worker*)calloc(threads, sizeof(Worker));
+    struct msg_slot_memory_config config = { limit };
+    Shrinker shrinker;
+    Worker total;
+    unsigned long long start, elapsed, baseline, memory, reclaimed, emptied;
+    int i, j, started, failed = 0;
+    if (workers==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    free_all_slots_and_channels(); /* the last run's slot */
+    memset(&shrinker, 0, sizeof(shrinker));
+    shrinker.slot = allocate_msg_slot(STRESS_MINOR)==0 ? get_slot(STRESS_MINOR) : NULL;
+    if (shrinker.slot==NULL || slot_configure_memory(shrinker.slot, &config)!=0){
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        free(workers);
+        return -1;
+    }
+    baseline = slot_memory(shrinker.slot, &reclaimed);
+    start = now_nanoseconds();
+    errno = pthread_create(&shrinker.thread, NULL, shrinker_ops, &shrinker);
+    if (errno!=0){
+        fprintf(stderr, "%s\n", strerror(errno));
+        free(workers);
+        return -1;
+    }
+    for (started=0 ; started < threads ; started++){
+        workers[started].slot = shrinker.slot;
+        workers[started].channels = channels;
+        workers[started].ops = ops;
+        workers[started].length = length;
+        workers[started].id = started;
+        workers[started].state = STRESS_SEED + started;
+        errno = pthread_create(&workers[started].thread, NULL, worker_churn, &workers[started]);
+        if (errno!=0){
+            fprintf(stderr, "%s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+    }
+    for (i=0 ; i < started ; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    __atomic_store_n(&shrinker.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(shrinker.thread, NULL);
+    elapsed = now_nanoseconds() - start;
+    memset(&total, 0, sizeof(total));
+    for (i=0 ; i < started ; i++){
+        total.done+=workers[i].done;
+        total.empty+=workers[i].empty;
+        total.full+=workers[i].full;
+        total.quota+=workers[i].quota;
+        total.busy+=workers[i].busy;
+        total.corrupt+=workers[i].corrupt;
+        total.failed+=workers[i].failed;
+        for (j=0 ; j < LATENCY_BUCKETS ; j++){
+            total.latency[j]+=workers[i].latency[j];
+        }
+    }
+    free(workers);
+    if (failed || total.failed!=0){
+        fprintf(stderr, "%llu operations failed\n", total.failed);
+        return -1;
+    }
+    config.limit = 0; /* so emptying the channels doesn't hit it */
+    slot_configure_memory(shrinker.slot, &config);
+    emptied = empty_channels(shrinker.slot, channels, length, &total.corrupt);
+    rcu_barrier(); /* the channels and messages that wait for a grace period uncharge the slot first */
+    memory = slot_memory(shrinker.slot, &reclaimed);
+    printf("%s  {\"churn\": %lu, \"channels\": %lu, \"threads\": %d, \"cycles_per_sec\": %.0f, \"done\": %llu, \"quota\": %llu, "
+           "\"busy\": %llu, \"empty\": %llu, \"full\": %llu, \"emptied\": %llu, \"reclaimed\": %llu, \"shrunk\": %llu, \"corrupt\": %llu, "
+           "\"leaked\": %lld, \"cycle_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}",
+           first ? "" : ",\n", limit, channels, threads, (double)ops * threads * 1e9 / elapsed, total.done, total.quota, total.busy,
+           total.empty, total.full, emptied, reclaimed, shrinker.reclaimed, total.corrupt, (long long)(memory - baseline),
+           latency_percentile(total.latency, 0.5), latency_percentile(total.latency, 0.99), latency_percentile(total.latency, 0.999));
+    fflush(stdout);
+    return total.corrupt!=0 || memory!=baseline || reclaimed==0 ? 1 : 0;
+}
+
+/*
+ * create_slot - creates a slot with the channels 1..channels, gives each a queue of depth messages, or a first message if depth is 0
+ * so every read of the run finds one. Returns the slot, or NULL if it failed
+ */
+Slot* create_slot(unsigned long channels, unsigned int length, unsigned int depth){
+    struct msg_slot_queue_config config = { depth, depth * length, MSG_SLOT_QUEUE_FAIL };
+    char* buffer = (char*)malloc(length);
+    Channel* channel;
+    Slot* slot;
+    unsigned long id;
+    long res = allocate_msg_slot(STRESS_MINOR);
+    slot = res==0 ? get_slot(STRESS_MINOR) : NULL;
+    for (id=1 ; slot!=NULL && buffer!=NULL && id <= channels ; id++){
+        res = get_or_create_channel(slot, id, &channel);
+        if (res!=0){
+            break;
+        }
+        if (depth!=0){
+            res = queue_configure(channel, &config);
+        }
+        else {
+            fill_message(buffer, length, id, UINT32_MAX, 0);
+            res = channel_write(channel, buffer, length, 1);
+        }
+        put_channel(channel); /* a channel with a queue or a message isn't reclaimed */
+        if (res < 0){
+            break;
+        }
+    }
+    free(buffer);
+    if (slot==NULL || buffer==NULL || res < 0){
+        fprintf(stderr, "%s\n", strerror(res < 0 ? -res : ENOMEM));
+        return NULL;
+    }
+    return slot;
+}
+
+/*
+ * worker_ops - a producer writes ops messages to random channels, a consumer reads ops times from random channels and checks the messages
+ */
+void* worker_ops(void* arg){
+    Worker* worker = (Worker*)arg;
+    char* buffer = (char*)malloc(worker->length);
+    unsigned long channel_id;
+    unsigned long long start;
+    Channel* channel;
+    ssize_t res;
+    long i;
+    if (buffer==NULL){
+        worker->failed++;
+        return NULL;
+    }
+    for (i=0 ; i < worker->ops ; i++){
+        channel_id = 1 + next_random(&worker->state) % worker->channels;
+        if (worker->producer){
+            fill_message(buffer, worker->length, channel_id, worker->id, (uint64_t)i);
+        }
+        start = now_nanoseconds();
+        channel = get_channel(worker->slot, channel_id);
+        if (worker->producer){
+            res = channel_write(channel, buffer, worker->length, 1);
+        }
+        else {
+            res = channel_read(channel, NULL, buffer, worker->length, 1);
+        }
+        put_channel(channel);
+        worker->latency[latency_bucket(now_nanoseconds() - start)]++;
+        if (res >= 0){
+            worker->done++;
+            if (!worker->producer && !check_message(buffer, res, worker->length, channel_id)){
+                worker->corrupt++;
+            }
+        }
+        else if (res==-EWOULDBLOCK){
+            worker->empty++;
+        }
+        else if (res==-ENOBUFS){
+            worker->full++;
+        }
+        else {
+            worker->failed++;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/*
+ * worker_churn - does ops cycles on random channels: binds its file to the channel, gives it a queue of one message, writes a message,
+ * reads it back and removes the queue, and drops its last channel at the end
+ */
+void* worker_churn(void* arg){
+    Worker* worker = (Worker*)arg;
+    struct msg_slot_queue_config queue = { 1, 0, MSG_SLOT_QUEUE_FAIL }, remove = { 0, 0, MSG_SLOT_QUEUE_FAIL };
+    FileContext context = { NULL, 0, 0 };
+    char* buffer = (char*)malloc(worker->length);
+    unsigned long channel_id;
+    unsigned long long start;
+    Channel *channel, *old;
+    ssize_t res;
+    long i;
+    if (buffer==NULL){
+        worker->failed++;
+        return NULL;
+    }
+    for (i=0 ; i < worker->ops ; i++){
+        channel_id = 1 + next_random(&worker->state) % worker->channels;
+        fill_message(buffer, worker->length, channel_id, worker->id, (uint64_t)i);
+        start = now_nanoseconds();
+        res = get_or_create_channel(worker->slot, channel_id, &channel);
+        if (res==0){
+            old = bind_file(&context, channel); /* the file holds the reference, like MSG_SLOT_CHANNEL */
+            if (old!=NULL){
+                put_channel(old);
+            }
+            res = queue_configure(channel, &queue);
+        }
+        if (res==0){
+            res = channel_write(channel, buffer, worker->length, 1);
+        }
+        if (res >= 0){
+            res = channel_read(channel, NULL, buffer, worker->length, 1);
+            if (res >= 0 && !check_message(buffer, res, worker->length, channel_id)){
+                worker->corrupt++;
+            }
+        }
+        if (res >= 0 || res==-EWOULDBLOCK || res==-ENOBUFS){ /* another thread may have read it, or filled the queue */
+            res = res >= 0 || res==-EWOULDBLOCK ? queue_configure(channel, &remove) : res;
+        }
+        worker->latency[latency_bucket(now_nanoseconds() - start)]++;
+        if (res==0){
+            worker->done++;
+        }
+        else if (res==-EDQUOT){
+            worker->quota++;
+        }
+        else if (res==-EBUSY){
+            worker->busy++;
+        }
+        else if (res==-EWOULDBLOCK){
+            worker->empty++;
+        }
+        else if (res==-ENOBUFS){
+            worker->full++;
+        }
+        else {
+            worker->failed++;
+        }
+    }
+    if (context.channel!=NULL){
+        put_channel(context.channel);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/*
+ * shrinker_ops - reclaims the idle channels of the slot, a few at a time like the module's shrinker, untill it's stopped
+ */
+void* shrinker_ops(void* arg){
+    Shrinker* shrinker = (Shrinker*)arg;
+    unsigned long nr_to_scan;
+    while (!__atomic_load_n(&shrinker->stop, __ATOMIC_RELAXED)){
+        nr_to_scan = 128;
+        shrinker->reclaimed+=reclaim_idle_channels(shrinker->slot, &nr_to_scan);
+        sched_yield();
+    }
+    return NULL;
+}
+
+/*
+ * empty_channels - reads the messages that are left in the queues of the channels and removes the queues, so every channel is reclaimed
+ * once it's dropped. Returns how many messages there were and counts the corrupt ones
+ */
+unsigned long long empty_channels(Slot* slot, unsigned long channels, unsigned int length, unsigned long long* corrupt){
+    struct msg_slot_queue_config queue = { 1, 0, MSG_SLOT_QUEUE_FAIL }, remove = { 0, 0, MSG_SLOT_QUEUE_FAIL };
+    char* buffer = (char*)malloc(length);
+    unsigned long long emptied = 0;
+    unsigned long id;
+    Channel* channel;
+    ssize_t res;
+    if (buffer==NULL){
+        return 0;
+    }
+    for (id=1 ; id <= channels ; id++){
+        channel = get_channel(slot, id);
+        if (channel==NULL){
+            continue;
+        }
+        while (channel->queue.depth!=0 && (res = channel_read(channel, NULL, buffer, length, 1)) >= 0){
+            emptied++;
+            if (!check_message(buffer, res, length, id)){
+                (*corrupt)++;
+            }
+        }
+        queue_configure(channel, &queue); /* a change of mode drops the single message of a cycle that wrote after another removed the queue */
+        queue_configure(channel, &remove);
+        put_channel(channel);
+    }
+    free(buffer);
+    return emptied;
+}
+
+/*
+ * slot_memory - the bytes that are charged to the slot, and fills how many channels were reclaimed
+ */
+unsigned long long slot_memory(Slot* slot, unsigned long long* reclaimed){
+    struct msg_slot_memory_stats stats;
+    *reclaimed = 0;
+    if (slot_memory_stats(slot, &stats)!=0){
+        return 0;
+    }
+    *reclaimed = stats.reclaimed;
+    return stats.memory;
+}
+
+/*
+ * drain - reads every message that is left in the queues of the channels, returns how many there were and counts the corrupt ones
+ */
+unsigned long long drain(Slot* slot, unsigned long channels, unsigned int length, unsigned long long* corrupt){
+    char* buffer = (char*)malloc(length);
+    unsigned long long drained = 0;
+    unsigned long id;
+    Channel* channel;
+    ssize_t res;
+    if (buffer==NULL){
+        return 0;
+    }
+    for (id=1 ; id <= channels ; id++){
+        channel = get_channel(slot, id);
+        while ((res = channel_read(channel, NULL, buffer, length, 1)) >= 0){
+            drained++;
+            if (!check_message(buffer, res, length, id)){
+                (*corrupt)++;
+            }
+        }
+        put_channel(channel);
+    }
+    free(buffer);
+    return drained;
+}
+
+/*
+ * fill_message - writes the header and a payload that depends on the producer and the sequence number
+ */
+void fill_message(char* buffer, unsigned int length, unsigned long channel_id, uint32_t producer, uint64_t sequence){
+    MessageHeader header = { channel_id, sequence, producer, 0 };
+    uint64_t state = sequence ^ ((uint64_t)producer << 40), value;
+    unsigned int i;
+    for (i=sizeof(header) ; i < length ; i+=sizeof(value)){
+        value = next_random(&state);
+        memcpy(buffer + i, &value, length - i < sizeof(value) ? length - i : sizeof(value));
+    }
+    header.checksum = checksum(buffer + sizeof(header), length - sizeof(header));
+    memcpy(buffer, &header, sizeof(header));
+}
+
+/*
+ * check_message - returns 1 if the message has the expected length, was written to the channel and its payload is intact, else 0
+ */
+int check_message(const char* buffer, ssize_t length, unsigned int expected, unsigned long channel_id){
+    MessageHeader header;
+    if (length!=(ssize_t)expected){
+        return 0;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    return header.channel_id==channel_id && header.checksum==checksum(buffer + sizeof(header), expected - sizeof(header));
+}
+
+/*
+ * checksum - FNV-1a of the data, 8 bytes at a time
+ */
+uint32_t checksum(const char* data, unsigned int length){
+    uint64_t hash = 14695981039346656037ULL, value;
+    unsigned int i;
+    for (i=0 ; i < length ; i+=sizeof(value)){
+        value = 0;
+        memcpy(&value, data + i, length - i < sizeof(value) ? length - i : sizeof(value));
+        hash = (hash ^ value) * 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/*
+ * latency_bucket - the bucket of an operation that took nanoseconds: the bucket b counts the ones below 2^b nanoseconds
+ */
+unsigned int latency_bucket(unsigned long long nanoseconds){
+    unsigned int bucket = nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0;
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/*
+ * latency_percentile - the upper bound in nanoseconds of the bucket that holds the given percentile (0..1) of the operations
+ */
+unsigned long long latency_percentile(const unsigned long long* latency, double percentile){
+    unsigned long long total = 0, seen = 0, target;
+    int i;
+    for (i=0 ; i < LATENCY_BUCKETS ; i++){
+        total+=latency[i];
+    }
+    if (total==0){
+        return 0;
+    }
+    target = (unsigned long long)(percentile * total);
+    for (i=0 ; i < LATENCY_BUCKETS - 1 ; i++){
+        seen+=latency[i];
+        if (seen > target){
+            break;
+        }
+    }
+    return 1ULL << i;
+}
+
+/*
+ * next_random - the next value of a splitmix64 stream
+ */
+uint64_t next_random(uint64_t* state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * now_nanoseconds - monotonic time in nanoseconds
+ */
+unsigned long long now_nanoseconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
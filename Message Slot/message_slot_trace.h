@@ -0,0 +1,108 @@
+/* the tracepoints of message_slot, in /sys/kernel/tracing/events/message_slot. Every read, write and ioctl of the device has an event
+ * when it starts and a *_done event with its result, so the latency of an operation is the time between the two of the same task, e.g.
+ * bpftrace -e 'tracepoint:message_slot:message_slot_read { @start[tid] = nsecs; }
+ *              tracepoint:message_slot:message_slot_read_done /@start[tid]/ { @ns = hist(nsecs - @start[tid]); delete(@start[tid]); }'
+ * A disabled tracepoint is a patched out branch, its arguments aren't even evaluated */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM message_slot
+
+#if !defined(MESSAGE_SLOT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define MESSAGE_SLOT_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "message_slot.h"
+
+DECLARE_EVENT_CLASS(message_slot_io,
+    TP_PROTO(unsigned int minor, Channel* channel, size_t length),
+    TP_ARGS(minor, channel, length),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned long, channel_id) /* 0 if the file isn't bound to a channel */
+        __field(size_t, length)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel_id = channel!=NULL ? channel->channel_id : 0;
+        __entry->length = length;
+    ),
+    TP_printk("minor=%u channel=%lu length=%zu", __entry->minor, __entry->channel_id, __entry->length)
+);
+
+DEFINE_EVENT(message_slot_io, message_slot_read,
+    TP_PROTO(unsigned int minor, Channel* channel, size_t length),
+    TP_ARGS(minor, channel, length)
+);
+
+DEFINE_EVENT(message_slot_io, message_slot_write,
+    TP_PROTO(unsigned int minor, Channel* channel, size_t length),
+    TP_ARGS(minor, channel, length)
+);
+
+DECLARE_EVENT_CLASS(message_slot_io_done,
+    TP_PROTO(unsigned int minor, Channel* channel, ssize_t res),
+    TP_ARGS(minor, channel, res),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned long, channel_id)
+        __field(ssize_t, res) /* the bytes that were read or written, or a negative errno */
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel_id = channel!=NULL ? channel->channel_id : 0;
+        __entry->res = res;
+    ),
+    TP_printk("minor=%u channel=%lu res=%zd", __entry->minor, __entry->channel_id, __entry->res)
+);
+
+DEFINE_EVENT(message_slot_io_done, message_slot_read_done,
+    TP_PROTO(unsigned int minor, Channel* channel, ssize_t res),
+    TP_ARGS(minor, channel, res)
+);
+
+DEFINE_EVENT(message_slot_io_done, message_slot_write_done,
+    TP_PROTO(unsigned int minor, Channel* channel, ssize_t res),
+    TP_ARGS(minor, channel, res)
+);
+
+TRACE_EVENT(message_slot_ioctl,
+    TP_PROTO(unsigned int minor, Channel* channel, unsigned int command, unsigned long param),
+    TP_ARGS(minor, channel, command, param),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned long, channel_id) /* of the bound channel, before MSG_SLOT_CHANNEL binds another */
+        __field(unsigned int, command)
+        __field(unsigned long, param)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel_id = channel!=NULL ? channel->channel_id : 0;
+        __entry->command = command;
+        __entry->param = param;
+    ),
+    TP_printk("minor=%u channel=%lu command=%u param=0x%lx", __entry->minor, __entry->channel_id, _IOC_NR(__entry->command), __entry->param)
+);
+
+TRACE_EVENT(message_slot_ioctl_done,
+    TP_PROTO(unsigned int minor, unsigned int command, long res),
+    TP_ARGS(minor, command, res),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, command)
+        __field(long, res)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->command = command;
+        __entry->res = res;
+    ),
+    TP_printk("minor=%u command=%u res=%ld", __entry->minor, _IOC_NR(__entry->command), __entry->res)
+);
+
+#endif /* MESSAGE_SLOT_TRACE_H */
+
+/* define_trace.h includes this file again from the module's directory, the Makefile adds it to the include path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE message_slot_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,64 @@
+#ifndef MESSAGE_STREAM_H
+#define MESSAGE_STREAM_H
+/* the summary of the streaming modes of message_sender and message_reader: the messages, bytes and calls of a stream, and the latency of
+ * its calls in power of 2 nanoseconds buckets */
+#include <stdio.h>
+#include <time.h>
+
+#define STREAM_LATENCY_BUCKETS 40
+
+typedef struct stream_stats{
+    unsigned long long start; /* nanoseconds */
+    unsigned long long messages;
+    unsigned long long bytes;
+    unsigned long long calls;
+    unsigned long long waits; /* calls that waited for a message or for room in a queue */
+    unsigned long long failed; /* messages that weren't written or read */
+    unsigned long long latency[STREAM_LATENCY_BUCKETS]; /* calls per bucket: the bucket b counts the ones below 2^b nanoseconds */
+}StreamStats;
+
+static inline unsigned long long stream_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* counts a call that started at start (stream_now) */
+static inline void stream_record_call(StreamStats* stats, unsigned long long start){
+    unsigned long long nanoseconds = stream_now() - start;
+    unsigned int bucket = nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0;
+    stats->calls++;
+    stats->latency[bucket < STREAM_LATENCY_BUCKETS ? bucket : STREAM_LATENCY_BUCKETS - 1]++;
+}
+
+/* the upper bound in nanoseconds of the bucket that holds the given percentile (0..1) of the calls, 0 if there were none */
+static inline unsigned long long stream_latency_percentile(const StreamStats* stats, double percentile){
+    unsigned long long total = 0, seen = 0, target;
+    int i;
+    for (i=0 ; i < STREAM_LATENCY_BUCKETS ; i++){
+        total+=stats->latency[i];
+    }
+    if (total==0){
+        return 0;
+    }
+    target = (unsigned long long)(percentile * total);
+    for (i=0 ; i < STREAM_LATENCY_BUCKETS - 1 ; i++){
+        seen+=stats->latency[i];
+        if (seen > target){
+            break;
+        }
+    }
+    return 1ULL << i;
+}
+
+/* prints the summary to stderr as one JSON object, stdout may be the stream itself */
+static inline void stream_print_summary(const StreamStats* stats){
+    double seconds = (stream_now() - stats->start) / 1e9;
+    fprintf(stderr, "{\"messages\": %llu, \"bytes\": %llu, \"calls\": %llu, \"waits\": %llu, \"failed\": %llu, \"seconds\": %.3f, "
+                    "\"msgs_per_sec\": %.0f, \"mb_per_sec\": %.3f, \"call_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}\n",
+            stats->messages, stats->bytes, stats->calls, stats->waits, stats->failed, seconds,
+            seconds > 0 ? stats->messages / seconds : 0.0, seconds > 0 ? stats->bytes / seconds / 1e6 : 0.0,
+            stream_latency_percentile(stats, 0.5), stream_latency_percentile(stats, 0.99), stream_latency_percentile(stats, 0.999));
+}
+
+#endif /* MESSAGE_STREAM_H */
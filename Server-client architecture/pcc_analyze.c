@@ -0,0 +1,592 @@
+/*
+ * pcc_analyze summary:
+ *
+ * The analysis kernel of pcc_server: counts the printable characters (32..126) of a buffer and the occurrences of each of them.
+ *
+ * The printable count is computed with vectorized range compares and popcount. The kernel (AVX-512, AVX2, SSE2 or scalar) is chosen
+ * once by pcc_analyze_init according to CPUID. The per character occurrences are counted branchlessly into 4 interleaved sub-histograms,
+ * so consecutive equal bytes don't serialize on the same counter (store forwarding stalls), and they are folded into pcc_total at the end.
+ * The results are bit-identical to analyze_data_scalar, which is the original byte by byte implementation.
+ *
+ * The other analyzers of the framed protocol keep their running state in an Analysis. Each of them has its own kernel, so no class is
+ * looked up per byte: ANALYZER_BYTES and ANALYZER_CLASS both count into the same 256 bucket histogram, and the classes of a ClassTable
+ * are folded from it once per request. ANALYZER_UTF8 validates with the lookup table algorithm of Keiser and Lemire (AVX2, a block
+ * of 32 bytes at a time, with a scalar fallback) and counts the printable codepoints in the same pass. All of them also count the byte
+ * histogram, so pcc_total still holds the printable characters of every request.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCC_X86 1
+#endif
+
+#include "pcc_analyze.h"
+
+#define SUB_HISTOGRAMS 4
+#define HISTOGRAM_THRESHOLD 1024 /* below it, zeroing and folding the sub-histograms costs more than it saves */
+
+typedef unsigned int (*count_kernel_fn)(const unsigned char* buffer, int len);
+typedef void (*utf8_kernel_fn)(Analysis* analysis, const unsigned char* buffer, int len);
+
+static unsigned int count_printable_scalar(const unsigned char* buffer, int len);
+static void histogram_interleaved(uint64_t pcc_total[NUM_PRINTABLE], const unsigned char* buffer, int len);
+static void utf8_scalar(Analysis* analysis, const unsigned char* buffer, int len);
+#ifdef PCC_X86
+static void utf8_avx2(Analysis* analysis, const unsigned char* buffer, int len);
+#endif
+
+static count_kernel_fn count_kernel = count_printable_scalar;
+static const char* kernel_name = "scalar";
+static utf8_kernel_fn utf8_kernel = utf8_scalar;
+static const char* utf8_kernel_name = "scalar";
+
+static const char* analyzer_names[NUM_ANALYZERS] = { NULL, "printable", "bytes", "class", "utf8" };
+
+/**
+ * count_printable_scalar - counts the printable characters, used as fallback and for the tails of the vectorized kernels
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return unsigned int - amount of printable characters
+ */
+static unsigned int count_printable_scalar(const unsigned char* buffer, int len){
+    unsigned int count=0;
+    int i;
+    for (i=0 ; i < len ; i++){
+        count += (unsigned char)(buffer[i] - OFFSET) < NUM_PRINTABLE;
+    }
+    return count;
+}
+
+#ifdef PCC_X86
+/* A byte b is printable iff (unsigned)(b - 32) <= 94, which is checked as min(b - 32, 94) == b - 32 */
+
+__attribute__((target("sse2,popcnt")))
+static unsigned int count_printable_sse2(const unsigned char* buffer, int len){
+    const __m128i offset = _mm_set1_epi8(OFFSET);
+    const __m128i last = _mm_set1_epi8(NUM_PRINTABLE - 1);
+    unsigned int count=0;
+    int i;
+    for (i=0 ; i + 16 <= len ; i+=16){
+        __m128i shifted = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(buffer + i)), offset);
+        __m128i printable = _mm_cmpeq_epi8(_mm_min_epu8(shifted, last), shifted);
+        count += __builtin_popcount(_mm_movemask_epi8(printable));
+    }
+    return count + count_printable_scalar(buffer + i, len - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned int count_printable_avx2(const unsigned char* buffer, int len){
+    const __m256i offset = _mm256_set1_epi8(OFFSET);
+    const __m256i last = _mm256_set1_epi8(NUM_PRINTABLE - 1);
+    unsigned int count=0;
+    int i;
+    for (i=0 ; i + 32 <= len ; i+=32){
+        __m256i shifted = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i)), offset);
+        __m256i printable = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, last), shifted);
+        count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(printable));
+    }
+    return count + count_printable_scalar(buffer + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static unsigned int count_printable_avx512(const unsigned char* buffer, int len){
+    const __m512i offset = _mm512_set1_epi8(OFFSET);
+    const __m512i last = _mm512_set1_epi8(NUM_PRINTABLE - 1);
+    unsigned int count=0;
+    int i;
+    for (i=0 ; i + 64 <= len ; i+=64){
+        __m512i shifted = _mm512_sub_epi8(_mm512_loadu_si512((const void*)(buffer + i)), offset);
+        count += __builtin_popcountll(_mm512_cmple_epu8_mask(shifted, last));
+    }
+    return count + count_printable_scalar(buffer + i, len - i);
+}
+#endif /* PCC_X86 */
+
+/**
+ * pcc_analyze_init - chooses the widest kernel that the CPU supports, must be called before the analysis starts
+ * @return void
+ */
+void pcc_analyze_init(void){
+#ifdef PCC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")){
+        utf8_kernel = utf8_avx2;
+        utf8_kernel_name = "avx2";
+    }
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")){
+        count_kernel = count_printable_avx512;
+        kernel_name = "avx512";
+        return;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")){
+        count_kernel = count_printable_avx2;
+        kernel_name = "avx2";
+        return;
+    }
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")){
+        count_kernel = count_printable_sse2;
+        kernel_name = "sse2";
+        return;
+    }
+#endif
+    count_kernel = count_printable_scalar;
+    kernel_name = "scalar";
+}
+
+/**
+ * pcc_analyze_kernel_name - the name of the kernel chosen by pcc_analyze_init
+ * @return const char* - "avx512", "avx2", "sse2" or "scalar"
+ */
+const char* pcc_analyze_kernel_name(void){
+    return kernel_name;
+}
+
+/**
+ * count_printable - counts the printable characters with the chosen kernel
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return unsigned int - amount of printable characters
+ */
+unsigned int count_printable(const char* buffer, int len){
+    return count_kernel((const unsigned char*)buffer, len);
+}
+
+/**
+ * count_bytes_interleaved - counts the occurrences of every byte value into the sub-histograms
+ * @param hist - the sub-histograms, zeroed by the caller. len is an int, so a bucket can't overflow
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+static inline void count_bytes_interleaved(uint32_t hist[SUB_HISTOGRAMS][NUM_BYTES], const unsigned char* buffer, int len){
+    uint64_t word;
+    int i;
+    for (i=0 ; i + 8 <= len ; i+=8){
+        memcpy(&word, buffer + i, sizeof(word));
+        hist[0][(uint8_t)word]++;
+        hist[1][(uint8_t)(word >> 8)]++;
+        hist[2][(uint8_t)(word >> 16)]++;
+        hist[3][(uint8_t)(word >> 24)]++;
+        hist[0][(uint8_t)(word >> 32)]++;
+        hist[1][(uint8_t)(word >> 40)]++;
+        hist[2][(uint8_t)(word >> 48)]++;
+        hist[3][(uint8_t)(word >> 56)]++;
+    }
+    for ( ; i < len ; i++){
+        hist[0][buffer[i]]++;
+    }
+}
+
+/**
+ * histogram_interleaved - adds the occurrences of each printable character to pcc_total
+ * @param *pcc_total - the data structure that holds the analyzed information
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+static void histogram_interleaved(uint64_t pcc_total[NUM_PRINTABLE], const unsigned char* buffer, int len){
+    uint32_t hist[SUB_HISTOGRAMS][NUM_BYTES];
+    int i;
+    memset(hist, 0, sizeof(hist));
+    count_bytes_interleaved(hist, buffer, len); /* every byte is counted, the non printable buckets are just never folded */
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        pcc_total[i] += hist[0][i + OFFSET] + hist[1][i + OFFSET] + hist[2][i + OFFSET] + hist[3][i + OFFSET];
+    }
+}
+
+/**
+ * histogram_bytes - adds the occurrences of every byte value to a 256 bucket histogram
+ * @param *bytes - the histogram
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+static void histogram_bytes(uint64_t bytes[NUM_BYTES], const unsigned char* buffer, int len){
+    uint32_t hist[SUB_HISTOGRAMS][NUM_BYTES];
+    int i;
+    if (len < HISTOGRAM_THRESHOLD){
+        for (i=0 ; i < len ; i++){
+            bytes[buffer[i]]++;
+        }
+        return;
+    }
+    memset(hist, 0, sizeof(hist));
+    count_bytes_interleaved(hist, buffer, len);
+    for (i=0 ; i < NUM_BYTES ; i++){
+        bytes[i] += hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+    }
+}
+
+/**
+ * analyze_data - analyze the information
+ * @param *pcc_total - the data structure that holds the analyzed information
+ * @param *buffer - the buffer that the information is being written to
+ * @param bytes_read - amount of bytes that currently recieved from client
+ * @param *counter - amount of printable characters recieved from the client
+ * @return void
+ */
+void analyze_data(uint64_t pcc_total[NUM_PRINTABLE], char* buffer, int bytes_read, uint64_t* counter){
+    if (bytes_read < HISTOGRAM_THRESHOLD){
+        analyze_data_scalar(pcc_total, buffer, bytes_read, counter);
+        return;
+    }
+    *counter = *counter + count_kernel((const unsigned char*)buffer, bytes_read);
+    histogram_interleaved(pcc_total, (const unsigned char*)buffer, bytes_read);
+}
+
+/**
+ * analyze_data_scalar - analyze the information byte by byte, the reference implementation
+ * @param *pcc_total - the data structure that holds the analyzed information
+ * @param *buffer - the buffer that the information is being written to
+ * @param bytes_read - amount of bytes that currently recieved from client
+ * @param *counter - amount of printable characters recieved from the client
+ * @return void
+ */
+void analyze_data_scalar(uint64_t pcc_total[NUM_PRINTABLE], char* buffer, int bytes_read, uint64_t* counter){
+    int i;
+    for (i=0 ; i < bytes_read ; i++){
+        char value = buffer[i];
+        if (value>126 || value < 32){
+            continue;
+        }
+        else{
+            pcc_total[value - OFFSET]++;
+            *counter = *counter + 1;
+        }
+    }
+}
+
+/**
+ * utf8_printable - whether a codepoint is printable: not a C0 or C1 control and not DEL
+ * @param codepoint - the codepoint
+ * @return int - 1 if printable, else 0
+ */
+static inline int utf8_printable(uint32_t codepoint){
+    return codepoint >= 0x20 && (codepoint < 0x7F || codepoint > 0x9F);
+}
+
+/**
+ * utf8_scalar - validates the UTF-8 data byte by byte and counts its printable codepoints, a sequence may continue in the next call
+ * @param *analysis - the running state of the request
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+static void utf8_scalar(Analysis* analysis, const unsigned char* buffer, int len){
+    uint32_t codepoint = analysis->utf8_codepoint;
+    int i, need = analysis->utf8_need;
+    unsigned char byte, low = analysis->utf8_low, high = analysis->utf8_high;
+    for (i=0 ; i < len && !analysis->utf8_error ; i++){
+        byte = buffer[i];
+        if (need > 0){
+            if (byte < low || byte > high){
+                analysis->utf8_error = 1;
+                break;
+            }
+            codepoint = (codepoint << 6) | (byte & 0x3F);
+            low = 0x80;
+            high = 0xBF;
+            if (--need==0){
+                analysis->utf8_count += utf8_printable(codepoint);
+            }
+            continue;
+        }
+        low = 0x80;
+        high = 0xBF;
+        if (byte < 0x80){
+            analysis->utf8_count += utf8_printable(byte);
+        }
+        else if (byte >= 0xC2 && byte <= 0xDF){
+            need = 1;
+            codepoint = byte & 0x1F;
+        }
+        else if (byte >= 0xE0 && byte <= 0xEF){ /* no overlong forms, no surrogates */
+            need = 2;
+            codepoint = byte & 0x0F;
+            low = byte==0xE0 ? 0xA0 : 0x80;
+            high = byte==0xED ? 0x9F : 0xBF;
+        }
+        else if (byte >= 0xF0 && byte <= 0xF4){ /* no overlong forms, nothing above U+10FFFF */
+            need = 3;
+            codepoint = byte & 0x07;
+            low = byte==0xF0 ? 0x90 : 0x80;
+            high = byte==0xF4 ? 0x8F : 0xBF;
+        }
+        else {
+            analysis->utf8_error = 1;
+        }
+    }
+    analysis->utf8_codepoint = codepoint;
+    analysis->utf8_need = need;
+    analysis->utf8_low = low;
+    analysis->utf8_high = high;
+}
+
+#ifdef PCC_X86
+/* The error classes of the lookup table algorithm, a pair of bytes is invalid iff the three lookups share a class */
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    _mm256_setr_epi8(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p)
+
+/**
+ * utf8_block_avx2 - validates a block of 32 bytes given the previous one, and counts its printable codepoints
+ * @param input - the block
+ * @param *prev - the previous block, replaced by this one
+ * @param *prev_incomplete - non zero where the previous block ended in the middle of a sequence, replaced by this block's
+ * @param *error - ored with the errors of the block
+ * @return int - amount of printable codepoints that start in the block, minus the C1 controls that end in it (which may
+ *               have started in the previous block, so it can be negative)
+ */
+__attribute__((target("avx2,popcnt"), always_inline))
+static inline int utf8_block_avx2(__m256i input, __m256i* prev, __m256i* prev_incomplete, __m256i* error){
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    __m256i shifted = _mm256_permute2x128_si256(*prev, input, 0x21); /* the high lane of prev and the low lane of input */
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i controls = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(input, _mm256_set1_epi8(0x1F)), input),
+                                       _mm256_cmpeq_epi8(input, _mm256_set1_epi8(0x7F)));
+    __m256i leads, c1, byte_1_high, byte_1_low, byte_2_high, special, prev2, prev3, must_be_continuation;
+    int count;
+    if (_mm256_movemask_epi8(input)==0){ /* all ASCII: valid, if no sequence was left incomplete */
+        *error = _mm256_or_si256(*error, *prev_incomplete);
+        *prev = input;
+        return 32 - __builtin_popcount((unsigned int)_mm256_movemask_epi8(controls));
+    }
+    byte_1_high = _mm256_shuffle_epi8(UTF8_TABLE(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+    byte_1_low = _mm256_shuffle_epi8(UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        _mm256_and_si256(prev1, low_nibble));
+    byte_2_high = _mm256_shuffle_epi8(UTF8_TABLE(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT),
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+    special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    /* the third and fourth bytes of a sequence must be continuations, which the 2 byte lookups flag as TWO_CONTS */
+    prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    must_be_continuation = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                                            _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)))),
+                                            _mm256_set1_epi8((char)0x80));
+    *error = _mm256_or_si256(*error, _mm256_xor_si256(must_be_continuation, special));
+    /* the last 3 bytes may start a sequence that continues in the next block */
+    *prev_incomplete = _mm256_subs_epu8(input, _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)));
+    *prev = input;
+    /* every byte but a continuation starts a codepoint, the C1 controls are 0xC2 0x80..0x9F */
+    leads = _mm256_cmpgt_epi8(input, _mm256_set1_epi8(-65));
+    c1 = _mm256_and_si256(_mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xC2)), _mm256_cmpgt_epi8(_mm256_set1_epi8(-96), input));
+    count = __builtin_popcount((unsigned int)_mm256_movemask_epi8(leads));
+    count -= __builtin_popcount((unsigned int)_mm256_movemask_epi8(controls));
+    count -= __builtin_popcount((unsigned int)_mm256_movemask_epi8(c1));
+    return count;
+}
+
+/**
+ * utf8_avx2 - validates the UTF-8 data a block of 32 bytes at a time and counts its printable codepoints, the bytes of an
+ * incomplete block wait in the tail for the next call (or for analysis_finish)
+ * @param *analysis - the running state of the request
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+__attribute__((target("avx2,popcnt")))
+static void utf8_avx2(Analysis* analysis, const unsigned char* buffer, int len){
+    __m256i prev = _mm256_loadu_si256((const __m256i*)analysis->utf8_prev);
+    __m256i prev_incomplete = _mm256_loadu_si256((const __m256i*)analysis->utf8_prev_incomplete);
+    __m256i error = _mm256_setzero_si256();
+    int64_t count=0;
+    int n;
+    if (analysis->utf8_tail_len > 0){
+        n = UTF8_BLOCK - analysis->utf8_tail_len < len ? UTF8_BLOCK - analysis->utf8_tail_len : len;
+        memcpy(analysis->utf8_tail + analysis->utf8_tail_len, buffer, n);
+        analysis->utf8_tail_len+=n;
+        buffer+=n;
+        len-=n;
+        if (analysis->utf8_tail_len==UTF8_BLOCK){
+            count += utf8_block_avx2(_mm256_loadu_si256((const __m256i*)analysis->utf8_tail), &prev, &prev_incomplete, &error);
+            analysis->utf8_tail_len = 0;
+        }
+    }
+    for ( ; len >= UTF8_BLOCK ; buffer+=UTF8_BLOCK, len-=UTF8_BLOCK){
+        count += utf8_block_avx2(_mm256_loadu_si256((const __m256i*)buffer), &prev, &prev_incomplete, &error);
+    }
+    if (len > 0){
+        memcpy(analysis->utf8_tail + analysis->utf8_tail_len, buffer, len);
+        analysis->utf8_tail_len+=len;
+    }
+    _mm256_storeu_si256((__m256i*)analysis->utf8_prev, prev);
+    _mm256_storeu_si256((__m256i*)analysis->utf8_prev_incomplete, prev_incomplete);
+    analysis->utf8_count += count;
+    analysis->utf8_error |= !_mm256_testz_si256(error, error);
+}
+
+/**
+ * utf8_finish_avx2 - validates the tail, padded with zeros (which end any sequence), and checks that no sequence was left incomplete
+ * @param *analysis - the running state of the request
+ * @return void
+ */
+__attribute__((target("avx2,popcnt")))
+static void utf8_finish_avx2(Analysis* analysis){
+    unsigned char padding[UTF8_BLOCK] = {0};
+    __m256i prev_incomplete;
+    int tail_len = analysis->utf8_tail_len;
+    if (tail_len > 0){ /* a zero byte is a control, so the padding adds nothing to the count */
+        utf8_avx2(analysis, padding, UTF8_BLOCK - tail_len);
+    }
+    prev_incomplete = _mm256_loadu_si256((const __m256i*)analysis->utf8_prev_incomplete);
+    analysis->utf8_error |= !_mm256_testz_si256(prev_incomplete, prev_incomplete);
+}
+#endif /* PCC_X86 */
+
+/**
+ * pcc_analyze_utf8_kernel_name - the name of the UTF-8 kernel chosen by pcc_analyze_init
+ * @return const char* - "avx2" or "scalar"
+ */
+const char* pcc_analyze_utf8_kernel_name(void){
+    return utf8_kernel_name;
+}
+
+/**
+ * analyzer_by_name - the analyzer of a name as given on the command line
+ * @param *name - "printable", "bytes", "class" or "utf8"
+ * @return int - the analyzer, or -1 if there is no such analyzer
+ */
+int analyzer_by_name(const char* name){
+    int i;
+    for (i=1 ; i < NUM_ANALYZERS ; i++){
+        if (strcmp(name, analyzer_names[i])==0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * class_table_load - reads a class table: a file of 256 bytes, the class of every byte value
+ * @param *table - filled with the table
+ * @param *path - the path of the file
+ * @return int - 0 if successfull, else -1 and an error is printed
+ */
+int class_table_load(ClassTable* table, const char* path){
+    FILE* file = fopen(path, "rb");
+    size_t size;
+    if (file==NULL){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size = fread(table->class_of, 1, NUM_BYTES, file);
+    if (size!=NUM_BYTES || fgetc(file)!=EOF){
+        fprintf(stderr, "%s: a class table holds exactly %d bytes\n", path, NUM_BYTES);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * analysis_reset - prepares the state for a new request
+ * @param *analysis - the state
+ * @return void
+ */
+void analysis_reset(Analysis* analysis){
+    memset(analysis, 0, sizeof(Analysis));
+}
+
+/**
+ * analysis_feed - analyzes the next part of a request
+ * @param analyzer - ANALYZER_BYTES, ANALYZER_CLASS or ANALYZER_UTF8
+ * @param *analysis - the running state of the request
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return void
+ */
+void analysis_feed(int analyzer, Analysis* analysis, const char* buffer, int len){
+    histogram_bytes(analysis->bytes, (const unsigned char*)buffer, len);
+    if (analyzer==ANALYZER_UTF8 && !analysis->utf8_error){
+        utf8_kernel(analysis, (const unsigned char*)buffer, len);
+    }
+}
+
+/**
+ * analysis_finish - completes a request and computes its result
+ * @param analyzer - ANALYZER_BYTES, ANALYZER_CLASS or ANALYZER_UTF8
+ * @param *analysis - the running state of the request
+ * @param *table - the class table of ANALYZER_CLASS
+ * @param *count - the amount of bytes (ANALYZER_BYTES), of bytes of a class other than 0 (ANALYZER_CLASS) or of printable
+ *                 codepoints (ANALYZER_UTF8, ANALYSIS_INVALID if the data isn't valid UTF-8)
+ * @param buckets - filled with the histogram: of the bytes or of the classes
+ * @return int - amount of buckets: NUM_BYTES, or 0 for ANALYZER_UTF8
+ */
+int analysis_finish(int analyzer, Analysis* analysis, const ClassTable* table, uint64_t* count, uint64_t buckets[NUM_BYTES]){
+    int i;
+    *count = 0;
+    switch (analyzer){
+    case ANALYZER_BYTES:
+        for (i=0 ; i < NUM_BYTES ; i++){
+            buckets[i] = analysis->bytes[i];
+            *count+=analysis->bytes[i];
+        }
+        return NUM_BYTES;
+    case ANALYZER_CLASS:
+        memset(buckets, 0, NUM_BYTES*sizeof(uint64_t));
+        for (i=0 ; i < NUM_BYTES ; i++){
+            buckets[table->class_of[i]]+=analysis->bytes[i];
+        }
+        for (i=1 ; i < NUM_BYTES ; i++){ /* class 0 isn't counted */
+            *count+=buckets[i];
+        }
+        return NUM_BYTES;
+    default:
+#ifdef PCC_X86
+        if (utf8_kernel==utf8_avx2 && !analysis->utf8_error){
+            utf8_finish_avx2(analysis);
+        }
+#endif
+        if (analysis->utf8_need > 0){ /* the scalar kernel stopped in the middle of a sequence */
+            analysis->utf8_error = 1;
+        }
+        *count = analysis->utf8_error ? ANALYSIS_INVALID : analysis->utf8_count;
+        return 0;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef PCC_ANALYZE_H
+#define PCC_ANALYZE_H
+
+#include <stdint.h>
+
+#define OFFSET 32
+#define NUM_PRINTABLE 95
+#define NUM_BYTES 256
+#define UTF8_BLOCK 32
+
+/* The analyzers, their ids are the ones of the framed protocol (pcc_protocol.h) */
+#define ANALYZER_PRINTABLE 1 /* printable ASCII: analyze_data */
+#define ANALYZER_BYTES 2 /* a histogram of all the byte values */
+#define ANALYZER_CLASS 3 /* a histogram of the classes of a ClassTable */
+#define ANALYZER_UTF8 4 /* UTF-8 validation and a count of the printable codepoints */
+#define NUM_ANALYZERS 5
+#define ANALYSIS_INVALID UINT64_MAX /* the count of a request that failed the UTF-8 validation */
+
+typedef struct class_table{ /* maps every byte value to a class, class 0 isn't counted */
+    unsigned char class_of[NUM_BYTES];
+}ClassTable;
+
+typedef struct analysis{ /* the running state of a request of one of the byte analyzers (all but ANALYZER_PRINTABLE) */
+    uint64_t bytes[NUM_BYTES]; /* occurrences of every byte value */
+    uint64_t utf8_count; /* printable codepoints: all but the C0 and C1 controls and DEL */
+    int utf8_error;
+    int utf8_need; /* the scalar validator: continuation bytes still expected, and the range of the next one */
+    unsigned char utf8_low;
+    unsigned char utf8_high;
+    uint32_t utf8_codepoint;
+    unsigned char utf8_tail[UTF8_BLOCK]; /* the vectorized validator: the bytes of a block that wasn't completed yet */
+    int utf8_tail_len;
+    unsigned char utf8_prev[UTF8_BLOCK]; /* the previous block */
+    unsigned char utf8_prev_incomplete[UTF8_BLOCK]; /* non zero if the previous block ended in the middle of a sequence */
+}Analysis;
+
+void pcc_analyze_init(void);
+const char* pcc_analyze_kernel_name(void);
+void analyze_data(uint64_t pcc_total[NUM_PRINTABLE], char* buffer, int bytes_read, uint64_t* counter);
+void analyze_data_scalar(uint64_t pcc_total[NUM_PRINTABLE], char* buffer, int bytes_read, uint64_t* counter);
+unsigned int count_printable(const char* buffer, int len);
+const char* pcc_analyze_utf8_kernel_name(void);
+int analyzer_by_name(const char* name);
+int class_table_load(ClassTable* table, const char* path);
+void analysis_reset(Analysis* analysis);
+void analysis_feed(int analyzer, Analysis* analysis, const char* buffer, int len);
+int analysis_finish(int analyzer, Analysis* analysis, const ClassTable* table, uint64_t* count, uint64_t buckets[NUM_BYTES]);
+
+#endif /* PCC_ANALYZE_H */
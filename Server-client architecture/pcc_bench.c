@@ -0,0 +1,233 @@
+/*
+ * pcc_bench summary:
+ *
+ * Micro-benchmarks of the analysis kernels of pcc_analyze.c. Every kernel is run over buffers of BENCH_SIZES sizes that are filled
+ * with three distributions: random bytes, printable characters only (32..126) and binary bytes only (the rest), since the kernels
+ * may branch on the data. A case is repeated untill it ran for --seconds (0.2 by default) and the best of BENCH_ROUNDS rounds is kept,
+ * so a run is comparable with the next one on the same machine.
+ * The buffers are generated with a fixed seed, so every run analyzes the same data.
+ *
+ * Usage: pcc_bench [--seconds S] [--max-size BYTES]
+ * The results are printed to stdout as one JSON object: the kernels that pcc_analyze_init chose, and a result per line with the
+ * nanoseconds per call and the GB/s of every kernel, distribution and size.
+ * (build: gcc -O2 pcc_bench.c pcc_analyze.c -o pcc_bench)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pcc_analyze.h"
+
+#define BENCH_ROUNDS 3
+#define BENCH_SEED 0x5043435F42454E43ULL
+#define MAX_SIZE_DEFAULT (16 << 20)
+
+#define DIST_RANDOM 0
+#define DIST_PRINTABLE 1
+#define DIST_BINARY 2
+#define NUM_DISTRIBUTIONS 3
+
+#define KERNEL_ANALYZE 0 /* analyze_data, the kernel of the printable analyzer and of legacy clients */
+#define KERNEL_ANALYZE_SCALAR 1 /* the original byte by byte implementation, the baseline */
+#define KERNEL_COUNT 2 /* the printable count alone */
+#define KERNEL_BYTES 3 /* analysis_feed of ANALYZER_BYTES (and ANALYZER_CLASS, which counts the same histogram) */
+#define KERNEL_UTF8 4 /* analysis_feed of ANALYZER_UTF8 */
+#define NUM_KERNELS 5
+
+static const int sizes[] = { 64, 512, 4096, 65536, 1 << 20, 16 << 20 };
+static const char* distribution_names[NUM_DISTRIBUTIONS] = { "random", "printable", "binary" };
+static const char* kernel_names[NUM_KERNELS] = { "analyze_data", "analyze_data_scalar", "count_printable", "bytes", "utf8" };
+
+int parse_arguments(int argc, char** argv, double* seconds, int* max_size);
+void fill_distribution(char* buffer, int len, int distribution, uint64_t* state);
+uint64_t next_random(uint64_t* state);
+double run_kernel(int kernel, char* buffer, int len, long long calls);
+double measure(int kernel, char* buffer, int len, double seconds, long long* calls);
+double now_seconds();
+
+static volatile unsigned int sink; /* keeps the results alive, so the calls aren't optimized out */
+
+/*
+ * main - runs every kernel over every distribution and size, and prints the results as JSON
+ */
+int main(int argc, char** argv){
+    double seconds = 0.2, nanoseconds;
+    int max_size = MAX_SIZE_DEFAULT, kernel, distribution, i, first = 1;
+    long long calls;
+    uint64_t state = BENCH_SEED;
+    char* buffer;
+    if (parse_arguments(argc, argv, &seconds, &max_size)==-1){
+        fprintf(stderr, "Usage: %s [--seconds S] [--max-size BYTES]\n", argv[0]);
+        return 1;
+    }
+    pcc_analyze_init();
+    buffer = (char*)aligned_alloc(64, ((size_t)max_size + 63) & ~(size_t)63);
+    if (buffer==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return 1;
+    }
+    printf("{\"kernel\": \"%s\", \"utf8_kernel\": \"%s\", \"seconds_per_case\": %.3f, \"results\": [\n",
+           pcc_analyze_kernel_name(), pcc_analyze_utf8_kernel_name(), seconds);
+    for (distribution=0 ; distribution < NUM_DISTRIBUTIONS ; distribution++){
+        fill_distribution(buffer, max_size, distribution, &state);
+        for (i=0 ; i < (int)(sizeof(sizes) / sizeof(sizes[0])) && sizes[i] <= max_size ; i++){
+            for (kernel=0 ; kernel < NUM_KERNELS ; kernel++){
+                nanoseconds = measure(kernel, buffer, sizes[i], seconds, &calls);
+                printf("%s  {\"kernel\": \"%s\", \"distribution\": \"%s\", \"size\": %d, \"calls\": %lld, \"ns_per_call\": %.1f, "
+                       "\"gb_per_sec\": %.3f}", first ? "" : ",\n", kernel_names[kernel], distribution_names[distribution], sizes[i],
+                       calls, nanoseconds, sizes[i] / nanoseconds);
+                first = 0;
+            }
+        }
+    }
+    printf("\n]}\n");
+    free(buffer);
+    return 0;
+}
+
+/**
+ * parse_arguments - parses the command line: [--seconds S] [--max-size BYTES]
+ * @param argc, argv - as recieved by main
+ * @param *seconds - filled with the time per case
+ * @param *max_size - filled with the largest buffer size
+ * @return int - 0 if successfull, else -1
+ */
+int parse_arguments(int argc, char** argv, double* seconds, int* max_size){
+    int i;
+    for (i=1 ; i < argc ; i++){
+        if (strcmp(argv[i], "--seconds")==0 && i+1 < argc){
+            *seconds = strtod(argv[++i], NULL);
+            if (*seconds <= 0){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--max-size")==0 && i+1 < argc){
+            *max_size = (int) strtol(argv[++i], NULL, 10);
+            if (*max_size < sizes[0] || *max_size > (1 << 30)){
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * next_random - the next value of a splitmix64 stream
+ * @param *state - the state of the stream
+ * @return uint64_t - the value
+ */
+uint64_t next_random(uint64_t* state){
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * fill_distribution - fills the buffer with bytes of a distribution
+ * @param *buffer - the buffer
+ * @param len - amount of bytes
+ * @param distribution - DIST_RANDOM, DIST_PRINTABLE (32..126) or DIST_BINARY (0..31 and 127..255)
+ * @param *state - the random stream
+ * @return void
+ */
+void fill_distribution(char* buffer, int len, int distribution, uint64_t* state){
+    int i;
+    unsigned int value;
+    for (i=0 ; i < len ; i++){
+        value = (unsigned int)(next_random(state) >> 32);
+        switch (distribution){
+        case DIST_PRINTABLE:
+            buffer[i] = (char)(OFFSET + value % NUM_PRINTABLE);
+            break;
+        case DIST_BINARY:
+            value %= NUM_BYTES - NUM_PRINTABLE;
+            buffer[i] = (char)(value < OFFSET ? value : value + NUM_PRINTABLE);
+            break;
+        default:
+            buffer[i] = (char)value;
+        }
+    }
+}
+
+/**
+ * run_kernel - calls a kernel over the buffer repeatedly
+ * @param kernel - KERNEL_*
+ * @param *buffer - the data
+ * @param len - amount of bytes
+ * @param calls - amount of calls
+ * @return double - the elapsed seconds
+ */
+double run_kernel(int kernel, char* buffer, int len, long long calls){
+    static uint64_t pcc_local[NUM_PRINTABLE];
+    static Analysis analysis;
+    uint64_t counter = 0;
+    long long i;
+    double start = now_seconds();
+    analysis_reset(&analysis);
+    for (i=0 ; i < calls ; i++){
+        switch (kernel){
+        case KERNEL_ANALYZE:
+            analyze_data(pcc_local, buffer, len, &counter);
+            break;
+        case KERNEL_ANALYZE_SCALAR:
+            analyze_data_scalar(pcc_local, buffer, len, &counter);
+            break;
+        case KERNEL_COUNT:
+            counter+=count_printable(buffer, len);
+            break;
+        case KERNEL_BYTES:
+            analysis_feed(ANALYZER_BYTES, &analysis, buffer, len);
+            break;
+        case KERNEL_UTF8: /* every call is a request of its own, so invalid data doesn't stop the validation after the first call */
+            analysis_reset(&analysis);
+            analysis_feed(ANALYZER_UTF8, &analysis, buffer, len);
+            counter+=analysis.utf8_count;
+            break;
+        }
+    }
+    sink = (unsigned int)(counter + pcc_local[0] + analysis.bytes[0]);
+    return now_seconds() - start;
+}
+
+/**
+ * measure - calibrates the amount of calls that run for the given time, and keeps the best of BENCH_ROUNDS rounds
+ * @param kernel - KERNEL_*
+ * @param *buffer - the data
+ * @param len - amount of bytes
+ * @param seconds - the time of a round
+ * @param *calls - filled with the amount of calls per round
+ * @return double - nanoseconds per call of the best round
+ */
+double measure(int kernel, char* buffer, int len, double seconds, long long* calls){
+    double elapsed, best;
+    int round;
+    *calls = 1;
+    while ((elapsed = run_kernel(kernel, buffer, len, *calls)) < seconds / 10){ /* also warms up the caches */
+        *calls*=2;
+    }
+    *calls = (long long)(*calls * (seconds / BENCH_ROUNDS) / elapsed) + 1;
+    best = run_kernel(kernel, buffer, len, *calls);
+    for (round=1 ; round < BENCH_ROUNDS ; round++){
+        elapsed = run_kernel(kernel, buffer, len, *calls);
+        best = elapsed < best ? elapsed : best;
+    }
+    return best * 1e9 / *calls;
+}
+
+/**
+ * now_seconds - monotonic time
+ * @return double - seconds
+ */
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
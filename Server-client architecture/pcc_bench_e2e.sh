@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# pcc_bench_e2e summary:
+#
+# End to end loopback benchmark of pcc_server. For every scenario a server is started on its own port, pcc_client's load generator
+# drives it with concurrent clients, and the server's stats endpoint is read before it is stopped with SIGINT. The scenarios cover
+# both protocols (legacy connections and pipelined framed requests), both engines (epoll and --uring) and the local transports
+# (a UNIX domain socket and the shared memory ring).
+#
+# Usage: pcc_bench_e2e.sh [--length N] [--connections C] [--duration T] [--workers W] [--port PORT]
+# The results are printed to stdout as one JSON object: a run per line, with the client's result (throughput, errors, mismatches and
+# latency) and the server's statistics (syscalls, bytes per call and its own latency histogram).
+# The exit status is 1 if a run failed or a client reported errors or mismatches.
+#
+
+LENGTH=65536
+CONNECTIONS=16
+DURATION=3
+WORKERS=4
+PORT=5600
+PIPELINE=8
+DIR="$(cd "$(dirname "$0")" && pwd)"
+
+usage(){
+    echo "Usage: $0 [--length N] [--connections C] [--duration T] [--workers W] [--port PORT]" >&2
+    exit 1
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --length) LENGTH="$2" ;;
+        --connections) CONNECTIONS="$2" ;;
+        --duration) DURATION="$2" ;;
+        --workers) WORKERS="$2" ;;
+        --port) PORT="$2" ;;
+        *) usage ;;
+    esac
+    [ $# -ge 2 ] || usage
+    shift 2
+done
+
+SOCKET="$(mktemp -u /tmp/pcc_bench.XXXXXX)"
+SERVER_PID=
+
+# stop_server - stops the server with SIGINT and waits for it to sum up
+stop_server(){
+    if [ -n "$SERVER_PID" ]; then
+        kill -INT "$SERVER_PID" 2>/dev/null
+        wait "$SERVER_PID" 2>/dev/null
+        SERVER_PID=
+    fi
+}
+trap 'stop_server; rm -f "$SOCKET"' EXIT
+
+# read_stats - prints the server's statistics, fails if the stats port doesn't accept
+read_stats(){
+    local line
+    exec 3<>"/dev/tcp/127.0.0.1/$((PORT + 1))" 2>/dev/null || return 1
+    read -r line <&3
+    exec 3<&-
+    echo "$line"
+}
+
+# start_server - starts the server with the given extra arguments and waits untill its stats port accepts
+start_server(){
+    local i
+    "$DIR/pcc_server" "$PORT" --workers "$WORKERS" --stats-port $((PORT + 1)) --unix "$SOCKET" "$@" >/dev/null 2>&1 &
+    SERVER_PID=$!
+    for i in $(seq 50); do
+        if read_stats >/dev/null; then
+            return 0
+        fi
+        if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+            break
+        fi
+        sleep 0.1
+    done
+    echo "pcc_server $* didn't start" >&2
+    stop_server
+    return 1
+}
+
+# run - runs a scenario: <name> <server arguments> -- <client arguments>, and prints its result
+run(){
+    local name="$1" server_args=() client_args=() client stats
+    shift
+    while [ "$1" != "--" ]; do
+        server_args+=("$1")
+        shift
+    done
+    shift
+    client_args=("$@")
+    start_server "${server_args[@]}" || return 1
+    client="$("$DIR/pcc_client" 127.0.0.1 "$PORT" "$LENGTH" --connections "$CONNECTIONS" --duration "$DURATION" --seed 1 "${client_args[@]}")"
+    stats="$(read_stats)"
+    stop_server
+    PORT=$((PORT + 2)) # a fresh port, so the last run's TIME_WAIT sockets don't matter
+    if [ -z "$client" ] || [ -z "$stats" ]; then
+        echo "$name failed" >&2
+        return 1
+    fi
+    printf '%s  {"name": "%s", "client": %s, "server": %s}' "$SEPARATOR" "$name" "$client" "$stats"
+    SEPARATOR=$',\n'
+    case "$client" in
+        *'"errors": 0,'*'"mismatches": 0,'*) return 0 ;;
+    esac
+    echo "$name had errors or mismatches" >&2
+    return 1
+}
+
+STATUS=0
+SEPARATOR=
+printf '{"length": %d, "connections": %d, "duration": %s, "workers": %d, "runs": [\n' "$LENGTH" "$CONNECTIONS" "$DURATION" "$WORKERS"
+run legacy-epoll -- || STATUS=1
+run framed-epoll -- --framed --pipeline "$PIPELINE" || STATUS=1
+run legacy-uring --uring -- || STATUS=1
+run framed-uring --uring -- --framed --pipeline "$PIPELINE" || STATUS=1
+run unix-framed -- --framed --pipeline "$PIPELINE" --unix "$SOCKET" || STATUS=1
+run shm-epoll -- --unix "$SOCKET" --shm || STATUS=1
+run shm-uring --uring -- --unix "$SOCKET" --shm || STATUS=1
+printf '\n]}\n'
+exit $STATUS
@@ -3,9 +3,35 @@
  *  
  * The client reads N characters from /dev/urandom and sends it to the server to get analyzed. The server send back the number of printable character that was sent.
  *
+ * Usage: pcc_client <ip> <port> <N> [--seed S] [--zerocopy]
+ * --seed S generates the data with a seeded xoshiro256** PRNG instead of /dev/urandom, so a benchmark payload is reproducible and costs no system call.
+ * --zerocopy generates one chunk of data (up to READ_CHUNK bytes) and sends it repeatedly with vmsplice+splice, so the socket takes
+ * the pages of the chunk instead of copying them. The chunk is never written again, because the kernel may still reference its pages.
+ * In all modes a short send is continued untill the whole data was sent.
+ * --framed uses the framed protocol of pcc_protocol.h instead of the legacy one (send untill EOF, decimal answer),
+ * and --histogram also asks for the amount of every printable character, which is printed like the server does.
+ * --analyzer printable|bytes|class|utf8 selects the analyzer of the framed request (printable by default), its count and histogram
+ * are printed.
+ * --unix PATH connects to the UNIX domain socket of pcc_server --unix PATH instead (ip and port are ignored), and --shm (which implies
+ * --framed) writes the requests to a shared memory ring that is passed to the server with the hello, instead of sending them through
+ * the socket: the data is generated (or read from /dev/urandom) straight into the ring, and the server analyzes it there.
+ *
+ * Load generator mode: pcc_client <ip> <port> <N> --connections C [--requests R] [--duration T] [--seed S] [--zerocopy] [--framed [--pipeline D]]
+ *                     [--unix PATH [--shm]]
+ * C threads keep one session each in flight (connect, send N bytes, recieve the answer) untill R sessions were made or T seconds passed.
+ * With --framed every thread keeps a single connection and pipelines up to D requests on it instead.
+ * Every thread sends a PRNG payload whose printable count is computed locally, and every answer is verified against it.
+ * The result is printed to stdout as one JSON object: throughput (GB/s, requests/s), errors, mismatches and p50/p99/p999 latency.
+ * (build: gcc -O2 -pthread pcc_client.c -o pcc_client)
+ *
  */
 
+#define _GNU_SOURCE /* vmsplice, splice, memfd_create */
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -17,14 +43,106 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <time.h>
+#include <endian.h>
+
+#include "pcc_protocol.h"
 
 #define BUFFER_SIZE 34
 #define READ_CHUNK 3355442
+#define PIPE_SIZE (1 << 20)
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+#define SOURCE_URANDOM 0
+#define SOURCE_PRNG 1
+
+#define LATENCY_SUB_BUCKETS 64 /* log-linear histogram: 64 linear buckets per power of 2, so a percentile is off by less than 1.6% */
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * 40)
+#define MAX_CONNECTIONS 10000
+#define MAX_PIPELINE 1024 /* the replies of a full pipeline stay far below the server's output high water */
+#define NUM_PRINTABLE 95
+#define NUM_BYTES 256
+#define OFFSET 32
+#define SHM_RING_CAPACITY (1U << 22) /* a power of 2 */
+
+typedef struct load_config{ /* the options of the load generator mode */
+    struct sockaddr_in serv_addr;
+    struct sockaddr_un unix_addr;
+    int local; /* connect to unix_addr instead of serv_addr */
+    int shm;
+    unsigned int length;
+    int connections;
+    long long requests; /* 0 means unlimited */
+    double duration; /* seconds, 0 means unlimited */
+    uint64_t seed;
+    int zerocopy;
+    int framed;
+    int pipeline;
+}LoadConfig;
+
+typedef struct load_thread{ /* the state and the results of a single load generator thread */
+    pthread_t thread;
+    int id;
+    char* chunk;
+    unsigned int chunk_len;
+    unsigned long long expected;
+    unsigned long long completed;
+    unsigned long long errors;
+    unsigned long long mismatches;
+    unsigned long long bytes;
+    unsigned long long latency[LATENCY_BUCKETS]; /* nanoseconds */
+}LoadThread;
+
+typedef struct shm_ring{ /* the client's side of a shared memory ring, see pcc_protocol.h */
+    PccShmRing* ring;
+    char* data;
+    uint64_t head; /* the client's copy of ring->head */
+    int sockfd;
+    int doorbell; /* the client writes it to wake the server */
+    int wakeup; /* the server writes it to wake the client */
+}ShmRing;
+
 int read_and_send_length_bytes_from_file(int sockfd, unsigned int len);
+int generate_and_send(int sockfd, unsigned int len, int source, int zerocopy);
+int fill_buffer(int source, int fd, char* buffer, unsigned int len);
+int send_all(int sockfd, const char* buffer, size_t len);
+int send_spliced(int sockfd, const char* chunk, unsigned int chunk_len, unsigned int len);
+void prng_seed(uint64_t state[4], uint64_t seed);
+void prng_fill(uint64_t state[4], char* buffer, size_t len);
+int run_load(LoadConfig* load);
+void* run_load_thread(void* arg);
+int run_session(LoadThread* thread, unsigned long long* answer);
+int run_framed_connection(LoadThread* thread);
+int claim_session();
+void record_answer(LoadThread* thread, double start, unsigned long long answer);
+int send_payload(int sockfd, const char* chunk, unsigned int chunk_len, unsigned int len, int zerocopy);
+int recv_all(int sockfd, void* buffer, size_t len);
+int framed_hello(int sockfd);
+int send_request_header(int sockfd, unsigned int len, unsigned int flags);
+int connect_server();
+int shm_hello(int sockfd, ShmRing* shm);
+char* shm_reserve(ShmRing* shm, size_t wanted, size_t* len);
+void shm_commit(ShmRing* shm, size_t len);
+int shm_write(ShmRing* shm, const char* data, size_t len);
+int shm_generate(ShmRing* shm, unsigned int len, int source);
+void shm_close(ShmRing* shm);
+int send_framed_request(int sockfd, ShmRing* shm, LoadThread* thread);
+int parse_analyzer(const char* name);
+void print_reply(int analyzer, uint64_t reply[], int histogram);
+unsigned long long count_printable_local(const char* buffer, unsigned int len);
+double now_seconds();
+int latency_bucket(unsigned long long value);
+unsigned long long latency_bucket_value(int bucket);
+unsigned long long latency_percentile(unsigned long long histogram[LATENCY_BUCKETS], unsigned long long total, double percentile);
 
 char big_buffer[READ_CHUNK] = {'\0'};
+static uint64_t prng_state[4];
+static LoadConfig load_config;
+static long long sessions_started=0; /* claimed by the load generator threads with an atomic increment */
+static double load_deadline=0;
 
 /*
 * main - Initiate connections, read N bytes from the file, send the information to the server and prints back the answer
@@ -36,12 +154,89 @@ int main(int argc, char** argv){
 
     
     char buffer[BUFFER_SIZE] = {'\0'};
-    unsigned int length = (unsigned int) strtoul(argv[3], NULL, 10);
-    if( (sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-      fprintf(stderr, "%s\n", strerror(errno));
-      return 1;
+    int i, source = SOURCE_URANDOM, zerocopy = 0, usage = 0, histogram = 0, analyzer = 0;
+    uint64_t reply[1 + NUM_BYTES];
+    uint32_t header[2];
+    ShmRing shm;
+    if (argc < 4){
+        usage = 1;
     }
+    else {
+        memset(&load_config, 0, sizeof(load_config));
+        load_config.length = (unsigned int) strtoul(argv[3], NULL, 10);
+    }
+    for (i=4 ; i < argc && !usage ; i++){
+        if (strcmp(argv[i], "--seed")==0 && i+1 < argc){
+            source = SOURCE_PRNG;
+            load_config.seed = strtoull(argv[++i], NULL, 10);
+            prng_seed(prng_state, load_config.seed);
+        }
+        else if (strcmp(argv[i], "--zerocopy")==0){
+            zerocopy = 1;
+        }
+        else if (strcmp(argv[i], "--connections")==0 && i+1 < argc){
+            load_config.connections = (int) strtol(argv[++i], NULL, 10);
+            usage = load_config.connections < 1 || load_config.connections > MAX_CONNECTIONS;
+        }
+        else if (strcmp(argv[i], "--requests")==0 && i+1 < argc){
+            load_config.requests = strtoll(argv[++i], NULL, 10);
+            usage = load_config.requests < 1;
+        }
+        else if (strcmp(argv[i], "--duration")==0 && i+1 < argc){
+            load_config.duration = strtod(argv[++i], NULL);
+            usage = load_config.duration <= 0;
+        }
+        else if (strcmp(argv[i], "--framed")==0){
+            load_config.framed = 1;
+        }
+        else if (strcmp(argv[i], "--histogram")==0){
+            histogram = 1;
+        }
+        else if (strcmp(argv[i], "--analyzer")==0 && i+1 < argc){
+            analyzer = parse_analyzer(argv[++i]);
+            usage = analyzer==-1;
+        }
+        else if (strcmp(argv[i], "--pipeline")==0 && i+1 < argc){
+            load_config.pipeline = (int) strtol(argv[++i], NULL, 10);
+            usage = load_config.pipeline < 1 || load_config.pipeline > MAX_PIPELINE;
+        }
+        else if (strcmp(argv[i], "--unix")==0 && i+1 < argc){
+            load_config.local = 1;
+            load_config.unix_addr.sun_family = AF_UNIX;
+            usage = strlen(argv[++i]) >= sizeof(load_config.unix_addr.sun_path);
+            if (!usage){
+                strcpy(load_config.unix_addr.sun_path, argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--shm")==0){
+            load_config.shm = 1;
+            load_config.framed = 1;
+        }
+        else {
+            usage = 1;
+        }
+    }
+    if (!usage && load_config.connections==0 && (load_config.requests!=0 || load_config.duration!=0 || load_config.pipeline!=0)){ /* load generator options */
+        usage = 1;
+    }
+    if (!usage && ((histogram || analyzer!=0) && (!load_config.framed || load_config.connections!=0))){ /* single framed request options */
+        usage = 1;
+    }
+    if (!usage && load_config.pipeline!=0 && !load_config.framed){
+        usage = 1;
+    }
+    if (!usage && load_config.shm && (!load_config.local || zerocopy)){ /* the ring is passed over the UNIX socket, and is written in place */
+        usage = 1;
+    }
+    if (analyzer==0){ /* always explicit, so the size of the histogram is known */
+        analyzer = PCC_ANALYZER_PRINTABLE;
+    }
+    if (usage){
+        fprintf(stderr, "Usage: %s <ip> <port> <N> [--seed S] [--zerocopy] [--framed [--histogram] [--analyzer printable|bytes|class|utf8]] "
+                        "[--connections C [--requests R] [--duration T] [--pipeline D]] [--unix PATH [--shm]]\n", argv[0]);
+        return 1;
+    }
+    unsigned int length = load_config.length;
 
     /* server setup */
     memset(&serv_addr, 0, sizeof(serv_addr));
@@ -49,16 +244,40 @@ int main(int argc, char** argv){
     unsigned int port = (unsigned int) strtoul(argv[2], NULL, 10);
     serv_addr.sin_port = htons(port); 
     serv_addr.sin_addr.s_addr = inet_addr(argv[1]);
-    
+    load_config.serv_addr = serv_addr;
 
-    if( connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0)
-    {
+    if (load_config.connections > 0){
+        load_config.zerocopy = zerocopy;
+        return run_load(&load_config)==-1 ? 1 : 0;
+    }
+    sockfd = connect_server();
+    if (sockfd==-1){
         fprintf(stderr, "%s\n", strerror(errno));
         return 1;
     }
     /***************/
-    if (-1==read_and_send_length_bytes_from_file(sockfd, length)){
-        return 1;
+    if (load_config.shm){ /* the request is written to the ring, and its data is generated right into it */
+        header[0] = htonl(length);
+        header[1] = htonl((histogram ? PCC_FLAG_HISTOGRAM : 0) | (analyzer << PCC_ANALYZER_SHIFT));
+        if (shm_hello(sockfd, &shm)==-1 || shm_write(&shm, (char*)header, sizeof(header))==-1 || shm_generate(&shm, length, source)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return 1;
+        }
+    }
+    else {
+        if (load_config.framed && (framed_hello(sockfd)==-1 || send_request_header(sockfd, length,
+                                                                      (histogram ? PCC_FLAG_HISTOGRAM : 0) | (analyzer << PCC_ANALYZER_SHIFT))==-1)){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return 1;
+        }
+        if (source==SOURCE_URANDOM && !zerocopy){
+            if (-1==read_and_send_length_bytes_from_file(sockfd, length)){
+                return 1;
+            }
+        }
+        else if (-1==generate_and_send(sockfd, length, source, zerocopy)){
+            return 1;
+        }
     }
     if (shutdown(sockfd, SHUT_WR) ==-1 ){
         fprintf(stderr, "%s\n", strerror(errno));
@@ -66,13 +285,28 @@ int main(int argc, char** argv){
     }
 
     /* recieve the computation done by the server */
+    if (load_config.framed){
+        if (recv_all(sockfd, reply, sizeof(uint64_t))==-1 ||
+            (histogram && analyzer==PCC_ANALYZER_PRINTABLE && recv_all(sockfd, reply + 1, NUM_PRINTABLE*sizeof(uint64_t))==-1) ||
+            (histogram && (analyzer==PCC_ANALYZER_BYTES || analyzer==PCC_ANALYZER_CLASS) &&
+             recv_all(sockfd, reply + 1, NUM_BYTES*sizeof(uint64_t))==-1)){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return 1;
+        }
+        print_reply(analyzer, reply, histogram);
+        if (load_config.shm){
+            shm_close(&shm);
+        }
+        close(sockfd);
+        return 0;
+    }
     bytes_read = recv(sockfd,buffer ,BUFFER_SIZE ,0);
     if( bytes_read < 0 ){
         fprintf(stderr, "%s\n", strerror(errno));
         return 1;
     }
-    unsigned int C = (unsigned int) strtoul(buffer, NULL, 10);
-    printf("# of printable characters: %u\n", C);
+    unsigned long long C = strtoull(buffer, NULL, 10);
+    printf("# of printable characters: %llu\n", C);
     close(sockfd);
     return 0;
 }
@@ -101,8 +335,9 @@ int read_and_send_length_bytes_from_file(int sockfd, unsigned int len){
         }
         else {
             total_bytes_read+=bytes_read;
-            if (send(sockfd, big_buffer , bytes_read, 0) < 1 ) {
+            if (send_all(sockfd, big_buffer , bytes_read) == -1 ) {
                 fprintf(stderr, "%s\n", strerror(errno));
+                close(fd);
                 return -1;
             }
             if (total_bytes_read==len) break;
@@ -111,4 +346,887 @@ int read_and_send_length_bytes_from_file(int sockfd, unsigned int len){
     close(fd);
     return 0;
     
-}
\ No newline at end of file
+}
+
+/**
+ * send_all - sends the whole buffer, continuing after short sends
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param *buffer - the data
+ * @param len - amount of bytes to send
+ * @return int - 0 if successfull, else -1
+ */
+int send_all(int sockfd, const char* buffer, size_t len){
+    ssize_t bytes_sent;
+    while (len > 0){
+        bytes_sent = send(sockfd, buffer, len, 0);
+        if (bytes_sent==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            return -1;
+        }
+        buffer+=bytes_sent;
+        len-=bytes_sent;
+    }
+    return 0;
+}
+
+/**
+ * prng_seed - seeds a xoshiro256** state, expanded from the seed with splitmix64
+ * @param state - the state to seed
+ * @param seed - the seed
+ * @return void
+ */
+void prng_seed(uint64_t state[4], uint64_t seed){
+    int i;
+    uint64_t z;
+    for (i=0 ; i < 4 ; i++){
+        seed += 0x9E3779B97F4A7C15ULL;
+        z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        state[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * prng_fill - fills the buffer with the next bytes of a xoshiro256** stream
+ * @param state - the state of the stream
+ * @param *buffer - the buffer to fill
+ * @param len - amount of bytes
+ * @return void
+ */
+void prng_fill(uint64_t state[4], char* buffer, size_t len){
+    uint64_t result, t;
+    size_t i;
+    for (i=0 ; i < len ; i+=sizeof(result)){
+        result = state[1] * 5;
+        result = ((result << 7) | (result >> 57)) * 9;
+        t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = (state[3] << 45) | (state[3] >> 19);
+        memcpy(buffer + i, &result, MIN(sizeof(result), len - i));
+    }
+}
+
+/**
+ * fill_buffer - fills the buffer from the PRNG or from /dev/urandom
+ * @param source - SOURCE_PRNG or SOURCE_URANDOM
+ * @param fd - /dev/urandom, used only with SOURCE_URANDOM
+ * @param *buffer - the buffer to fill
+ * @param len - amount of bytes
+ * @return int - 0 if successfull, else -1
+ */
+int fill_buffer(int source, int fd, char* buffer, unsigned int len){
+    ssize_t bytes_read;
+    if (source==SOURCE_PRNG){
+        prng_fill(prng_state, buffer, len);
+        return 0;
+    }
+    while (len > 0){
+        bytes_read = read(fd, buffer, len);
+        if (bytes_read==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            return -1;
+        }
+        buffer+=bytes_read;
+        len-=bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * send_spliced - sends len bytes that are the chunk repeated, by mapping the chunk's pages into a pipe (vmsplice) and moving them
+ * to the socket (splice), so the data isn't copied from user space
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param *chunk - the data, which must not be written while the kernel may still reference it
+ * @param chunk_len - size of the chunk
+ * @param len - the total amount of bytes to send
+ * @return int - 0 if successfull, else -1
+ */
+int send_spliced(int sockfd, const char* chunk, unsigned int chunk_len, unsigned int len){
+    int pipefd[2];
+    struct iovec iov;
+    ssize_t in_pipe, moved;
+    unsigned int total_sent=0, offset=0;
+    if (pipe(pipefd)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, PIPE_SIZE); /* best effort, a smaller pipe only means more iterations */
+    while (total_sent < len){
+        iov.iov_base = (void*)(chunk + offset);
+        iov.iov_len = MIN(chunk_len - offset, len - total_sent);
+        in_pipe = vmsplice(pipefd[1], &iov, 1, 0);
+        if (in_pipe==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            fprintf(stderr, "%s\n", strerror(errno));
+            close(pipefd[0]); close(pipefd[1]);
+            return -1;
+        }
+        offset = (offset + in_pipe) % chunk_len;
+        total_sent += in_pipe;
+        while (in_pipe > 0){ /* drain the pipe into the socket */
+            moved = splice(pipefd[0], NULL, sockfd, NULL, in_pipe, SPLICE_F_MOVE | (total_sent < len ? SPLICE_F_MORE : 0));
+            if (moved==-1){
+                if (errno==EINTR){
+                    continue;
+                }
+                fprintf(stderr, "%s\n", strerror(errno));
+                close(pipefd[0]); close(pipefd[1]);
+                return -1;
+            }
+            in_pipe-=moved;
+        }
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return 0;
+}
+
+/**
+ * generate_and_send - generates the data and sends it to the server
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param len - the total amount of bytes to send
+ * @param source - SOURCE_PRNG or SOURCE_URANDOM
+ * @param zerocopy - if set, one chunk is generated and sent repeatedly with send_spliced
+ * @return int - 0 if successfull, else -1
+ */
+int generate_and_send(int sockfd, unsigned int len, int source, int zerocopy){
+    int fd = -1;
+    unsigned int total_sent=0, size_to_send;
+    if (source==SOURCE_URANDOM){
+        fd = open("/dev/urandom", O_RDONLY);
+        if (fd ==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (zerocopy){
+        size_to_send = MIN(READ_CHUNK, len);
+        if (fill_buffer(source, fd, big_buffer, size_to_send)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (fd!=-1) close(fd);
+        return len==0 ? 0 : send_spliced(sockfd, big_buffer, size_to_send, len);
+    }
+    while (total_sent < len){
+        size_to_send = MIN(READ_CHUNK, len - total_sent);
+        if (fill_buffer(source, fd, big_buffer, size_to_send)==-1 || send_all(sockfd, big_buffer, size_to_send)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            if (fd!=-1) close(fd);
+            return -1;
+        }
+        total_sent+=size_to_send;
+    }
+    if (fd!=-1) close(fd);
+    return 0;
+}
+
+/**
+ * now_seconds - monotonic time
+ * @return double - seconds
+ */
+double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * count_printable_local - counts the printable characters of the payload, independently of the server's kernel
+ * @param *buffer - the data
+ * @param len - amount of bytes
+ * @return unsigned long long - amount of printable characters
+ */
+unsigned long long count_printable_local(const char* buffer, unsigned int len){
+    unsigned long long count=0;
+    unsigned int i;
+    for (i=0 ; i < len ; i++){
+        if (buffer[i] >= 32 && buffer[i] <= 126){
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * latency_bucket - the histogram bucket of a latency
+ * @param value - the latency in nanoseconds
+ * @return int - the bucket
+ */
+int latency_bucket(unsigned long long value){
+    int shift;
+    if (value < 2*LATENCY_SUB_BUCKETS){
+        return (int)value;
+    }
+    shift = 63 - __builtin_clzll(value) - 6; /* value >> shift is in [64, 128) */
+    if (shift*LATENCY_SUB_BUCKETS + (int)(value >> shift) >= LATENCY_BUCKETS){
+        return LATENCY_BUCKETS - 1;
+    }
+    return shift*LATENCY_SUB_BUCKETS + (int)(value >> shift);
+}
+
+/**
+ * latency_bucket_value - the lowest latency of a histogram bucket
+ * @param bucket - the bucket
+ * @return unsigned long long - the latency in nanoseconds
+ */
+unsigned long long latency_bucket_value(int bucket){
+    int shift;
+    if (bucket < 2*LATENCY_SUB_BUCKETS){
+        return (unsigned long long)bucket;
+    }
+    shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    return (unsigned long long)(bucket - shift*LATENCY_SUB_BUCKETS) << shift;
+}
+
+/**
+ * latency_percentile - the latency that the given fraction of the sessions didn't exceed
+ * @param histogram - the latency histogram
+ * @param total - amount of sessions in the histogram
+ * @param percentile - between 0 and 1
+ * @return unsigned long long - the latency in nanoseconds
+ */
+unsigned long long latency_percentile(unsigned long long histogram[LATENCY_BUCKETS], unsigned long long total, double percentile){
+    unsigned long long seen=0, rank = (unsigned long long)(percentile * total);
+    int i;
+    if (rank >= total && total > 0){
+        rank = total - 1;
+    }
+    for (i=0 ; i < LATENCY_BUCKETS ; i++){
+        seen+=histogram[i];
+        if (seen > rank){
+            return latency_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+/**
+ * send_payload - sends len bytes that are the chunk repeated
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param *chunk - the data
+ * @param chunk_len - size of the chunk
+ * @param len - the total amount of bytes to send
+ * @param zerocopy - if set, the data is sent with send_spliced
+ * @return int - 0 if successfull, else -1
+ */
+int send_payload(int sockfd, const char* chunk, unsigned int chunk_len, unsigned int len, int zerocopy){
+    unsigned int total_sent=0, size_to_send;
+    if (zerocopy){
+        return len==0 ? 0 : send_spliced(sockfd, chunk, chunk_len, len);
+    }
+    while (total_sent < len){
+        size_to_send = MIN(chunk_len, len - total_sent);
+        if (send_all(sockfd, chunk, size_to_send)==-1){
+            return -1;
+        }
+        total_sent+=size_to_send;
+    }
+    return 0;
+}
+
+/**
+ * recv_all - recieves exactly len bytes
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param *buffer - the buffer to fill
+ * @param len - amount of bytes
+ * @return int - 0 if successfull, else -1 (errno is EPIPE if the server closed the connection)
+ */
+int recv_all(int sockfd, void* buffer, size_t len){
+    ssize_t bytes_read;
+    while (len > 0){
+        bytes_read = recv(sockfd, buffer, len, 0);
+        if (bytes_read==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read==0){
+            errno = EPIPE;
+            return -1;
+        }
+        buffer = (char*)buffer + bytes_read;
+        len-=bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * framed_hello - exchanges hellos with the server and checks that it speaks the client's version
+ * @param sockfd - the file descriptor of the tcp connection
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int framed_hello(int sockfd){
+    unsigned char hello[PCC_HELLO_SIZE] = {0};
+    memcpy(hello, PCC_MAGIC, PCC_MAGIC_SIZE);
+    hello[PCC_MAGIC_SIZE] = PCC_VERSION;
+    if (send_all(sockfd, (char*)hello, PCC_HELLO_SIZE)==-1 || recv_all(sockfd, hello, PCC_HELLO_SIZE)==-1){
+        return -1;
+    }
+    if (memcmp(hello, PCC_MAGIC, PCC_MAGIC_SIZE)!=0 || hello[PCC_MAGIC_SIZE]!=PCC_VERSION){
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * send_request_header - sends the header of a framed request
+ * @param sockfd - the file descriptor of the tcp connection
+ * @param len - amount of data bytes in the request
+ * @param flags - PCC_FLAG_*
+ * @return int - 0 if successfull, else -1
+ */
+int send_request_header(int sockfd, unsigned int len, unsigned int flags){
+    uint32_t header[2];
+    header[0] = htonl(len);
+    header[1] = htonl(flags);
+    return send_all(sockfd, (char*)header, sizeof(header));
+}
+
+/**
+ * connect_server - connects to the server's TCP port, or to its UNIX domain socket with --unix
+ * @return int - the socket if successfull, else -1
+ */
+int connect_server(){
+    int sockfd = socket(load_config.local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (sockfd==-1){
+        return -1;
+    }
+    if ((load_config.local ? connect(sockfd, (struct sockaddr*) &load_config.unix_addr, sizeof(load_config.unix_addr))
+                           : connect(sockfd, (struct sockaddr*) &load_config.serv_addr, sizeof(load_config.serv_addr))) < 0){
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * shm_hello - creates a ring and its eventfds, and passes them to the server with the hello
+ * @param sockfd - the file descriptor of the connection to the server's UNIX domain socket
+ * @param *shm - filled with the client's side of the ring
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int shm_hello(int sockfd, ShmRing* shm){
+    unsigned char hello[PCC_HELLO_SIZE] = {0};
+    char control[CMSG_SPACE(PCC_SHM_FDS * sizeof(int))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    int fds[PCC_SHM_FDS], saved_errno;
+    void* map = MAP_FAILED;
+    memset(shm, 0, sizeof(ShmRing));
+    shm->sockfd = sockfd;
+    fds[0] = memfd_create("pcc_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    shm->doorbell = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->wakeup = fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0]==-1 || fds[1]==-1 || fds[2]==-1 || ftruncate(fds[0], PCC_SHM_DATA_OFFSET + SHM_RING_CAPACITY)==-1 ||
+        fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL)==-1 ||
+        (map = mmap(NULL, PCC_SHM_DATA_OFFSET + SHM_RING_CAPACITY, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0))==MAP_FAILED){
+        goto error;
+    }
+    shm->ring = (PccShmRing*)map;
+    shm->data = (char*)map + PCC_SHM_DATA_OFFSET;
+    shm->ring->magic = PCC_SHM_MAGIC;
+    shm->ring->capacity = SHM_RING_CAPACITY;
+    memcpy(hello, PCC_MAGIC, PCC_MAGIC_SIZE);
+    hello[PCC_MAGIC_SIZE] = PCC_VERSION;
+    hello[PCC_HELLO_TRANSPORT_OFFSET] = PCC_TRANSPORT_SHM;
+    iov.iov_base = hello;
+    iov.iov_len = PCC_HELLO_SIZE;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(PCC_SHM_FDS * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, PCC_SHM_FDS * sizeof(int));
+    if (sendmsg(sockfd, &msg, 0)!=PCC_HELLO_SIZE || recv_all(sockfd, hello, PCC_HELLO_SIZE)==-1){
+        goto error;
+    }
+    close(fds[0]); /* the mapping keeps the memory */
+    if (memcmp(hello, PCC_MAGIC, PCC_MAGIC_SIZE)!=0 || hello[PCC_MAGIC_SIZE]!=PCC_VERSION ||
+        hello[PCC_HELLO_TRANSPORT_OFFSET]!=PCC_TRANSPORT_SHM){
+        shm_close(shm);
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    return 0;
+
+error:
+    saved_errno = errno;
+    if (map!=MAP_FAILED){
+        munmap(map, PCC_SHM_DATA_OFFSET + SHM_RING_CAPACITY);
+    }
+    if (fds[0]!=-1) close(fds[0]);
+    if (fds[1]!=-1) close(fds[1]);
+    if (fds[2]!=-1) close(fds[2]);
+    errno = saved_errno;
+    return -1;
+}
+
+/**
+ * shm_reserve - waits untill the ring has room, and returns the contiguous free space at its head
+ * @param *shm - the ring
+ * @param wanted - the amount of bytes the caller has to write
+ * @param *len - filled with the size of the returned space, between 1 and wanted
+ * @return char* - the space, or NULL if the server closed the connection (errno is EPIPE) or an error occurred
+ */
+char* shm_reserve(ShmRing* shm, size_t wanted, size_t* len){
+    struct pollfd fds[2];
+    uint64_t tail, offset, value;
+    while (1){
+        tail = __atomic_load_n(&shm->ring->tail, __ATOMIC_ACQUIRE);
+        if (shm->head - tail < SHM_RING_CAPACITY){
+            break;
+        }
+        __atomic_store_n(&shm->ring->client_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shm->ring->tail, __ATOMIC_SEQ_CST)!=tail){ /* the server made room meanwhile */
+            __atomic_store_n(&shm->ring->client_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        fds[0].fd = shm->wakeup;
+        fds[0].events = POLLIN;
+        fds[1].fd = shm->sockfd; /* the server closes the connection if it failed */
+        fds[1].events = POLLRDHUP;
+        if (poll(fds, 2, -1)==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            return NULL;
+        }
+        if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)){
+            errno = EPIPE;
+            return NULL;
+        }
+        if ((fds[0].revents & POLLIN) && read(shm->wakeup, &value, sizeof(value))==-1 && errno!=EAGAIN){
+            return NULL;
+        }
+    }
+    offset = shm->head & (SHM_RING_CAPACITY - 1);
+    *len = MIN(wanted, MIN(SHM_RING_CAPACITY - (shm->head - tail), SHM_RING_CAPACITY - offset));
+    return shm->data + offset;
+}
+
+/**
+ * shm_commit - publishes bytes that were written to the space returned by shm_reserve, and wakes the server if it sleeps
+ * @param *shm - the ring
+ * @param len - amount of bytes
+ * @return void
+ */
+void shm_commit(ShmRing* shm, size_t len){
+    uint64_t one = 1;
+    shm->head+=len;
+    __atomic_store_n(&shm->ring->head, shm->head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->ring->server_sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&shm->ring->server_sleeping, 0, __ATOMIC_SEQ_CST)){
+        if (write(shm->doorbell, &one, sizeof(one))==-1){ /* only fails if the counter is about to overflow, so the server is awake anyway */
+            return;
+        }
+    }
+}
+
+/**
+ * shm_write - copies data to the ring and publishes it
+ * @param *shm - the ring
+ * @param *data - the data
+ * @param len - amount of bytes
+ * @return int - 0 if successfull, else -1
+ */
+int shm_write(ShmRing* shm, const char* data, size_t len){
+    char* space;
+    size_t n;
+    while (len > 0){
+        space = shm_reserve(shm, len, &n);
+        if (space==NULL){
+            return -1;
+        }
+        memcpy(space, data, n);
+        shm_commit(shm, n);
+        data+=n;
+        len-=n;
+    }
+    return 0;
+}
+
+/**
+ * shm_generate - generates the data straight into the ring, from the PRNG or from /dev/urandom, and publishes it piece by piece,
+ * so the server analyzes while the rest is generated. The PRNG is filled in chunks of READ_CHUNK like generate_and_send, so a seed
+ * gives the same data over every transport: a chunk that doesn't fit before the end of the ring is generated aside and copied
+ * @param *shm - the ring
+ * @param len - the total amount of bytes
+ * @param source - SOURCE_PRNG or SOURCE_URANDOM
+ * @return int - 0 if successfull, else -1
+ */
+int shm_generate(ShmRing* shm, unsigned int len, int source){
+    int fd = -1, ret_val = 0;
+    unsigned int size;
+    char* space;
+    size_t n;
+    if (source==SOURCE_URANDOM){
+        fd = open("/dev/urandom", O_RDONLY);
+        if (fd==-1){
+            return -1;
+        }
+    }
+    while (len > 0 && ret_val==0){
+        size = MIN(READ_CHUNK, len);
+        space = shm_reserve(shm, size, &n);
+        if (space==NULL){
+            ret_val = -1;
+        }
+        else if (source==SOURCE_PRNG && n < size){
+            ret_val = (fill_buffer(source, fd, big_buffer, size)==-1 || shm_write(shm, big_buffer, size)==-1) ? -1 : 0;
+            len-=size;
+        }
+        else if (fill_buffer(source, fd, space, n)==-1){
+            ret_val = -1;
+        }
+        else {
+            shm_commit(shm, n);
+            len-=n;
+        }
+    }
+    if (fd!=-1) close(fd);
+    return ret_val;
+}
+
+/**
+ * shm_close - unmaps the ring and closes its eventfds
+ * @param *shm - the ring
+ * @return void
+ */
+void shm_close(ShmRing* shm){
+    munmap(shm->ring, PCC_SHM_DATA_OFFSET + SHM_RING_CAPACITY);
+    close(shm->doorbell);
+    close(shm->wakeup);
+}
+
+/**
+ * parse_analyzer - the analyzer of a name as given on the command line
+ * @param *name - "printable", "bytes", "class" or "utf8"
+ * @return int - PCC_ANALYZER_*, or -1 if there is no such analyzer
+ */
+int parse_analyzer(const char* name){
+    if (strcmp(name, "printable")==0){
+        return PCC_ANALYZER_PRINTABLE;
+    }
+    if (strcmp(name, "bytes")==0){
+        return PCC_ANALYZER_BYTES;
+    }
+    if (strcmp(name, "class")==0){
+        return PCC_ANALYZER_CLASS;
+    }
+    if (strcmp(name, "utf8")==0){
+        return PCC_ANALYZER_UTF8;
+    }
+    return -1;
+}
+
+/**
+ * print_reply - prints the reply of a framed request
+ * @param analyzer - the analyzer of the request
+ * @param reply - the count and the histogram, as recieved
+ * @param histogram - whether the reply holds the histogram
+ * @return void
+ */
+void print_reply(int analyzer, uint64_t reply[], int histogram){
+    unsigned long long count = be64toh(reply[0]);
+    int i;
+    switch (analyzer){
+    case PCC_ANALYZER_PRINTABLE:
+        printf("# of printable characters: %llu\n", count);
+        for (i=0 ; histogram && i < NUM_PRINTABLE ; i++){
+            printf("char '%c' : %llu times\n", i+OFFSET, (unsigned long long)be64toh(reply[1+i]));
+        }
+        return;
+    case PCC_ANALYZER_UTF8:
+        if (count==PCC_COUNT_INVALID){
+            printf("invalid UTF-8\n");
+        }
+        else {
+            printf("# of printable codepoints: %llu\n", count);
+        }
+        return;
+    default:
+        printf(analyzer==PCC_ANALYZER_BYTES ? "# of bytes: %llu\n" : "# of classified bytes: %llu\n", count);
+        for (i=0 ; histogram && i < NUM_BYTES ; i++){
+            if (reply[1+i]!=0){
+                printf("%s %d : %llu times\n", analyzer==PCC_ANALYZER_BYTES ? "byte" : "class", i, (unsigned long long)be64toh(reply[1+i]));
+            }
+        }
+        return;
+    }
+}
+
+/**
+ * run_session - a single session: connect, send the thread's payload, recieve the answer
+ * @param *thread - the load generator thread
+ * @param *answer - the amount of printable characters that the server answered
+ * @return int - 0 if successfull, else -1
+ */
+int run_session(LoadThread* thread, unsigned long long* answer){
+    char buffer[BUFFER_SIZE] = {'\0'};
+    int sockfd, bytes_read, total_read=0, ret_val=-1;
+    sockfd = connect_server();
+    if (sockfd==-1){
+        return -1;
+    }
+    if (send_payload(sockfd, thread->chunk, thread->chunk_len, load_config.length, load_config.zerocopy)==-1){
+        close(sockfd);
+        return -1;
+    }
+    if (shutdown(sockfd, SHUT_WR)==-1){
+        close(sockfd);
+        return -1;
+    }
+    while (total_read < BUFFER_SIZE - 1){ /* the server closes the connection after the answer */
+        bytes_read = recv(sockfd, buffer + total_read, BUFFER_SIZE - 1 - total_read, 0);
+        if (bytes_read==-1 && errno==EINTR){
+            continue;
+        }
+        if (bytes_read <= 0){
+            ret_val = (bytes_read==0 && total_read > 0) ? 0 : -1;
+            break;
+        }
+        total_read+=bytes_read;
+    }
+    close(sockfd);
+    *answer = strtoull(buffer, NULL, 10);
+    return ret_val;
+}
+
+/**
+ * run_framed_connection - opens a framed connection and pipelines requests on it, keeping up to load_config.pipeline of them
+ * in flight, untill the requests or the duration of the load are exhausted
+ * @param *thread - the load generator thread
+ * @return int - 0 if successfull, else -1 (the requests in flight are counted as errors)
+ */
+int run_framed_connection(LoadThread* thread){
+    double sent_at[MAX_PIPELINE];
+    uint64_t reply;
+    int sockfd, head=0, in_flight=0, more=1;
+    ShmRing ring, *shm = load_config.shm ? &ring : NULL;
+    sockfd = connect_server();
+    if (sockfd==-1){
+        return -1;
+    }
+    if ((shm!=NULL ? shm_hello(sockfd, shm) : framed_hello(sockfd))==-1){
+        close(sockfd);
+        return -1;
+    }
+    while (1){
+        while (more && in_flight < load_config.pipeline){
+            more = claim_session();
+            if (!more){
+                break;
+            }
+            sent_at[(head + in_flight) % load_config.pipeline] = now_seconds();
+            in_flight++;
+            if (send_framed_request(sockfd, shm, thread)==-1){
+                thread->errors+=in_flight;
+                if (shm!=NULL){
+                    shm_close(shm);
+                }
+                close(sockfd);
+                return -1;
+            }
+        }
+        if (in_flight==0){
+            break;
+        }
+        if (recv_all(sockfd, &reply, sizeof(reply))==-1){
+            thread->errors+=in_flight;
+            if (shm!=NULL){
+                shm_close(shm);
+            }
+            close(sockfd);
+            return -1;
+        }
+        record_answer(thread, sent_at[head], be64toh(reply));
+        head = (head + 1) % load_config.pipeline;
+        in_flight--;
+    }
+    shutdown(sockfd, SHUT_WR);
+    if (shm!=NULL){
+        shm_close(shm);
+    }
+    close(sockfd);
+    return 0;
+}
+
+/**
+ * send_framed_request - sends a framed request of load_config.length bytes that are the thread's chunk repeated, through the socket
+ * or the ring
+ * @param sockfd - the file descriptor of the connection
+ * @param *shm - the ring, or NULL
+ * @param *thread - the load generator thread
+ * @return int - 0 if successfull, else -1
+ */
+int send_framed_request(int sockfd, ShmRing* shm, LoadThread* thread){
+    uint32_t header[2];
+    unsigned int total_sent=0, size_to_send;
+    if (shm==NULL){
+        return (send_request_header(sockfd, load_config.length, 0)==-1 ||
+                send_payload(sockfd, thread->chunk, thread->chunk_len, load_config.length, load_config.zerocopy)==-1) ? -1 : 0;
+    }
+    header[0] = htonl(load_config.length);
+    header[1] = 0;
+    if (shm_write(shm, (char*)header, sizeof(header))==-1){
+        return -1;
+    }
+    while (total_sent < load_config.length){
+        size_to_send = MIN(thread->chunk_len, load_config.length - total_sent);
+        if (shm_write(shm, thread->chunk, size_to_send)==-1){
+            return -1;
+        }
+        total_sent+=size_to_send;
+    }
+    return 0;
+}
+
+/**
+ * claim_session - claims the next session (or framed request), if the requests and the duration of the load are not exhausted
+ * @return int - 1 if claimed, else 0
+ */
+int claim_session(){
+    if (load_config.requests > 0 && __atomic_fetch_add(&sessions_started, 1, __ATOMIC_RELAXED) >= load_config.requests){
+        return 0;
+    }
+    if (load_config.duration > 0 && now_seconds() >= load_deadline){
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * record_answer - records a completed session (or framed request): its latency, and whether the answer is the expected one
+ * @param *thread - the load generator thread
+ * @param start - when the session started
+ * @param answer - the amount of printable characters that the server answered
+ * @return void
+ */
+void record_answer(LoadThread* thread, double start, unsigned long long answer){
+    double end = now_seconds();
+    thread->completed++;
+    thread->bytes+=load_config.length;
+    thread->latency[latency_bucket((unsigned long long)((end - start) * 1e9))]++;
+    if (answer!=thread->expected){
+        thread->mismatches++;
+    }
+}
+
+/**
+ * run_load_thread - runs sessions one after the other (or framed connections), untill the requests or the duration of the load are exhausted
+ * @param *arg - the load generator thread
+ * @return void* - NULL
+ */
+void* run_load_thread(void* arg){
+    LoadThread* thread = (LoadThread*)arg;
+    unsigned long long answer;
+    double start;
+    if (load_config.framed){
+        while (run_framed_connection(thread)==-1 && claim_session()){ /* reconnect after an error */
+            thread->errors++;
+        }
+        return NULL;
+    }
+    while (claim_session()){
+        start = now_seconds();
+        if (run_session(thread, &answer)==-1){
+            thread->errors++;
+            continue;
+        }
+        record_answer(thread, start, answer);
+    }
+    return NULL;
+}
+
+/**
+ * run_load - the load generator mode: creates the threads and their payloads, waits for them and prints the summary as JSON
+ * @param *load - the options
+ * @return int - 0 if successfull, else -1
+ */
+int run_load(LoadConfig* load){
+    LoadThread* threads;
+    unsigned long long* latency;
+    unsigned long long completed=0, errors=0, mismatches=0, bytes=0, reps;
+    uint64_t state[4];
+    double start, elapsed;
+    int i, j, ret_val;
+    if (load->requests==0 && load->duration==0){ /* by default every connection makes a single session */
+        load->requests = load->connections;
+    }
+    if (load->pipeline==0){
+        load->pipeline = 1;
+    }
+    threads = (LoadThread*)calloc(load->connections, sizeof(LoadThread));
+    latency = (unsigned long long*)calloc(LATENCY_BUCKETS, sizeof(unsigned long long));
+    if (threads==NULL || latency==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    for (i=0 ; i < load->connections ; i++){ /* every thread has its own reproducible payload and its expected answer */
+        threads[i].id = i;
+        threads[i].chunk_len = MIN(READ_CHUNK, load->length);
+        threads[i].chunk = (char*)malloc(threads[i].chunk_len + 1);
+        if (threads[i].chunk==NULL){
+            fprintf(stderr, "%s\n", strerror(errno));
+            return -1;
+        }
+        prng_seed(state, load->seed + i);
+        prng_fill(state, threads[i].chunk, threads[i].chunk_len);
+        if (threads[i].chunk_len > 0){
+            reps = load->length / threads[i].chunk_len;
+            threads[i].expected = reps * count_printable_local(threads[i].chunk, threads[i].chunk_len) +
+                                  count_printable_local(threads[i].chunk, load->length % threads[i].chunk_len);
+        }
+    }
+    start = now_seconds();
+    load_deadline = start + load->duration;
+    for (i=0 ; i < load->connections ; i++){
+        ret_val = pthread_create(&threads[i].thread, NULL, run_load_thread, &threads[i]);
+        if (ret_val){
+            fprintf(stderr,"%s\n", strerror(ret_val));
+            return -1;
+        }
+    }
+    for (i=0 ; i < load->connections ; i++){
+        pthread_join(threads[i].thread, NULL);
+        completed+=threads[i].completed;
+        errors+=threads[i].errors;
+        mismatches+=threads[i].mismatches;
+        bytes+=threads[i].bytes;
+        for (j=0 ; j < LATENCY_BUCKETS ; j++){
+            latency[j]+=threads[i].latency[j];
+        }
+        free(threads[i].chunk);
+    }
+    elapsed = now_seconds() - start;
+    printf("{\"connections\": %d, \"framed\": %s, \"pipeline\": %d, \"length\": %u, \"requests\": %llu, \"errors\": %llu, \"mismatches\": %llu, "
+           "\"bytes\": %llu, \"seconds\": %.6f, \"gb_per_sec\": %.6f, \"requests_per_sec\": %.2f, "
+           "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f}}\n",
+           load->connections, load->framed ? "true" : "false", load->pipeline, load->length, completed, errors, mismatches, bytes, elapsed,
+           elapsed > 0 ? bytes / elapsed / 1e9 : 0.0, elapsed > 0 ? completed / elapsed : 0.0,
+           latency_percentile(latency, completed, 0.50) / 1e3, latency_percentile(latency, completed, 0.99) / 1e3,
+           latency_percentile(latency, completed, 0.999) / 1e3);
+    free(threads);
+    free(latency);
+    return (errors > 0 || mismatches > 0) ? -1 : 0;
+}
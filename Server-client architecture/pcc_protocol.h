@@ -0,0 +1,68 @@
+#ifndef PCC_PROTOCOL_H
+#define PCC_PROTOCOL_H
+#include <stdint.h>
+
+/*
+ * The framed pcc protocol, all integers are big endian:
+ *
+ *  client -> server  hello:    PCC_MAGIC, version (1 byte), transport (1 byte), 2 zero bytes
+ *  server -> client  hello:    PCC_MAGIC, the server's version, the client's transport, 2 zero bytes
+ *  client -> server  request:  length (4 bytes), flags (4 bytes), length bytes of data     (repeated, may be pipelined)
+ *  server -> client  reply:    count (8 bytes) [, the histogram: 8 bytes per bucket if PCC_FLAG_HISTOGRAM]  (in request order)
+ *
+ * Bits 8..15 of the flags select the analyzer of the request (0 is the server's --analyzer):
+ *  PCC_ANALYZER_PRINTABLE  count: printable ASCII characters,                  histogram: 95 buckets, one per printable character
+ *  PCC_ANALYZER_BYTES      count: bytes,                                       histogram: 256 buckets, one per byte value
+ *  PCC_ANALYZER_CLASS      count: bytes of a class other than 0,               histogram: 256 buckets, one per class of the server's table
+ *  PCC_ANALYZER_UTF8       count: printable codepoints, or PCC_COUNT_INVALID,  histogram: none
+ *                          if the data isn't valid UTF-8
+ *
+ * The client closes its sending side when it has no more requests, and the server closes the connection after the last reply.
+ * A connection that doesn't start with the hello is a legacy one: its data is counted untill EOF and the answer is sent as a decimal string.
+ *
+ * The transport is PCC_TRANSPORT_SOCKET, unless the client is connected to the server's UNIX domain socket and sends its hello with
+ * PCC_TRANSPORT_SHM and PCC_SHM_FDS descriptors (SCM_RIGHTS): a memfd sealed with F_SEAL_SHRINK that holds a PccShmRing, an eventfd
+ * that wakes the server (the doorbell) and an eventfd that wakes the client, both non-blocking. The requests are then written to the
+ * ring in the format above instead of to the socket, and the replies still come through the socket. The ring is in the host's byte order.
+ * After publishing head, the client writes 1 to the doorbell if server_sleeping is set (clearing it); after publishing tail, the server
+ * does the same with the client's eventfd and client_sleeping. Both set their flag before they block, and check the other position again.
+ */
+
+#define PCC_MAGIC "\x89PCC"
+#define PCC_MAGIC_SIZE 4
+#define PCC_VERSION 1
+#define PCC_HELLO_SIZE 8
+#define PCC_REQUEST_HEADER_SIZE 8
+#define PCC_REPLY_SIZE 8
+
+#define PCC_FLAG_HISTOGRAM 1 /* the reply also holds the histogram of the analyzer */
+#define PCC_ANALYZER_SHIFT 8
+#define PCC_ANALYZER_MASK 0xFF
+
+#define PCC_ANALYZER_DEFAULT 0
+#define PCC_ANALYZER_PRINTABLE 1
+#define PCC_ANALYZER_BYTES 2
+#define PCC_ANALYZER_CLASS 3
+#define PCC_ANALYZER_UTF8 4
+
+#define PCC_COUNT_INVALID UINT64_MAX
+
+#define PCC_HELLO_TRANSPORT_OFFSET 5
+#define PCC_TRANSPORT_SOCKET 0
+#define PCC_TRANSPORT_SHM 1
+
+#define PCC_SHM_FDS 3 /* the memfd, the server's doorbell and the client's eventfd */
+#define PCC_SHM_MAGIC 0x50434352494e4731ULL /* "PCCRING1" */
+#define PCC_SHM_DATA_OFFSET 4096 /* the data of the ring follows the PccShmRing at this offset of the memfd */
+#define PCC_SHM_CAPACITY_MAX (1ULL << 30)
+
+typedef struct pcc_shm_ring{ /* the positions only grow, the byte of position p is at data[p % capacity] */
+    uint64_t magic;
+    uint64_t capacity; /* a power of 2, up to PCC_SHM_CAPACITY_MAX */
+    uint64_t head __attribute__((aligned(64))); /* written by the client: the end of the requests it published */
+    uint32_t server_sleeping;
+    uint64_t tail __attribute__((aligned(64))); /* written by the server: the end of the data it consumed, the client may overwrite what precedes it */
+    uint32_t client_sleeping;
+}PccShmRing;
+
+#endif /* PCC_PROTOCOL_H */
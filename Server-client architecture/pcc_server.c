@@ -1,19 +1,63 @@
 /*
  * pcc_server summary:
- * 
- *  
- * The server computes the amount of printable character that was sent from a certain client and send back the answer to the client. Furthermore, it increments and save each 
+ *
+ *
+ * The server computes the amount of printable character that was sent from a certain client and send back the answer to the client. Furthermore, it increments and save each
  * character occurrence and print it out when the user signal SIGINT to the server.
  *
- * 
- * 
- ***Signal handling: Upon receiving SIGINT, the program terminates and prints the amount of printable character per character.
+ * The server is event driven: all sockets are non-blocking and multiplexed by a single epoll instance, so a slow or idle client
+ * never stalls the others. Every client has a Connection that holds its running counter, its own histogram and the (possibly partially sent) replies.
+ *
+ * Two protocols are served on the same port. A client that starts with the hello of pcc_protocol.h is framed: it keeps the connection
+ * and sends length prefixed requests, possibly pipelined, and gets a binary reply per request in order. Any other client is legacy:
+ * its data is counted untill EOF and the answer is a decimal string. A framed request is merged into pcc_total when its reply is queued,
+ * a legacy client's histogram only once its reply was fully sent. While more than OUTPUT_HIGH_WATER bytes of replies wait to be sent,
+ * the client's data isn't read, so a client that pipelines without reading can't make the server buffer without bound.
+ * A framed request may select an analyzer of pcc_analyze.c (printable ASCII, a byte histogram, the classes of --class-table, or UTF-8
+ * validation); the ones that don't use --analyzer (printable by default). Legacy clients always get the printable count.
+ *
+ * Admission control: the listening sockets use a backlog of --backlog (SOMAXCONN by default) and are drained with accept4, up to
+ * ACCEPT_BATCH clients per wakeup. Beyond --max-connections clients (of all the workers) a new client is reset right after accept.
+ * --idle-timeout closes a client that neither sent nor recieved data for that long, and --total-timeout one that is connected for that
+ * long, so a client that never finishes can't pin a worker. The deadlines are kept in a timer wheel per worker, ticked every 100ms.
+ * The amounts of rejected and timed out clients are part of the statistics.
+ *
+ * Local transports: with --unix PATH the workers also accept clients on a UNIX domain socket, which serves both protocols like the
+ * TCP port. A framed client of the UNIX socket may pass a shared memory ring (a memfd) and two eventfds with its hello (see
+ * pcc_protocol.h): its requests are then written to the ring, and the worker analyzes them in place in the mapped ring, so the data
+ * is never copied through a socket. The client rings the doorbell eventfd only when the worker set server_sleeping in the ring, so a
+ * busy ring costs no system call per request. The replies and the end of the requests (the client's shutdown) still go through the socket.
+ *
+ * The analysis kernel lives in pcc_analyze.c, the io_uring wrapper in pcc_uring.c, the live statistics in pcc_stats.c, the state file in
+ * pcc_state.c and the timer wheel in pcc_timer.c
+ * (build: gcc -O2 -pthread pcc_server.c pcc_analyze.c pcc_uring.c pcc_stats.c pcc_state.c pcc_timer.c -o pcc_server).
+ *
+ * Usage: pcc_server <port> [--workers N] [--recv-buffer BYTES] [--uring] [--stats-port PORT] [--state-file PATH [--checkpoint-interval SECONDS]]
+ *                   [--analyzer printable|bytes|class|utf8] [--class-table FILE]
+ *                   [--backlog N] [--max-connections N] [--idle-timeout SECONDS] [--total-timeout SECONDS] [--unix PATH]
+ * Every worker is a thread with its own SO_REUSEPORT listening socket, epoll instance and cache line aligned shard of pcc_total,
+ * so the workers never write to shared memory. The shards are summed only by sum_up_and_exit.
+ * Every worker recieves into a single large buffer (1MB by default) that is analyzed before the next recv, so its size doesn't grow with
+ * the amount of clients. With --uring the worker uses io_uring instead of epoll: a multishot accept, and a multishot recv per client that
+ * picks one of URING_BUFFERS provided buffers, so a stream of data costs no system call per recv.
+ * On exit, the amount of bytes recieved per system call is printed to stderr.
+ * Every worker publishes its counters with a seqlock before it blocks, so the server can be inspected while it runs: SIGUSR1 prints
+ * a JSON snapshot (pcc_total, active connections, bytes, requests, request latency histogram, bytes per call) to stderr, and every
+ * client of --stats-port (which listens on the loopback interface only) recieves one.
+ * pcc_total is kept in 64 bit counters. With --state-file it survives restarts: it is restored from the file at startup, and the main
+ * thread checkpoints the published snapshots to it every --checkpoint-interval seconds (10 by default) and once more on exit,
+ * so the workers pay nothing for it.
+ *
+ ***Signal handling: Upon receiving SIGINT (handled by the main thread), the workers stop accepting new clients, finish the clients that are in the middle of processing,
+ ***                 then terminates and prints the amount of printable character per character.
  ***                 Upon recieving SIGPIPE, the program prints an error to stderr and continues handling other clients.
  */
 
+#define _GNU_SOURCE /* accept4 */
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <stdio.h>
@@ -23,205 +67,2133 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "pcc_analyze.h"
+#include "pcc_uring.h"
+#include "pcc_protocol.h"
+#include "pcc_stats.h"
+#include "pcc_state.h"
+#include "pcc_timer.h"
+
+#define RECV_BUFFER_DEFAULT (1 << 20)
+#define RECV_BUFFER_MAX (1 << 30) /* analyze_data takes an int length */
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64 /* max clients accepted per wakeup, so a connection flood can't starve the connected clients */
+#define BACKLOG_DEFAULT SOMAXCONN
+#define TIMER_TICK_NS 100000000ULL /* the resolution of the deadlines, 100ms */
+#define RECV_BUDGET 16 /* max recv calls for one client per wakeup, so a fast client can't starve the others */
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 16 /* a power of 2 */
+#define REPLY_SIZE 24 /* enough for the decimal representation of a uint64_t */
+#define OUTPUT_HIGH_WATER 65536 /* above it, the client's data isn't read untill its replies are sent */
+#define CACHE_LINE 64
+#define MAX_WORKERS 256
+#define STATS_TEXT_SIZE 8192
+#define CHECKPOINT_INTERVAL_DEFAULT 10 /* seconds */
+#define STATS_SEND_TIMEOUT 1 /* seconds, so a stuck stats client can't delay the handling of SIGINT */
+
+#define STATE_DETECT 0 /* matching the hello, to tell a framed client from a legacy one */
+#define STATE_LEGACY 1 /* counting untill EOF */
+#define STATE_HEADER 2 /* framed: recieving a request header */
+#define STATE_PAYLOAD 3 /* framed: recieving the data of a request */
+
+#define URING_OP_ACCEPT 1 /* io_uring user_data is the Connection pointer (if any) ored with the operation */
+#define URING_OP_SHUTDOWN 2
+#define URING_OP_RECV 3
+#define URING_OP_SEND 4
+#define URING_OP_CANCEL 5
+#define URING_OP_TIMER 6
+#define URING_OP_ACCEPT_UNIX 7
+#define URING_OP_RECVMSG 8
+#define URING_OP_DOORBELL 9
+#define URING_OP_MASK 15 /* a Connection is allocated by calloc, so it is at least 16 bytes aligned */
+
+#define SHM_DOORBELL_TAG 1 /* ored with the Connection pointer in the epoll data of a ring client's doorbell */
+#define SHM_MEMFD 0 /* the descriptors that a ring client passes with its hello, in order */
+#define SHM_DOORBELL 1
+#define SHM_WAKEUP 2
+
+typedef struct config{ /* the command line options */
+    unsigned int port;
+    int num_workers;
+    size_t recv_buffer_size;
+    int use_uring;
+    unsigned int stats_port; /* 0 if there is no stats endpoint */
+    const char* state_path; /* NULL if pcc_total isn't kept across restarts */
+    unsigned int checkpoint_interval; /* seconds */
+    int analyzer; /* of the framed requests that don't select one */
+    const char* class_table_path; /* NULL if there is no ANALYZER_CLASS */
+    int backlog;
+    unsigned int max_connections; /* of all the workers together, 0 if unlimited */
+    unsigned int idle_timeout; /* seconds without any data recieved or sent, 0 if none */
+    unsigned int total_timeout; /* seconds since the client was accepted, 0 if none */
+    const char* unix_path; /* NULL if there is no UNIX domain socket */
+}Config;
+
+typedef struct shm_channel{ /* the local side of a client of the UNIX socket, and of its shared memory ring if it passed one */
+    int fds[PCC_SHM_FDS]; /* SHM_MEMFD, SHM_DOORBELL and SHM_WAKEUP as recieved with the hello, -1 if not recieved (or closed) */
+    PccShmRing* ring; /* NULL untill the ring is attached */
+    char* data;
+    size_t map_size;
+    uint64_t capacity; /* copied from the ring once, the client can't change it later */
+    uint64_t tail; /* the worker's copy of ring->tail */
+    int client_done; /* the client shut down its sending side, the ring is consumed untill head */
+    int paused; /* the ring isn't consumed untill the replies are below OUTPUT_HIGH_WATER */
+    int doorbell_armed; /* io_uring only */
+    int doorbell_cancelled;
+    unsigned char hello[PCC_HELLO_SIZE]; /* the hello is recieved with recvmsg, to get the descriptors */
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(PCC_SHM_FDS * sizeof(int))];
+}ShmChannel;
+
+typedef struct connection{ /* the state of a single client */
+    TimerEntry timer; /* its deadline, if there is a timeout */
+    int fd;
+    int state;
+    int eof; /* the client finished sending */
+    int failed;
+    unsigned int events; /* the events registered in epoll */
+    int recv_armed; /* io_uring only: the operation of the armed recv, 0 if none */
+    int recv_cancelled;
+    int send_in_flight;
+    uint64_t counter; /* of the whole connection if legacy, else of the current request */
+    uint64_t pcc_local[NUM_PRINTABLE]; /* 64 bit like the shards, a connection or a request can pass 2^31 characters */
+    unsigned char header[PCC_HELLO_SIZE]; /* the hello or the request header that is being recieved */
+    int header_len;
+    uint32_t remaining; /* bytes of the current request that were not recieved yet */
+    uint32_t flags;
+    int analyzer; /* of the current request */
+    Analysis* analysis; /* the running state of a request of a byte analyzer, allocated by the first such request */
+    unsigned long long request_start; /* CLOCK_MONOTONIC nanoseconds, when the current request (or the legacy connection) started */
+    unsigned long long accepted_at; /* nanoseconds */
+    unsigned long long last_activity; /* nanoseconds, of the last recv or send that moved data */
+    char* out; /* replies that were not sent yet */
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    char* sending; /* io_uring only: the replies of the send in flight, so out can grow meanwhile */
+    size_t sending_len;
+    size_t sending_sent;
+    size_t sending_cap;
+    ShmChannel* shm; /* clients of the UNIX socket only */
+    int closed; /* epoll only: closed during the current batch of events, and freed after it */
+    struct connection* next_closed;
+}Connection;
 
-#define OFFSET 32
-#define BUFFER_SIZE 256
+typedef struct worker{ /* a thread with its own listening socket, epoll instance and shard of pcc_total */
+    Stats stats; /* its shard of pcc_total and its counters, only written by the owning thread */
+    StatsSeqlock published __attribute__((aligned(CACHE_LINE))); /* the copy of stats that the main thread reads */
+    int listenfd;
+    int epollfd;
+    int shutting_down;
+    pthread_t thread;
+    char* buffer;
+    int timerfd; /* ticks the wheel, -1 if there is no timeout */
+    unsigned long long now; /* nanoseconds, read once per wakeup */
+    TimerWheel wheel; /* the deadlines of its clients */
+    Uring ring;
+    Connection* closed; /* epoll only: the clients that are freed after the current batch of events, which may still hold events of them */
+}__attribute__((aligned(CACHE_LINE))) Worker; /* the alignment keeps every shard on its own cache lines */
 
-int recv_and_analyze_info(int pcc_total[95], int listenfd,char* buffer, int len,unsigned int* counter);
-void analyze_data(int pcc_total[95], char* buffer,int bytes_read,unsigned int* counter);
-int send_analyzed_info(int connfd,int counter);
+int recv_and_analyze_info(Worker* worker, Connection* conn);
+int parse_arguments(int argc, char** argv, Config* config);
+int create_listening_socket(unsigned int port, int reuseport);
+int init_worker(Worker* worker, unsigned int port, int reuseport);
+int init_worker_uring(Worker* worker, unsigned int port, int reuseport);
+void* run_worker(void* arg);
+void* run_worker_uring(void* arg);
+int uring_submit_recv(Worker* worker, Connection* conn);
+int uring_submit_send(Worker* worker, Connection* conn);
+int uring_cancel_recv(Worker* worker, Connection* conn);
+int uring_cancel_doorbell(Worker* worker, Connection* conn);
+void uring_submit_accept(Worker* worker, int listenfd, uint64_t op);
+int uring_submit_doorbell(Worker* worker, Connection* conn);
+void uring_recieved(Worker* worker, Connection* conn, char* buffer, int res);
+void uring_submit_timer_poll(Worker* worker);
+void uring_progress(Worker* worker, Connection* conn);
+void handle_completion(Worker* worker, struct io_uring_cqe* cqe);
+int set_nonblocking(int fd);
+int accept_connections(Worker* worker, int listenfd);
+Connection* admit_connection(Worker* worker, int connfd, int local);
+void reject_connection(Worker* worker, int connfd);
+int create_tick_timer(Worker* worker);
+unsigned long long connection_deadline(Connection* conn);
+void expire_connections(Worker* worker);
+void handle_connection(Worker* worker, Connection* conn, unsigned int events);
+int update_events(Worker* worker, Connection* conn);
+void connection_error(Connection* conn);
+void finish_connection(Worker* worker, Connection* conn);
+void free_connection(Worker* worker, Connection* conn);
+void close_connection(Worker* worker, Connection* conn);
+int consume_data(Worker* worker, Connection* conn, char* buffer, int len);
+int finish_input(Worker* worker, Connection* conn);
+int input_finished(Worker* worker, Connection* conn);
+int socket_open(Connection* conn);
+int create_unix_socket(const char* path);
+void shm_prepare_hello(Connection* conn);
+void shm_collect_fds(Connection* conn);
+int shm_attach(Worker* worker, Connection* conn);
+int shm_attached(Connection* conn);
+int shm_consume(Worker* worker, Connection* conn);
+int shm_resume(Connection* conn);
+void shm_read_doorbell(Connection* conn);
+void fall_back_to_legacy(Connection* conn);
+int start_request(Connection* conn);
+int complete_request(Worker* worker, Connection* conn);
+int append_output(Connection* conn, const void* data, size_t len);
+size_t pending_output(Connection* conn);
+int send_output(Connection* conn);
+void record_request(Worker* worker, Connection* conn);
+unsigned long long now_nanoseconds();
+int create_stats_socket(unsigned int port);
+void serve_stats(int statsfd);
+int snapshot_json(char* buffer, size_t size);
+void sum_snapshots(Stats* total);
+int create_checkpoint_timer(unsigned int interval);
+void checkpoint(const unsigned long long pcc_total[NUM_PRINTABLE]);
+void sum_shards(unsigned long long total[NUM_PRINTABLE]);
+void print_recv_statistics();
 void sum_up_and_exit();
-int change_sigint();
-void signal_handler(int signum, siginfo_t* info, void* ptr);
+int block_signals(sigset_t* mask);
 
-static int accepted=0;
-static int pcc_total[95] ={0};
-static int SIGINT_INVOKED=0;
+static Config config = { 0, 1, RECV_BUFFER_DEFAULT, 0, 0, NULL, CHECKPOINT_INTERVAL_DEFAULT, ANALYZER_PRINTABLE, NULL, BACKLOG_DEFAULT, 0, 0, 0, NULL };
+static Worker* workers=NULL;
+static State state; /* the state file, if config.state_path is set */
+static unsigned long long restored_total[NUM_PRINTABLE]; /* pcc_total of the previous runs, restored from the state file */
+static ClassTable class_table; /* of ANALYZER_CLASS, loaded from config.class_table_path */
+static unsigned int open_connections=0; /* of all the workers, checked against config.max_connections */
+static int unix_listenfd=-1; /* shared by all the workers, -1 if there is no --unix */
+static int shutdown_fd=-1; /* eventfd that wakes up all workers when SIGINT is recieved */
 
 /*
-* main - Initiate connections, recieve, analyze and send back information to the client
+* main - Initiate the workers and their connections, then serve the statistics untill SIGINT and sum up
 */
 int main(int argc, char** argv){
-    int listenfd   = -1;
-    int connfd     = -1;
+    int i, ret_val, sigfd = -1, statsfd = -1, timerfd = -1, running = 1;
+    uint64_t one = 1, expirations;
+    sigset_t signal_mask;
+    struct signalfd_siginfo info;
+    struct pollfd fds[3];
+    char stats_text[STATS_TEXT_SIZE];
+    Stats total;
 
-    struct sockaddr_in serv_addr;
-    struct sockaddr_in peer_addr;
-    socklen_t addrsize = sizeof(struct sockaddr_in);
-    unsigned int port = (unsigned int) strtoul(argv[1], NULL, 10);
-
-    char buffer[BUFFER_SIZE];
-    /********** Init **********/
-    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
-    if (listenfd==-1){
-        fprintf(stderr, "%s\n", strerror(errno));
+    if (parse_arguments(argc, argv, &config)==-1){
+        fprintf(stderr, "Usage: %s <port> [--workers N] [--recv-buffer BYTES] [--uring] [--stats-port PORT] "
+                        "[--state-file PATH [--checkpoint-interval SECONDS]] [--analyzer printable|bytes|class|utf8] "
+                        "[--class-table FILE] [--backlog N] [--max-connections N] [--idle-timeout SECONDS] "
+                        "[--total-timeout SECONDS] [--unix PATH]\n", argv[0]);
         return 1;
     }
-    memset( &serv_addr, 0, addrsize);
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(port);
-
-
+    if (config.class_table_path!=NULL && class_table_load(&class_table, config.class_table_path)==-1){
+        return 1;
+    }
+    if (config.state_path!=NULL){
+        if (state_open(&state, config.state_path, restored_total)==-1){
+            return 1;
+        }
+        timerfd = create_checkpoint_timer(config.checkpoint_interval);
+        if (timerfd==-1){
+            return 1;
+        }
+    }
+    /********** Init **********/
+    pcc_analyze_init();
     if (signal(SIGPIPE, SIG_IGN) == SIG_ERR ) {
         fprintf(stderr, "Unable to disable SIGPIPE signal \n");
         return 1;
     }
-
-    if( 0 != bind( listenfd, (struct sockaddr*) &serv_addr, addrsize ) )
-    {
+    if (block_signals(&signal_mask)==-1){ /* before creating the workers, so they inherit the mask and only main handles the signals */
+        return 1;
+    }
+    sigfd = signalfd(-1, &signal_mask, 0);
+    if (sigfd==-1){
         fprintf(stderr, "%s\n", strerror(errno));
         return 1;
     }
-    if( 0 != listen( listenfd, 10 ) )
-    {
+    if (config.stats_port!=0){
+        statsfd = create_stats_socket(config.stats_port);
+        if (statsfd==-1){
+            return 1;
+        }
+    }
+    if (config.unix_path!=NULL){
+        unix_listenfd = create_unix_socket(config.unix_path);
+        if (unix_listenfd==-1){
+            return 1;
+        }
+    }
+    shutdown_fd = eventfd(0, EFD_NONBLOCK);
+    if (shutdown_fd==-1){
         fprintf(stderr, "%s\n", strerror(errno));
         return 1;
     }
-    /***********************/
-    if ( change_sigint()== -1 ) {
+    if (posix_memalign((void**)&workers, CACHE_LINE, config.num_workers*sizeof(Worker))!=0){
+        fprintf(stderr, "Unable to allocate the workers\n");
         return 1;
     }
-    while (1){
-        accepted=0;
-        connfd = accept( listenfd, (struct sockaddr*) &peer_addr, &addrsize);
-        accepted=1;
-        if( connfd < 0 )
-        {
-            fprintf(stderr, "%s\n", strerror(errno)); 
-            close(connfd);
-            continue;
+    memset(workers, 0, config.num_workers*sizeof(Worker));
+    for (i=0 ; i < config.num_workers ; i++){
+        if (config.use_uring){
+            ret_val = init_worker_uring(&workers[i], config.port, config.num_workers > 1);
+        }
+        else {
+            ret_val = init_worker(&workers[i], config.port, config.num_workers > 1);
         }
-        unsigned int counter=0;
-        int ret_val = recv_and_analyze_info(pcc_total,connfd, buffer, BUFFER_SIZE, &counter); 
         if (ret_val==-1){
-            fprintf(stderr, "An error occurred (perhaps client unexpectedly closed connection): %s\n", strerror(errno));
-            close(connfd);
+            return 1;
+        }
+    }
+    for (i=0 ; i < config.num_workers ; i++){
+        ret_val = pthread_create(&workers[i].thread, NULL, config.use_uring ? run_worker_uring : run_worker, &workers[i]);
+        if (ret_val){
+            fprintf(stderr,"%s\n", strerror(ret_val));
+            return 1;
+        }
+    }
+    /***********************/
+    fds[0].fd = sigfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = statsfd; /* ignored by poll if there is no stats endpoint */
+    fds[1].events = POLLIN;
+    fds[2].fd = timerfd; /* ignored by poll if there is no state file */
+    fds[2].events = POLLIN;
+    while (running){ /* SIGUSR1 prints the statistics to stderr, a client of the stats port recieves them, SIGINT sums up */
+        if (poll(fds, 3, -1)==-1){
             continue;
         }
-        else { /* send to the user amount of printable characters */
-            if ( send_analyzed_info(connfd,counter) ==-1 ){
-                fprintf(stderr, "An error occurred (perhaps client unexpectedly closed connection): %s\n", strerror(errno));
-                close(connfd);
-                continue; 
+        if ((fds[2].revents & POLLIN) && read(timerfd, &expirations, sizeof(expirations))==(ssize_t)sizeof(expirations)){
+            sum_snapshots(&total);
+            checkpoint(total.pcc_total);
+        }
+        if ((fds[1].revents & POLLIN) && statsfd!=-1){
+            serve_stats(statsfd);
+        }
+        if ((fds[0].revents & POLLIN) && read(sigfd, &info, sizeof(info))==(ssize_t)sizeof(info)){
+            if (info.ssi_signo==SIGINT){
+                running = 0;
+            }
+            else if (snapshot_json(stats_text, sizeof(stats_text)) > 0){
+                fputs(stats_text, stderr);
             }
- 
         }
-        close(connfd);
-        if (SIGINT_INVOKED){ /* if the server is in the middle of processing a client, it will finish and enter this condition */
-            sum_up_and_exit();
-        } 
     }
+    if (statsfd!=-1){
+        close(statsfd);
+    }
+    if (write(shutdown_fd, &one, sizeof(one))==-1){ /* every worker stops accepting, finishes its in-flight clients and returns */
+        fprintf(stderr, "%s\n", strerror(errno));
+    }
+    for (i=0 ; i < config.num_workers ; i++){
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (unix_listenfd!=-1){
+        close(unix_listenfd);
+        unlink(config.unix_path);
+    }
+    print_recv_statistics();
+    if (config.state_path!=NULL){ /* the workers are done, so the final checkpoint holds everything that was answered */
+        close(timerfd);
+        sum_shards(total.pcc_total);
+        checkpoint(total.pcc_total);
+        state_close(&state);
+    }
+    sum_up_and_exit();
+    return 0;
 }
 
 /**
- * recv_and_analyze_info - recieve information from a client and analyze it
- * @param *pcc_total - the data structure that holds the analyzed information
- * @param connfd - the file descriptor of the tcp connection
- * @param *buffer - the buffer that the information is being written to
- * @param len - buffers size
- * @param *counter - amount of printable characters recieved from the client
+ * parse_arguments - parses the command line: <port> [--workers N] [--recv-buffer BYTES] [--uring] [--stats-port PORT]
+ *                   [--state-file PATH [--checkpoint-interval SECONDS]] [--analyzer NAME] [--class-table FILE]
+ *                   [--backlog N] [--max-connections N] [--idle-timeout SECONDS] [--total-timeout SECONDS] [--unix PATH]
+ * @param argc, argv - as recieved by main
+ * @param *config - filled with the options, the ones that aren't given keep their default
  * @return int - 0 if successfull, else -1
  */
-int recv_and_analyze_info(int pcc_total[95], int connfd,char* buffer, int len, unsigned int* counter){
-        int bytes_read;
-        while (1){
-            bytes_read = recv(connfd,buffer,len, 0);
-            if (bytes_read==-1){
+int parse_arguments(int argc, char** argv, Config* config){
+    int i;
+    if (argc < 2){
+        return -1;
+    }
+    config->port = (unsigned int) strtoul(argv[1], NULL, 10);
+    for (i=2 ; i < argc ; i++){
+        if (strcmp(argv[i], "--workers")==0 && i+1 < argc){
+            config->num_workers = (int) strtol(argv[++i], NULL, 10);
+            if (config->num_workers < 1 || config->num_workers > MAX_WORKERS){
                 return -1;
             }
-            if (bytes_read==0) break;
-            analyze_data(pcc_total,buffer,bytes_read, counter);
         }
-        return 0;
+        else if (strcmp(argv[i], "--recv-buffer")==0 && i+1 < argc){
+            config->recv_buffer_size = (size_t) strtoul(argv[++i], NULL, 10);
+            if (config->recv_buffer_size < 1 || config->recv_buffer_size > RECV_BUFFER_MAX){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--uring")==0){
+            config->use_uring = 1;
+        }
+        else if (strcmp(argv[i], "--stats-port")==0 && i+1 < argc){
+            config->stats_port = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (config->stats_port < 1 || config->stats_port > 65535 || config->stats_port==config->port){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--state-file")==0 && i+1 < argc){
+            config->state_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-interval")==0 && i+1 < argc){
+            config->checkpoint_interval = (unsigned int) strtoul(argv[++i], NULL, 10);
+            if (config->checkpoint_interval < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--analyzer")==0 && i+1 < argc){
+            config->analyzer = analyzer_by_name(argv[++i]);
+            if (config->analyzer==-1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--class-table")==0 && i+1 < argc){
+            config->class_table_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--backlog")==0 && i+1 < argc){
+            config->backlog = (int) strtol(argv[++i], NULL, 10);
+            if (config->backlog < 1){
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--max-connections")==0 && i+1 < argc){
+            config->max_connections = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--idle-timeout")==0 && i+1 < argc){
+            config->idle_timeout = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--total-timeout")==0 && i+1 < argc){
+            config->total_timeout = (unsigned int) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--unix")==0 && i+1 < argc){
+            config->unix_path = argv[++i];
+        }
+        else {
+            return -1;
+        }
+    }
+    if (config->analyzer==ANALYZER_CLASS && config->class_table_path==NULL){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * create_listening_socket - creates a non-blocking socket listening on the port
+ * @param port - the port to listen on
+ * @param reuseport - if set, SO_REUSEPORT is applied so every worker can own a socket on the same port and the kernel balances the clients between them
+ * @return int - the socket if successfull, else -1
+ */
+int create_listening_socket(unsigned int port, int reuseport){
+    int listenfd, enable = 1;
+    struct sockaddr_in serv_addr;
+    socklen_t addrsize = sizeof(struct sockaddr_in);
+    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+    if (listenfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset( &serv_addr, 0, addrsize);
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv_addr.sin_port = htons(port);
+
+    if (reuseport && 0 != setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)))
+    {
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    if( 0 != bind( listenfd, (struct sockaddr*) &serv_addr, addrsize ) )
+    {
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    if( 0 != listen( listenfd, config.backlog ) )
+    {
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    if (set_nonblocking(listenfd)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
 
+/**
+ * create_unix_socket - creates the non-blocking UNIX domain socket that all the workers accept from, replacing a socket that was left
+ * at the path by a previous run
+ * @param *path - the path to bind to
+ * @return int - the socket if successfull, else -1
+ */
+int create_unix_socket(const char* path){
+    int listenfd;
+    struct sockaddr_un addr;
+    struct stat st;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    if (stat(path, &st)==0 && S_ISSOCK(st.st_mode)){
+        unlink(path);
+    }
+    if (bind(listenfd, (struct sockaddr*) &addr, sizeof(addr))!=0 || listen(listenfd, config.backlog)!=0 || set_nonblocking(listenfd)==-1){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
 }
 
 /**
- * analyze_data - analyze the information
- * @param *pcc_total - the data structure that holds the analyzed information
- * @param *buffer - the buffer that the information is being written to
- * @param bytes_read - amount of bytes that currently recieved from client
- * @param *counter - amount of printable characters recieved from the client
- * @return void
+ * init_worker - creates the worker's listening socket and epoll instance
+ * @param *worker - the worker to initiate
+ * @param port - the port to listen on
+ * @param reuseport - whether other workers share the port
+ * @return int - 0 if successfull, else -1
  */
-void analyze_data(int pcc_total[95], char* buffer,int bytes_read, unsigned int* counter){
-    int i;
-    for (i=0 ; i < bytes_read ; i++){
-        char value = buffer[i];
-        if (value>126 || value < 32){
+int init_worker(Worker* worker, unsigned int port, int reuseport){
+    struct epoll_event ev;
+    worker->listenfd = create_listening_socket(port, reuseport);
+    if (worker->listenfd==-1){
+        return -1;
+    }
+    worker->buffer = (char*)malloc(config.recv_buffer_size);
+    if (worker->buffer==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    worker->epollfd = epoll_create1(0);
+    if (worker->epollfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &worker->listenfd; /* the listening socket and the shutdown eventfd are the only ones without a Connection */
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->listenfd, &ev)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    ev.data.ptr = &shutdown_fd;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, shutdown_fd, &ev)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE; /* shared by the workers, a client wakes up only one of them */
+    ev.data.ptr = &unix_listenfd;
+    if (unix_listenfd!=-1 && epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, unix_listenfd, &ev)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    if (create_tick_timer(worker)==-1){
+        return -1;
+    }
+    ev.data.ptr = &worker->timerfd;
+    if (worker->timerfd!=-1 && epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->timerfd, &ev)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * run_worker - the worker's event loop: dispatches epoll events of its listening sockets and of its clients
+ * @param *arg - the worker
+ * @return void* - NULL, after SIGINT was recieved and all the worker's clients were served
+ */
+void* run_worker(void* arg){
+    Worker* worker = (Worker*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    Connection* conn;
+    int i, nfds;
+    while (1){
+        stats_publish(&worker->published, &worker->stats); /* before blocking, so an idle worker's snapshot is up to date */
+        if (worker->shutting_down && worker->stats.active_connections==0){
+            return NULL;
+        }
+        nfds = epoll_wait(worker->epollfd, events, MAX_EVENTS, -1);
+        if (nfds==-1){
+            if (errno!=EINTR){
+                fprintf(stderr, "%s\n", strerror(errno));
+            }
             continue;
         }
-        else{
-            pcc_total[value - OFFSET]++;
-            *counter = *counter + 1;
+        worker->now = now_nanoseconds();
+        for (i=0 ; i < nfds ; i++){
+            if (events[i].data.ptr==&shutdown_fd){ /* stop accepting new clients, the ones in the middle of processing are finished first */
+                epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, shutdown_fd, NULL);
+                if (unix_listenfd!=-1){ /* closed by main once all the workers returned */
+                    epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, unix_listenfd, NULL);
+                }
+                close(worker->listenfd);
+                worker->listenfd=-1;
+                worker->shutting_down=1;
+                continue;
+            }
+            if (events[i].data.ptr==&worker->listenfd){
+                if (worker->listenfd!=-1){
+                    accept_connections(worker, worker->listenfd);
+                }
+                continue;
+            }
+            if (events[i].data.ptr==&unix_listenfd){
+                if (!worker->shutting_down){
+                    accept_connections(worker, unix_listenfd);
+                }
+                continue;
+            }
+            if (events[i].data.ptr==&worker->timerfd){
+                expire_connections(worker);
+                continue;
+            }
+            conn = (Connection*)((uintptr_t)events[i].data.ptr & ~(uintptr_t)SHM_DOORBELL_TAG);
+            if (conn->closed){
+                continue;
+            }
+            if ((uintptr_t)events[i].data.ptr & SHM_DOORBELL_TAG){ /* the client published requests to its ring */
+                shm_read_doorbell(conn);
+                handle_connection(worker, conn, 0);
+                continue;
+            }
+            handle_connection(worker, conn, events[i].events);
+        }
+        while (worker->closed!=NULL){
+            conn = worker->closed;
+            worker->closed = conn->next_closed;
+            free_connection(worker, conn);
         }
     }
 }
 
 /**
- * send_analyzed_info - send the analyzed information back to the client
- * @param connfd - the file descriptor of the tcp connection
- * @param counter - amount of printable characters recieved from the client
+ * init_worker_uring - creates the worker's listening socket, io_uring instance and provided buffers
+ * @param *worker - the worker to initiate
+ * @param port - the port to listen on
+ * @param reuseport - whether other workers share the port
  * @return int - 0 if successfull, else -1
  */
-int send_analyzed_info(int connfd,int counter){
-        int length = snprintf(NULL,0, "%d", counter);
-        char* transmitted_data = (char*)malloc(length + 1);
-        if (transmitted_data==NULL){
-            return -1;
+int init_worker_uring(Worker* worker, unsigned int port, int reuseport){
+    worker->listenfd = create_listening_socket(port, reuseport);
+    if (worker->listenfd==-1){
+        return -1;
+    }
+    if (uring_init(&worker->ring, URING_ENTRIES)==-1){
+        fprintf(stderr, "Unable to create io_uring instance: %s\n", strerror(errno));
+        return -1;
+    }
+    if (uring_setup_buffers(&worker->ring, URING_BUFFERS, config.recv_buffer_size)==-1){
+        fprintf(stderr, "Unable to register io_uring buffers: %s\n", strerror(errno));
+        return -1;
+    }
+    return create_tick_timer(worker);
+}
+
+/**
+ * run_worker_uring - the worker's event loop with io_uring: accepts the clients, recieves their data and sends back the answers with
+ * multishot requests, and handles their completions
+ * @param *arg - the worker
+ * @return void* - NULL, after SIGINT was recieved and all the worker's clients were served
+ */
+void* run_worker_uring(void* arg){
+    Worker* worker = (Worker*)arg;
+    Uring* ring = &worker->ring;
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe* cqe;
+
+    uring_submit_accept(worker, worker->listenfd, URING_OP_ACCEPT);
+    if (unix_listenfd!=-1){
+        uring_submit_accept(worker, unix_listenfd, URING_OP_ACCEPT_UNIX);
+    }
+    sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD; /* polling doesn't consume the eventfd, so all the workers see it */
+    sqe->fd = shutdown_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_OP_SHUTDOWN;
+    if (worker->timerfd!=-1){
+        uring_submit_timer_poll(worker);
+    }
+    while (1){
+        worker->stats.syscalls = ring->enter_calls;
+        stats_publish(&worker->published, &worker->stats); /* before blocking, so an idle worker's snapshot is up to date */
+        if (worker->shutting_down && worker->stats.active_connections==0){
+            uring_exit(ring);
+            return NULL;
         }
-        snprintf(transmitted_data, length+1,"%d", counter);
-        int val;
-        if ((val=send(connfd, transmitted_data , length, 0)) < 1 ) { 
-            free(transmitted_data);
-            return -1;
+        if (uring_submit_and_wait(ring, 1)==-1 && errno!=EINTR){
+            fprintf(stderr, "%s\n", strerror(errno));
+            continue;
         }
-        if (send(connfd, NULL, 0, 0) ==-1 ){ /* checking if client unexpectedly closed the connection */
-            free(transmitted_data);
-            return -1;
+        worker->now = now_nanoseconds();
+        while ((cqe = uring_peek_cqe(ring))!=NULL){
+            handle_completion(worker, cqe);
+            uring_cqe_seen(ring);
         }
-        free(transmitted_data);
+    }
+}
+
+/**
+ * uring_submit_accept - arms a multishot accept of a listening socket
+ * @param *worker - the worker
+ * @param listenfd - its TCP socket, or the shared UNIX socket
+ * @param op - URING_OP_ACCEPT or URING_OP_ACCEPT_UNIX
+ * @return void
+ */
+void uring_submit_accept(Worker* worker, int listenfd, uint64_t op){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = op;
+}
+
+/**
+ * uring_submit_recv - arms a multishot recv for the client, every completion carries one of the provided buffers. The hello of a
+ * client of the UNIX socket is recieved with a single recvmsg instead, since it may carry the descriptors of a ring
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
+ */
+int uring_submit_recv(Worker* worker, Connection* conn){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return -1;
+    }
+    if (conn->shm!=NULL && conn->state==STATE_DETECT){
+        shm_prepare_hello(conn);
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&conn->shm->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_CMSG_CLOEXEC;
+        sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_RECVMSG;
+        conn->recv_armed = URING_OP_RECVMSG;
+        conn->recv_cancelled = 0;
         return 0;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_RECV;
+    conn->recv_armed = URING_OP_RECV;
+    conn->recv_cancelled = 0;
+    return 0;
+}
+
+/**
+ * uring_submit_doorbell - arms a multishot poll of the doorbell of a ring client
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client, its ring is attached
+ * @return int - 0 if successfull, else -1
+ */
+int uring_submit_doorbell(Worker* worker, Connection* conn){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->shm->fds[SHM_DOORBELL];
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_DOORBELL;
+    conn->shm->doorbell_armed = 1;
+    conn->shm->doorbell_cancelled = 0;
+    return 0;
 }
 
 /**
- * signal_handler -  If recieved SIGINT while processing a client, wait untill finishing and then terminates. Otherwise immediatly exits.
- * This function arguments are determinted by struct sigaction and are not used in this module
+ * uring_submit_send - submits a send of the client's pending replies. The replies are moved to the sending buffer, so new replies
+ * can be appended to out while the send is in flight
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
  */
-void signal_handler(int signum, siginfo_t* info, void* ptr){ 
-    if (accepted==0){
-        sum_up_and_exit();
+int uring_submit_send(Worker* worker, Connection* conn){
+    struct io_uring_sqe* sqe;
+    char* temp;
+    size_t temp_cap;
+    if (conn->sending_sent==conn->sending_len){ /* swap the buffers */
+        temp = conn->sending;
+        temp_cap = conn->sending_cap;
+        conn->sending = conn->out;
+        conn->sending_cap = conn->out_cap;
+        conn->sending_len = conn->out_len;
+        conn->sending_sent = conn->out_sent;
+        conn->out = temp;
+        conn->out_cap = temp_cap;
+        conn->out_len = 0;
+        conn->out_sent = 0;
     }
-    else { /* in the middile of processing a client */
-        SIGINT_INVOKED=1;
+    sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return -1;
     }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->sending + conn->sending_sent);
+    sqe->len = conn->sending_len - conn->sending_sent;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_SEND;
+    conn->send_in_flight = 1;
+    return 0;
 }
 
 /**
- * change_sigint - Registers the handler for SIGINT
- * @return void
+ * uring_cancel_recv - cancels the client's armed recv, its last completion carries -ECANCELED
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
+ */
+int uring_cancel_recv(Worker* worker, Connection* conn){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t)(uintptr_t)conn | conn->recv_armed;
+    sqe->user_data = URING_OP_CANCEL;
+    conn->recv_cancelled = 1;
+    return 0;
+}
+
+/**
+ * uring_cancel_doorbell - cancels the poll of a ring client's doorbell, its last completion carries -ECANCELED
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
  */
-int change_sigint(){
-    struct sigaction sigint;
-    memset(&sigint, 0 , sizeof(sigint));
-    sigint.sa_sigaction = signal_handler;
-    if (0!= sigaction(SIGINT, &sigint, NULL)){
-        printf("%s\n",strerror(errno));
+int uring_cancel_doorbell(Worker* worker, Connection* conn){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
         return -1;
     }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t)(uintptr_t)conn | URING_OP_DOORBELL;
+    sqe->user_data = URING_OP_CANCEL;
+    conn->shm->doorbell_cancelled = 1;
     return 0;
 }
 
 /**
- * sum_up_and_exit -  prints the information collected to stdout and exits program
+ * uring_submit_timer_poll - arms a multishot poll of the worker's tick timer
+ * @param *worker - the worker
  * @return void
  */
-void sum_up_and_exit(){
-    int i;
-    for (i=0 ; i < 95 ; i++){
-        printf("char '%c' : %u times\n", i+OFFSET,pcc_total[i]);
+void uring_submit_timer_poll(Worker* worker){
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    if (sqe==NULL){
+        return;
     }
-    exit(0);
-}
\ No newline at end of file
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = worker->timerfd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_OP_TIMER;
+}
+
+/**
+ * uring_progress - after a completion of the client, submits what it needs next: a send of its pending replies, re-arming or
+ * cancelling its recv according to the amount of pending replies, resuming its ring, or closing it when it is done and nothing is in flight
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return void
+ */
+void uring_progress(Worker* worker, Connection* conn){
+    size_t pending;
+    int doorbell_armed = conn->shm!=NULL && conn->shm->doorbell_armed;
+    if (!conn->failed && !conn->send_in_flight && pending_output(conn) > 0 && uring_submit_send(worker, conn)==-1){
+        connection_error(conn);
+    }
+    pending = pending_output(conn);
+    if (conn->failed || (conn->eof && pending==0 && !conn->send_in_flight)){
+        if (conn->recv_armed && !conn->recv_cancelled){
+            uring_cancel_recv(worker, conn);
+        }
+        if (doorbell_armed && !conn->shm->doorbell_cancelled){
+            uring_cancel_doorbell(worker, conn);
+        }
+        if (!conn->recv_armed && !conn->send_in_flight && !doorbell_armed){ /* nothing of the client is in flight, it can be freed */
+            if (!conn->failed){
+                finish_connection(worker, conn);
+            }
+            free_connection(worker, conn);
+        }
+        return;
+    }
+    if (socket_open(conn) && !conn->recv_armed && pending <= OUTPUT_HIGH_WATER){
+        if (uring_submit_recv(worker, conn)==-1){
+            connection_error(conn);
+        }
+    }
+    else if (conn->recv_armed && !conn->recv_cancelled && pending > OUTPUT_HIGH_WATER){
+        uring_cancel_recv(worker, conn);
+    }
+    if (shm_attached(conn) && !doorbell_armed && uring_submit_doorbell(worker, conn)==-1){
+        connection_error(conn);
+    }
+    if (conn->shm!=NULL && conn->shm->paused && pending <= OUTPUT_HIGH_WATER && shm_resume(conn)==-1){
+        connection_error(conn);
+    }
+}
+
+/**
+ * handle_completion - advances the worker or one of its clients according to an io_uring completion
+ * @param *worker - the worker
+ * @param *cqe - the completion
+ * @return void
+ */
+void handle_completion(Worker* worker, struct io_uring_cqe* cqe){
+    Connection* conn = (Connection*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+    struct io_uring_sqe* sqe;
+    unsigned short bid;
+    uint64_t op = cqe->user_data & URING_OP_MASK;
+    switch (op){
+    case URING_OP_ACCEPT:
+    case URING_OP_ACCEPT_UNIX:
+        if (cqe->res >= 0){
+            conn = admit_connection(worker, cqe->res, op==URING_OP_ACCEPT_UNIX);
+            if (conn!=NULL && uring_submit_recv(worker, conn)==-1){
+                free_connection(worker, conn);
+            }
+        }
+        else if (cqe->res!=-ECANCELED){
+            fprintf(stderr, "%s\n", strerror(-cqe->res));
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE) && !worker->shutting_down){ /* the multishot accept was terminated, arm a new one */
+            uring_submit_accept(worker, op==URING_OP_ACCEPT ? worker->listenfd : unix_listenfd, op);
+        }
+        return;
+    case URING_OP_SHUTDOWN: /* stop accepting new clients, the ones in the middle of processing are finished first */
+        worker->shutting_down=1;
+        sqe = uring_get_sqe(&worker->ring);
+        if (sqe!=NULL){
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_OP_ACCEPT;
+            sqe->user_data = URING_OP_CANCEL;
+        }
+        sqe = unix_listenfd!=-1 ? uring_get_sqe(&worker->ring) : NULL;
+        if (sqe!=NULL){ /* the UNIX socket is closed by main once all the workers returned */
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_OP_ACCEPT_UNIX;
+            sqe->user_data = URING_OP_CANCEL;
+        }
+        close(worker->listenfd);
+        worker->listenfd=-1;
+        return;
+    case URING_OP_RECV:
+        if (!(cqe->flags & IORING_CQE_F_MORE)){ /* the multishot recv was terminated */
+            conn->recv_armed = 0;
+        }
+        if (cqe->res > 0){
+            bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            uring_recieved(worker, conn, uring_buffer(&worker->ring, bid), cqe->res);
+            uring_recycle_buffer(&worker->ring, bid);
+        }
+        else {
+            uring_recieved(worker, conn, NULL, cqe->res);
+        }
+        uring_progress(worker, conn);
+        return;
+    case URING_OP_RECVMSG: /* the hello of a client of the UNIX socket */
+        conn->recv_armed = 0;
+        if (cqe->res > 0){
+            shm_collect_fds(conn);
+        }
+        uring_recieved(worker, conn, (char*)conn->shm->hello, cqe->res);
+        uring_progress(worker, conn);
+        return;
+    case URING_OP_DOORBELL: /* the client published requests to its ring */
+        if (!(cqe->flags & IORING_CQE_F_MORE)){
+            conn->shm->doorbell_armed = 0;
+        }
+        if (cqe->res > 0){
+            shm_read_doorbell(conn);
+            if (!conn->failed && !conn->eof && shm_consume(worker, conn)==-1){
+                connection_error(conn);
+            }
+        }
+        else if (cqe->res < 0 && !(cqe->res==-ECANCELED && conn->shm->doorbell_cancelled) && !conn->failed){
+            errno = -cqe->res;
+            connection_error(conn);
+        }
+        uring_progress(worker, conn);
+        return;
+    case URING_OP_TIMER:
+        expire_connections(worker);
+        if (!(cqe->flags & IORING_CQE_F_MORE)){
+            uring_submit_timer_poll(worker);
+        }
+        return;
+    case URING_OP_SEND:
+        conn->send_in_flight = 0;
+        if (cqe->res < 0){
+            if (!conn->failed){
+                errno = -cqe->res;
+                connection_error(conn);
+            }
+        }
+        else {
+            conn->sending_sent+=cqe->res;
+            conn->last_activity = worker->now;
+        }
+        uring_progress(worker, conn);
+        return;
+    default:
+        return;
+    }
+}
+
+/**
+ * uring_recieved - handles the result of a recv of the client: its data is analyzed, or its end of input is handled
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @param *buffer - the data, if res is positive
+ * @param res - amount of bytes recieved, 0 at EOF, or -errno
+ * @return void
+ */
+void uring_recieved(Worker* worker, Connection* conn, char* buffer, int res){
+    if (res > 0){
+        worker->stats.bytes_received+=res;
+        conn->last_activity = worker->now;
+        if (shm_attached(conn) && !conn->failed){ /* a ring client sends its requests through the ring */
+            errno = EPROTO;
+            connection_error(conn);
+        }
+        if (!conn->failed && consume_data(worker, conn, buffer, res)==-1){
+            connection_error(conn);
+        }
+    }
+    else if (res==0){ /* the client finished sending */
+        if (!conn->failed && input_finished(worker, conn)==-1){
+            connection_error(conn);
+        }
+    }
+    else if (res!=-ENOBUFS && !(res==-ECANCELED && conn->recv_cancelled) && !conn->failed){
+        errno = -res; /* on -ENOBUFS all the provided buffers were in use, the data waits in the socket untill recv is armed again */
+        connection_error(conn);
+    }
+}
+
+/**
+ * set_nonblocking - adds O_NONBLOCK to the file status flags
+ * @param fd - the file descriptor to change
+ * @return int - 0 if successfull, else -1
+ */
+int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags==-1){
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * accept_connections - accepts up to ACCEPT_BATCH pending clients of a listening socket and registers them in the worker's epoll
+ * instance, the listening socket is level triggered so the rest are reported again
+ * @param *worker - the worker
+ * @param listenfd - its TCP socket, or the shared UNIX socket
+ * @return int - amount of accepted clients
+ */
+int accept_connections(Worker* worker, int listenfd){
+    struct epoll_event ev;
+    Connection* conn;
+    int connfd, accepted=0;
+    while (accepted < ACCEPT_BATCH){
+        connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if( connfd < 0 )
+        {
+            if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR){
+                fprintf(stderr, "%s\n", strerror(errno));
+            }
+            return accepted;
+        }
+        accepted++;
+        conn = admit_connection(worker, connfd, listenfd==unix_listenfd);
+        if (conn==NULL){
+            continue;
+        }
+        conn->events = EPOLLIN;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, connfd, &ev)==-1){
+            fprintf(stderr, "%s\n", strerror(errno));
+            free_connection(worker, conn);
+        }
+    }
+    return accepted;
+}
+
+/**
+ * admit_connection - creates the Connection of an accepted client, unless there are config.max_connections clients already
+ * @param *worker - the worker that accepted the client
+ * @param connfd - the client's socket
+ * @param local - whether the client is of the UNIX socket, so it may pass a ring with its hello
+ * @return Connection* - the client, or NULL if it was rejected (and closed)
+ */
+Connection* admit_connection(Worker* worker, int connfd, int local){
+    Connection* conn;
+    int i;
+    if (config.max_connections!=0 && __atomic_add_fetch(&open_connections, 1, __ATOMIC_RELAXED) > config.max_connections){
+        __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+        reject_connection(worker, connfd);
+        return NULL;
+    }
+    conn = (Connection*)calloc(1, sizeof(Connection));
+    if (conn!=NULL && local){
+        conn->shm = (ShmChannel*)calloc(1, sizeof(ShmChannel));
+        if (conn->shm==NULL){
+            free(conn);
+            conn = NULL;
+        }
+        for (i=0 ; conn!=NULL && i < PCC_SHM_FDS ; i++){
+            conn->shm->fds[i] = -1;
+        }
+    }
+    if (conn==NULL){
+        fprintf(stderr, "%s\n", strerror(errno));
+        if (config.max_connections!=0){
+            __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+        }
+        close(connfd);
+        return NULL;
+    }
+    conn->fd = connfd;
+    conn->state = STATE_DETECT;
+    conn->request_start = now_nanoseconds();
+    conn->accepted_at = conn->request_start;
+    conn->last_activity = conn->request_start;
+    worker->stats.active_connections++;
+    if (worker->timerfd!=-1){
+        wheel_add(&worker->wheel, &conn->timer, (connection_deadline(conn) + TIMER_TICK_NS - 1) / TIMER_TICK_NS);
+    }
+    return conn;
+}
+
+/**
+ * reject_connection - closes a client that can't be served right away with a reset, so no TIME_WAIT state is kept for it
+ * @param *worker - the worker that accepted the client
+ * @param connfd - the client's socket
+ * @return void
+ */
+void reject_connection(Worker* worker, int connfd){
+    struct linger linger = { 1, 0 };
+    setsockopt(connfd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(connfd);
+    worker->stats.rejected++;
+}
+
+/**
+ * create_tick_timer - creates the timer that advances the worker's wheel every TIMER_TICK_NS, if there is a timeout
+ * @param *worker - the worker
+ * @return int - 0 if successfull, else -1
+ */
+int create_tick_timer(Worker* worker){
+    struct itimerspec spec;
+    worker->timerfd = -1;
+    if (config.idle_timeout==0 && config.total_timeout==0){
+        return 0;
+    }
+    wheel_init(&worker->wheel, now_nanoseconds() / TIMER_TICK_NS);
+    worker->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (worker->timerfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_nsec = TIMER_TICK_NS;
+    spec.it_interval.tv_nsec = TIMER_TICK_NS;
+    if (timerfd_settime(worker->timerfd, 0, &spec, NULL)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * connection_deadline - the earliest of the client's idle and total deadlines
+ * @param *conn - the client
+ * @return unsigned long long - nanoseconds
+ */
+unsigned long long connection_deadline(Connection* conn){
+    unsigned long long deadline = ~0ULL, total;
+    if (config.idle_timeout!=0){
+        deadline = conn->last_activity + config.idle_timeout * 1000000000ULL;
+    }
+    if (config.total_timeout!=0){
+        total = conn->accepted_at + config.total_timeout * 1000000000ULL;
+        deadline = total < deadline ? total : deadline;
+    }
+    return deadline;
+}
+
+/**
+ * expire_connections - advances the worker's wheel and closes the clients whose deadline passed. The data path only updates
+ * last_activity, so a client whose timer expired but was active since is just given a new timer
+ * @param *worker - the worker
+ * @return void
+ */
+void expire_connections(Worker* worker){
+    TimerEntry *entry, *next;
+    Connection* conn;
+    unsigned long long now = now_nanoseconds(), deadline, expirations;
+    if (read(worker->timerfd, &expirations, sizeof(expirations))==-1 && errno!=EAGAIN){
+        fprintf(stderr, "%s\n", strerror(errno));
+    }
+    for (entry=wheel_advance(&worker->wheel, now / TIMER_TICK_NS) ; entry!=NULL ; entry=next){
+        next = entry->next;
+        entry->next = NULL;
+        conn = (Connection*)entry; /* the timer is the first member */
+        deadline = connection_deadline(conn);
+        if (now < deadline){
+            wheel_add(&worker->wheel, &conn->timer, (deadline + TIMER_TICK_NS - 1) / TIMER_TICK_NS);
+            continue;
+        }
+        if (config.total_timeout!=0 && now >= conn->accepted_at + config.total_timeout * 1000000000ULL){
+            worker->stats.total_timeouts++;
+        }
+        else {
+            worker->stats.idle_timeouts++;
+        }
+        if (config.use_uring){ /* it is freed once nothing of it is in flight */
+            conn->failed = 1;
+            uring_progress(worker, conn);
+        }
+        else {
+            close_connection(worker, conn);
+        }
+    }
+}
+
+/**
+ * handle_connection - advances a client: recieves and analyzes its data, sends its pending replies and closes it when it is done
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @param events - the epoll events that are ready for the client
+ * @return void
+ */
+void handle_connection(Worker* worker, Connection* conn, unsigned int events){
+    size_t pending;
+    int ret_val;
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && socket_open(conn) && pending_output(conn) <= OUTPUT_HIGH_WATER){
+        ret_val = recv_and_analyze_info(worker, conn);
+        if (ret_val==-1){
+            connection_error(conn);
+            close_connection(worker, conn);
+            return;
+        }
+        if (ret_val==1 && input_finished(worker, conn)==-1){ /* the client finished sending */
+            connection_error(conn);
+            close_connection(worker, conn);
+            return;
+        }
+    }
+    if (shm_attached(conn) && !conn->eof && shm_consume(worker, conn)==-1){
+        connection_error(conn);
+        close_connection(worker, conn);
+        return;
+    }
+    pending = pending_output(conn);
+    if (send_output(conn)==-1){
+        connection_error(conn);
+        close_connection(worker, conn);
+        return;
+    }
+    if (pending_output(conn) < pending){
+        conn->last_activity = worker->now;
+    }
+    if (conn->eof && pending_output(conn)==0){ /* the client was fully served */
+        finish_connection(worker, conn);
+        close_connection(worker, conn);
+        return;
+    }
+    if (conn->shm!=NULL && conn->shm->paused && pending_output(conn) <= OUTPUT_HIGH_WATER && shm_resume(conn)==-1){
+        connection_error(conn);
+        close_connection(worker, conn);
+        return;
+    }
+    if (update_events(worker, conn)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        close_connection(worker, conn);
+    }
+}
+
+/**
+ * update_events - registers the events the client waits for: EPOLLIN while it may send and its pending replies are below
+ * OUTPUT_HIGH_WATER, EPOLLOUT while it has pending replies
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
+ */
+int update_events(Worker* worker, Connection* conn){
+    struct epoll_event ev;
+    unsigned int wanted = 0;
+    size_t pending = pending_output(conn);
+    if (socket_open(conn) && pending <= OUTPUT_HIGH_WATER){
+        wanted |= EPOLLIN;
+    }
+    if (pending > 0){
+        wanted |= EPOLLOUT;
+    }
+    if (wanted==conn->events){
+        return 0;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = wanted;
+    ev.data.ptr = conn;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_MOD, conn->fd, &ev)==-1){
+        return -1;
+    }
+    conn->events = wanted;
+    return 0;
+}
+
+/**
+ * connection_error - marks the client as failed and prints the error in errno
+ * @param *conn - the client
+ * @return void
+ */
+void connection_error(Connection* conn){
+    fprintf(stderr, "An error occurred (perhaps client unexpectedly closed connection): %s\n", strerror(errno));
+    conn->failed = 1;
+}
+
+/**
+ * finish_connection - called once the client was fully served: a legacy client's characters are counted in the worker's shard
+ * (a framed client's characters were counted after each of its requests)
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return void
+ */
+void finish_connection(Worker* worker, Connection* conn){
+    int i;
+    if (conn->state!=STATE_LEGACY){
+        return;
+    }
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        worker->stats.pcc_total[i]+=conn->pcc_local[i];
+    }
+}
+
+/**
+ * free_connection - closes the client's socket (and ring) and frees it
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return void
+ */
+void free_connection(Worker* worker, Connection* conn){
+    int i;
+    if (conn->shm!=NULL){
+        if (conn->shm->ring!=NULL){
+            munmap(conn->shm->ring, conn->shm->map_size);
+        }
+        for (i=0 ; i < PCC_SHM_FDS ; i++){
+            if (conn->shm->fds[i]!=-1){
+                close(conn->shm->fds[i]);
+            }
+        }
+        free(conn->shm);
+    }
+    if (worker->timerfd!=-1){
+        wheel_remove(&worker->wheel, &conn->timer);
+    }
+    if (config.max_connections!=0){
+        __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+    }
+    close(conn->fd);
+    free(conn->analysis);
+    free(conn->out);
+    free(conn->sending);
+    free(conn);
+    worker->stats.active_connections--;
+}
+
+/**
+ * close_connection - unregisters the client from epoll, it is freed after the current batch of events, which may still hold events
+ * of it (a ring client has its doorbell in epoll too)
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return void
+ */
+void close_connection(Worker* worker, Connection* conn){
+    epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    if (shm_attached(conn)){ /* the client holds the doorbell too, so closing it doesn't remove it from epoll */
+        epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, conn->shm->fds[SHM_DOORBELL], NULL);
+    }
+    if (worker->timerfd!=-1){
+        wheel_remove(&worker->wheel, &conn->timer);
+    }
+    conn->closed = 1;
+    conn->next_closed = worker->closed;
+    worker->closed = conn;
+}
+
+/**
+ * consume_data - runs the client's data through the protocol: detects whether the client is framed or legacy, analyzes the data
+ * and queues a reply for every request that was completed
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @param *buffer - the data
+ * @param len - amount of bytes in the buffer
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int consume_data(Worker* worker, Connection* conn, char* buffer, int len){
+    unsigned char byte, transport;
+    uint32_t field;
+    int n;
+    while (len > 0 && !conn->eof){
+        switch (conn->state){
+        case STATE_DETECT: /* PCC_MAGIC, a version, the transport (a ring only on the UNIX socket) and 2 zero bytes */
+            byte = (unsigned char)buffer[0];
+            if ((conn->header_len < PCC_MAGIC_SIZE && byte!=(unsigned char)PCC_MAGIC[conn->header_len]) ||
+                (conn->header_len > PCC_MAGIC_SIZE && byte!=0 &&
+                 !(conn->header_len==PCC_HELLO_TRANSPORT_OFFSET && byte==PCC_TRANSPORT_SHM && conn->shm!=NULL))){
+                fall_back_to_legacy(conn);
+                worker->stats.bytes_analyzed+=conn->header_len;
+                break;
+            }
+            conn->header[conn->header_len++] = byte;
+            buffer++;
+            len--;
+            if (conn->header_len==PCC_HELLO_SIZE){
+                byte = conn->header[PCC_MAGIC_SIZE]; /* the client's version */
+                transport = conn->header[PCC_HELLO_TRANSPORT_OFFSET];
+                memset(conn->header, 0, PCC_HELLO_SIZE); /* answer with the server's hello */
+                memcpy(conn->header, PCC_MAGIC, PCC_MAGIC_SIZE);
+                conn->header[PCC_MAGIC_SIZE] = PCC_VERSION;
+                conn->header[PCC_HELLO_TRANSPORT_OFFSET] = transport;
+                if (append_output(conn, conn->header, PCC_HELLO_SIZE)==-1){
+                    return -1;
+                }
+                if (byte!=PCC_VERSION){ /* the client learns the server's version from the hello, and the connection is closed */
+                    conn->eof = 1;
+                }
+                conn->state = STATE_HEADER;
+                conn->header_len = 0;
+                if (transport==PCC_TRANSPORT_SHM && !conn->eof && shm_attach(worker, conn)==-1){
+                    return -1;
+                }
+            }
+            break;
+        case STATE_LEGACY:
+            analyze_data(conn->pcc_local, buffer, len, &conn->counter);
+            worker->stats.bytes_analyzed+=len;
+            return 0;
+        case STATE_HEADER:
+            if (conn->header_len==0){
+                conn->request_start = now_nanoseconds();
+            }
+            n = PCC_REQUEST_HEADER_SIZE - conn->header_len;
+            n = n < len ? n : len;
+            memcpy(conn->header + conn->header_len, buffer, n);
+            conn->header_len+=n;
+            buffer+=n;
+            len-=n;
+            if (conn->header_len==PCC_REQUEST_HEADER_SIZE){
+                memcpy(&field, conn->header, sizeof(field));
+                conn->remaining = ntohl(field);
+                memcpy(&field, conn->header + sizeof(field), sizeof(field));
+                conn->flags = ntohl(field);
+                if (start_request(conn)==-1){
+                    return -1;
+                }
+                if (conn->remaining==0 && complete_request(worker, conn)==-1){
+                    return -1;
+                }
+            }
+            break;
+        case STATE_PAYLOAD:
+            n = conn->remaining < (uint32_t)len ? (int)conn->remaining : len;
+            if (conn->analyzer==ANALYZER_PRINTABLE){
+                analyze_data(conn->pcc_local, buffer, n, &conn->counter);
+            }
+            else {
+                analysis_feed(conn->analyzer, conn->analysis, buffer, n);
+            }
+            worker->stats.bytes_analyzed+=n;
+            conn->remaining-=n;
+            buffer+=n;
+            len-=n;
+            if (conn->remaining==0 && complete_request(worker, conn)==-1){
+                return -1;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * fall_back_to_legacy - the client didn't send the hello, so the bytes that were matched against it are its data
+ * @param *conn - the client
+ * @return void
+ */
+void fall_back_to_legacy(Connection* conn){
+    conn->state = STATE_LEGACY;
+    analyze_data(conn->pcc_local, (char*)conn->header, conn->header_len, &conn->counter);
+}
+
+/**
+ * finish_input - called when the client finished sending: a legacy client gets its answer, a framed client must not be in the
+ * middle of a request
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int finish_input(Worker* worker, Connection* conn){
+    char reply[REPLY_SIZE];
+    int length;
+    if (conn->state==STATE_DETECT){
+        fall_back_to_legacy(conn);
+        worker->stats.bytes_analyzed+=conn->header_len;
+    }
+    if (conn->state==STATE_LEGACY){
+        record_request(worker, conn);
+        length = snprintf(reply, REPLY_SIZE, "%llu", (unsigned long long)conn->counter);
+        return append_output(conn, reply, length);
+    }
+    if (conn->state==STATE_PAYLOAD || conn->header_len > 0){
+        errno = EPROTO; /* the connection ended in the middle of a request */
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * input_finished - called when the client shut down its sending side of the socket: a ring client's ring is consumed untill its
+ * last published request first
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int input_finished(Worker* worker, Connection* conn){
+    if (shm_attached(conn)){
+        conn->shm->client_done = 1;
+        return shm_consume(worker, conn);
+    }
+    conn->eof = 1;
+    return finish_input(worker, conn);
+}
+
+/**
+ * socket_open - whether the client may still send through its socket
+ * @param *conn - the client
+ * @return int - 1 if so, else 0
+ */
+int socket_open(Connection* conn){
+    return !conn->eof && (conn->shm==NULL || !conn->shm->client_done);
+}
+
+/**
+ * shm_prepare_hello - prepares the msghdr that recieves the rest of the hello of a client of the UNIX socket, and the descriptors
+ * that may come with it
+ * @param *conn - the client
+ * @return void
+ */
+void shm_prepare_hello(Connection* conn){
+    ShmChannel* shm = conn->shm;
+    memset(&shm->msg, 0, sizeof(shm->msg));
+    shm->iov.iov_base = shm->hello;
+    shm->iov.iov_len = PCC_HELLO_SIZE - conn->header_len; /* nothing beyond the hello, the requests are recieved as usual */
+    shm->msg.msg_iov = &shm->iov;
+    shm->msg.msg_iovlen = 1;
+    shm->msg.msg_control = shm->control;
+    shm->msg.msg_controllen = sizeof(shm->control);
+}
+
+/**
+ * shm_collect_fds - keeps the descriptors that came with the hello, if they are the PCC_SHM_FDS descriptors of a ring, and closes
+ * any others
+ * @param *conn - the client, its msghdr holds the result of recvmsg
+ * @return void
+ */
+void shm_collect_fds(Connection* conn){
+    ShmChannel* shm = conn->shm;
+    struct cmsghdr* cmsg;
+    int fds[PCC_SHM_FDS], i, count;
+    for (cmsg=CMSG_FIRSTHDR(&shm->msg) ; cmsg!=NULL ; cmsg=CMSG_NXTHDR(&shm->msg, cmsg)){
+        if (cmsg->cmsg_level!=SOL_SOCKET || cmsg->cmsg_type!=SCM_RIGHTS){
+            continue;
+        }
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        count = count < PCC_SHM_FDS ? count : PCC_SHM_FDS; /* the control buffer holds no more, the kernel closes the rest */
+        memcpy(fds, CMSG_DATA(cmsg), count*sizeof(int));
+        for (i=0 ; i < count ; i++){
+            if (count==PCC_SHM_FDS && shm->fds[i]==-1){
+                shm->fds[i] = fds[i];
+            }
+            else {
+                close(fds[i]);
+            }
+        }
+    }
+}
+
+/**
+ * shm_attach - maps the ring that the client passed with its hello and starts watching its doorbell. The client can't make the
+ * worker fault: the memfd must be sealed against shrinking, and the capacity is read once
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client, its hello asked for PCC_TRANSPORT_SHM
+ * @return int - 0 if successfull, else -1 and errno is set (EPROTO if the descriptors or the ring are not valid)
+ */
+int shm_attach(Worker* worker, Connection* conn){
+    ShmChannel* shm = conn->shm;
+    struct epoll_event ev;
+    struct stat st;
+    void* map;
+    int seals;
+    if (shm->fds[SHM_MEMFD]==-1){
+        errno = EPROTO;
+        return -1;
+    }
+    seals = fcntl(shm->fds[SHM_MEMFD], F_GET_SEALS);
+    if (seals==-1 || !(seals & F_SEAL_SHRINK) || fstat(shm->fds[SHM_MEMFD], &st)==-1 || st.st_size < PCC_SHM_DATA_OFFSET ||
+        !(fcntl(shm->fds[SHM_DOORBELL], F_GETFL) & O_NONBLOCK) || !(fcntl(shm->fds[SHM_WAKEUP], F_GETFL) & O_NONBLOCK)){
+        errno = EPROTO;
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fds[SHM_MEMFD], 0);
+    if (map==MAP_FAILED){
+        return -1;
+    }
+    shm->ring = (PccShmRing*)map;
+    shm->map_size = st.st_size;
+    shm->data = (char*)map + PCC_SHM_DATA_OFFSET;
+    shm->capacity = shm->ring->capacity;
+    shm->tail = __atomic_load_n(&shm->ring->tail, __ATOMIC_ACQUIRE);
+    close(shm->fds[SHM_MEMFD]); /* the mapping keeps the memory */
+    shm->fds[SHM_MEMFD] = -1;
+    if (shm->ring->magic!=PCC_SHM_MAGIC || shm->capacity==0 || (shm->capacity & (shm->capacity - 1))!=0 ||
+        shm->capacity > PCC_SHM_CAPACITY_MAX || PCC_SHM_DATA_OFFSET + shm->capacity > (uint64_t)st.st_size){
+        errno = EPROTO;
+        return -1;
+    }
+    if (config.use_uring){
+        if (uring_submit_doorbell(worker, conn)==-1){
+            return -1;
+        }
+    }
+    else {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = (void*)((uintptr_t)conn | SHM_DOORBELL_TAG);
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, shm->fds[SHM_DOORBELL], &ev)==-1){
+            return -1;
+        }
+    }
+    return shm_resume(conn); /* the client may have published requests before the ring was attached */
+}
+
+/**
+ * shm_attached - whether the client's requests come through a ring
+ * @param *conn - the client
+ * @return int - 1 if so, else 0
+ */
+int shm_attached(Connection* conn){
+    return conn->shm!=NULL && conn->shm->ring!=NULL;
+}
+
+/**
+ * shm_consume - analyzes the requests that the client published to its ring in place, and hands the consumed space back to it.
+ * Stops when the ring is empty (after setting server_sleeping, so the client rings the doorbell), when the replies exceed
+ * OUTPUT_HIGH_WATER (untill shm_resume), or after RECV_BUDGET rounds (it rings its own doorbell, so other clients aren't starved)
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int shm_consume(Worker* worker, Connection* conn){
+    ShmChannel* shm = conn->shm;
+    uint64_t head, offset, n, one = 1;
+    int rounds;
+    shm->paused = 0;
+    for (rounds=0 ; !conn->eof ; rounds++){
+        if (pending_output(conn) > OUTPUT_HIGH_WATER){
+            shm->paused = 1;
+            return 0;
+        }
+        if (rounds==RECV_BUDGET){
+            return shm_resume(conn);
+        }
+        head = __atomic_load_n(&shm->ring->head, __ATOMIC_ACQUIRE);
+        if (head==shm->tail){
+            if (shm->client_done){ /* the client's last request was consumed */
+                conn->eof = 1;
+                return finish_input(worker, conn);
+            }
+            __atomic_store_n(&shm->ring->server_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&shm->ring->head, __ATOMIC_SEQ_CST)==shm->tail){
+                return 0;
+            }
+            __atomic_store_n(&shm->ring->server_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (head - shm->tail > shm->capacity){
+            errno = EPROTO;
+            return -1;
+        }
+        offset = shm->tail & (shm->capacity - 1);
+        n = head - shm->tail < shm->capacity - offset ? head - shm->tail : shm->capacity - offset; /* up to the end of the ring */
+        worker->stats.bytes_received+=n;
+        conn->last_activity = worker->now;
+        if (consume_data(worker, conn, shm->data + offset, (int)n)==-1){
+            return -1;
+        }
+        shm->tail+=n;
+        __atomic_store_n(&shm->ring->tail, shm->tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shm->ring->client_sleeping, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&shm->ring->client_sleeping, 0, __ATOMIC_SEQ_CST) &&
+            write(shm->fds[SHM_WAKEUP], &one, sizeof(one))==-1 && errno!=EAGAIN){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * shm_resume - makes the worker consume the client's ring again, by ringing its doorbell
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1
+ */
+int shm_resume(Connection* conn){
+    uint64_t one = 1;
+    conn->shm->paused = 0;
+    if (write(conn->shm->fds[SHM_DOORBELL], &one, sizeof(one))==-1 && errno!=EAGAIN){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * shm_read_doorbell - resets the client's doorbell, the ring is consumed afterwards so nothing that was published before is missed
+ * @param *conn - the client
+ * @return void
+ */
+void shm_read_doorbell(Connection* conn){
+    uint64_t value;
+    if (read(conn->shm->fds[SHM_DOORBELL], &value, sizeof(value))==-1 && errno!=EAGAIN){
+        fprintf(stderr, "%s\n", strerror(errno));
+    }
+}
+
+/**
+ * start_request - chooses the analyzer of the request whose header was recieved, and resets its state
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1 and errno is set (EINVAL if the analyzer doesn't exist or has no class table)
+ */
+int start_request(Connection* conn){
+    conn->analyzer = (conn->flags >> PCC_ANALYZER_SHIFT) & PCC_ANALYZER_MASK;
+    if (conn->analyzer==PCC_ANALYZER_DEFAULT){
+        conn->analyzer = config.analyzer;
+    }
+    if (conn->analyzer >= NUM_ANALYZERS || (conn->analyzer==ANALYZER_CLASS && config.class_table_path==NULL)){
+        errno = EINVAL;
+        return -1;
+    }
+    conn->state = STATE_PAYLOAD;
+    if (conn->analyzer==ANALYZER_PRINTABLE){
+        conn->counter = 0;
+        memset(conn->pcc_local, 0, sizeof(conn->pcc_local));
+        return 0;
+    }
+    if (conn->analysis==NULL){
+        conn->analysis = (Analysis*)malloc(sizeof(Analysis));
+        if (conn->analysis==NULL){
+            return -1;
+        }
+    }
+    analysis_reset(conn->analysis);
+    return 0;
+}
+
+/**
+ * complete_request - counts the request's characters in the worker's shard and queues its reply
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int complete_request(Worker* worker, Connection* conn){
+    uint64_t reply[1 + NUM_BYTES], buckets[NUM_BYTES], count;
+    int i, n = 1, num_buckets;
+    if (conn->analyzer==ANALYZER_PRINTABLE){
+        reply[0] = htobe64(conn->counter);
+        for (i=0 ; i < NUM_PRINTABLE ; i++){
+            worker->stats.pcc_total[i]+=conn->pcc_local[i];
+            buckets[i] = conn->pcc_local[i];
+        }
+        num_buckets = NUM_PRINTABLE;
+    }
+    else {
+        num_buckets = analysis_finish(conn->analyzer, conn->analysis, &class_table, &count, buckets);
+        reply[0] = htobe64(count);
+        for (i=0 ; i < NUM_PRINTABLE ; i++){ /* every analyzer counts the bytes, so pcc_total still holds all the printable characters */
+            worker->stats.pcc_total[i]+=conn->analysis->bytes[i + OFFSET];
+        }
+    }
+    if (conn->flags & PCC_FLAG_HISTOGRAM){
+        for (i=0 ; i < num_buckets ; i++){
+            reply[n++] = htobe64(buckets[i]);
+        }
+    }
+    conn->state = STATE_HEADER;
+    conn->header_len = 0;
+    record_request(worker, conn);
+    return append_output(conn, reply, n*sizeof(uint64_t));
+}
+
+/**
+ * record_request - counts a request that was answered, and its latency from its first byte (or from the accept of a legacy client)
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client
+ * @return void
+ */
+void record_request(Worker* worker, Connection* conn){
+    worker->stats.requests++;
+    worker->stats.latency[stats_latency_bucket(now_nanoseconds() - conn->request_start)]++;
+}
+
+/**
+ * now_nanoseconds - reads the monotonic clock
+ * @return unsigned long long - nanoseconds
+ */
+unsigned long long now_nanoseconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * append_output - queues data to be sent to the client
+ * @param *conn - the client
+ * @param *data - the data
+ * @param len - amount of bytes
+ * @return int - 0 if successfull, else -1
+ */
+int append_output(Connection* conn, const void* data, size_t len){
+    size_t cap;
+    char* temp;
+    if (conn->out_sent > 0 && conn->out_sent==conn->out_len){
+        conn->out_sent = 0;
+        conn->out_len = 0;
+    }
+    if (conn->out_len + len > conn->out_cap){
+        if (conn->out_sent > 0){ /* the sent replies are dropped before growing */
+            memmove(conn->out, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+            conn->out_len-=conn->out_sent;
+            conn->out_sent = 0;
+        }
+        cap = conn->out_cap ? conn->out_cap : 256;
+        while (conn->out_len + len > cap){
+            cap*=2;
+        }
+        if (cap!=conn->out_cap){
+            temp = (char*)realloc(conn->out, cap);
+            if (temp==NULL){
+                return -1;
+            }
+            conn->out = temp;
+            conn->out_cap = cap;
+        }
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len+=len;
+    return 0;
+}
+
+/**
+ * pending_output - amount of queued bytes that were not sent to the client yet
+ * @param *conn - the client
+ * @return size_t - amount of bytes
+ */
+size_t pending_output(Connection* conn){
+    return (conn->out_len - conn->out_sent) + (conn->sending_len - conn->sending_sent);
+}
+
+/**
+ * recv_and_analyze_info - recieve the currently available information from a client into the worker's buffer and analyze it
+ * @param *worker - the worker that owns the client
+ * @param *conn - the client, its histogram, counter and replies are updated
+ * @return int - 1 if the client finished sending, 0 if there is no more data for now, else -1
+ */
+int recv_and_analyze_info(Worker* worker, Connection* conn){
+        int bytes_read, calls;
+        char* buffer;
+        for (calls=0 ; calls < RECV_BUDGET ; calls++){
+            if (conn->shm!=NULL && conn->state==STATE_DETECT){ /* the descriptors of a ring client come with its hello */
+                shm_prepare_hello(conn);
+                bytes_read = recvmsg(conn->fd, &conn->shm->msg, MSG_CMSG_CLOEXEC);
+                buffer = (char*)conn->shm->hello;
+                if (bytes_read > 0){
+                    shm_collect_fds(conn);
+                }
+            }
+            else {
+                bytes_read = recv(conn->fd,worker->buffer,config.recv_buffer_size, 0);
+                buffer = worker->buffer;
+            }
+            worker->stats.syscalls++;
+            if (bytes_read==-1){
+                if (errno==EAGAIN || errno==EWOULDBLOCK){
+                    return 0;
+                }
+                if (errno==EINTR){
+                    continue;
+                }
+                return -1;
+            }
+            if (bytes_read==0) return 1;
+            worker->stats.bytes_received+=bytes_read;
+            conn->last_activity = worker->now;
+            if (shm_attached(conn)){ /* a ring client sends its requests through the ring */
+                errno = EPROTO;
+                return -1;
+            }
+            if (consume_data(worker, conn, buffer, bytes_read)==-1){
+                return -1;
+            }
+            if (conn->eof || pending_output(conn) > OUTPUT_HIGH_WATER){ /* wait untill the replies are sent */
+                return 0;
+            }
+        }
+        return 0; /* the socket is level triggered, so epoll reports it again if data is left */
+
+}
+
+/**
+ * send_output - send the client's pending replies without blocking
+ * @param *conn - the client
+ * @return int - 1 if all the replies were sent, 0 if the socket is not writable for now, else -1
+ */
+int send_output(Connection* conn){
+    ssize_t val;
+    while (conn->out_sent < conn->out_len){
+        val = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, 0);
+        if (val==-1){
+            if (errno==EAGAIN || errno==EWOULDBLOCK){
+                return 0;
+            }
+            if (errno==EINTR){
+                continue;
+            }
+            return -1;
+        }
+        conn->out_sent+=val;
+    }
+    conn->out_sent = 0;
+    conn->out_len = 0;
+    return 1;
+}
+
+/**
+ * block_signals - Blocks SIGINT and SIGUSR1, so they are only recieved by the signalfd of main
+ * @param *mask - filled with the mask that contains SIGINT and SIGUSR1
+ * @return int - 0 if successfull, else -1
+ */
+int block_signals(sigset_t* mask){
+    int ret_val;
+    sigemptyset(mask);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGUSR1);
+    ret_val = pthread_sigmask(SIG_BLOCK, mask, NULL);
+    if (ret_val){
+        fprintf(stderr,"%s\n",strerror(ret_val));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * create_stats_socket - creates the blocking socket of the stats endpoint, listening on the loopback interface only
+ * @param port - the port to listen on
+ * @return int - the socket if successfull, else -1
+ */
+int create_stats_socket(unsigned int port){
+    int statsfd, enable = 1;
+    struct sockaddr_in serv_addr;
+    statsfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (statsfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    serv_addr.sin_port = htons(port);
+    if (setsockopt(statsfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable))!=0 ||
+        bind(statsfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr))!=0 || listen(statsfd, 10)!=0){
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(statsfd);
+        return -1;
+    }
+    return statsfd;
+}
+
+/**
+ * serve_stats - accepts a client of the stats endpoint, sends it a snapshot as a JSON line and closes it
+ * @param statsfd - the socket of the stats endpoint
+ * @return void
+ */
+void serve_stats(int statsfd){
+    char stats_text[STATS_TEXT_SIZE];
+    struct timeval timeout = { STATS_SEND_TIMEOUT, 0 };
+    int connfd, length, sent=0;
+    ssize_t val;
+    connfd = accept(statsfd, NULL, NULL);
+    if (connfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return;
+    }
+    length = snapshot_json(stats_text, sizeof(stats_text));
+    setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (sent < length){
+        val = send(connfd, stats_text + sent, length - sent, 0);
+        if (val==-1){
+            if (errno==EINTR){
+                continue;
+            }
+            fprintf(stderr, "%s\n", strerror(errno));
+            break;
+        }
+        sent+=val;
+    }
+    close(connfd);
+}
+
+/**
+ * snapshot_json - sums the snapshots that the workers published and formats them
+ * @param *buffer - filled with a JSON line
+ * @param size - the size of the buffer
+ * @return int - the length of the line, or -1 if the buffer is too small
+ */
+int snapshot_json(char* buffer, size_t size){
+    Stats total;
+    sum_snapshots(&total);
+    return stats_format_json(&total, config.num_workers, buffer, size);
+}
+
+/**
+ * sum_snapshots - sums the snapshots that the workers published, pcc_total includes the one restored from the state file
+ * @param *total - filled with the sum
+ * @return void
+ */
+void sum_snapshots(Stats* total){
+    Stats snapshot;
+    int i;
+    memset(total, 0, sizeof(Stats));
+    memcpy(total->pcc_total, restored_total, sizeof(restored_total));
+    for (i=0 ; i < config.num_workers ; i++){
+        stats_snapshot(&workers[i].published, &snapshot);
+        stats_add(total, &snapshot);
+    }
+}
+
+/**
+ * create_checkpoint_timer - creates a timer that expires every interval
+ * @param interval - seconds
+ * @return int - the timerfd if successfull, else -1
+ */
+int create_checkpoint_timer(unsigned int interval){
+    struct itimerspec spec;
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (timerfd==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = interval;
+    spec.it_interval.tv_sec = interval;
+    if (timerfd_settime(timerfd, 0, &spec, NULL)==-1){
+        fprintf(stderr, "%s\n", strerror(errno));
+        close(timerfd);
+        return -1;
+    }
+    return timerfd;
+}
+
+/**
+ * checkpoint - writes pcc_total to the state file, an error is printed and the server keeps running
+ * @param *pcc_total - the counters, including the restored ones
+ * @return void
+ */
+void checkpoint(const unsigned long long pcc_total[NUM_PRINTABLE]){
+    if (state_checkpoint(&state, pcc_total)==-1){
+        fprintf(stderr, "Unable to checkpoint %s: %s\n", config.state_path, strerror(errno));
+    }
+}
+
+/**
+ * sum_shards - sums the shards of all the workers and the counters restored from the state file, after the workers were joined
+ * @param total - filled with the amount of every printable character
+ * @return void
+ */
+void sum_shards(unsigned long long total[NUM_PRINTABLE]){
+    int i, j;
+    memcpy(total, restored_total, sizeof(restored_total));
+    for (j=0 ; j < config.num_workers ; j++){
+        for (i=0 ; i < NUM_PRINTABLE ; i++){
+            total[i]+=workers[j].stats.pcc_total[i];
+        }
+    }
+}
+
+/**
+ * print_recv_statistics - prints to stderr the amount of bytes recieved and of system calls it took, per worker
+ * @return void
+ */
+void print_recv_statistics(){
+    int i;
+    for (i=0 ; i < config.num_workers ; i++){
+        fprintf(stderr, "worker %d: %llu bytes, %llu %s calls, %.1f bytes per call\n", i, workers[i].stats.bytes_received, workers[i].stats.syscalls,
+                config.use_uring ? "io_uring_enter" : "recv",
+                workers[i].stats.syscalls ? (double)workers[i].stats.bytes_received / workers[i].stats.syscalls : 0.0);
+    }
+}
+
+/**
+ * sum_up_and_exit -  prints the information collected by all the workers to stdout and exits program
+ * @return void
+ */
+void sum_up_and_exit(){
+    int i;
+    unsigned long long pcc_total[NUM_PRINTABLE];
+    sum_shards(pcc_total);
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        printf("char '%c' : %llu times\n", i+OFFSET,pcc_total[i]);
+    }
+    exit(0);
+}
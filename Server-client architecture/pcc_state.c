@@ -0,0 +1,176 @@
+/*
+ * pcc_state summary:
+ *
+ * Keeps pcc_total across restarts in a memory mapped state file of STATE_SLOTS page sized slots. A checkpoint is written to the slot
+ * that doesn't hold the latest one and synced to disk, so a crash in the middle of a checkpoint leaves at most that slot torn: its
+ * checksum doesn't match, and the previous checkpoint is restored instead. The counters that were added after the last checkpoint are lost.
+ * The slots are as large as the page size of the machine, and the file is locked with flock while a server has it open.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "pcc_state.h"
+
+#define STATE_FILE_SIZE(state) (STATE_SLOTS * (state)->slot_size)
+
+/**
+ * slot_checksum - FNV-1a over the fields of the slot that precede the checksum
+ * @param *slot - the slot
+ * @return uint64_t - the checksum
+ */
+static uint64_t slot_checksum(const StateSlot* slot){
+    const unsigned char* bytes = (const unsigned char*)slot;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i=0 ; i < offsetof(StateSlot, checksum) ; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * slot_valid - checks the header and the checksum of a slot
+ * @param *slot - the slot
+ * @return int - 1 if the slot holds a complete checkpoint of this version, else 0
+ */
+static int slot_valid(const StateSlot* slot){
+    return memcmp(slot->magic, STATE_MAGIC, STATE_MAGIC_SIZE)==0 && slot->version==STATE_VERSION &&
+           slot->num_printable==NUM_PRINTABLE && slot->checksum==slot_checksum(slot);
+}
+
+/**
+ * state_empty - checks whether the file holds nothing but zeros, like a new one that the server was killed in before its first checkpoint
+ * @param *state - the mapped state
+ * @return int - 1 if every byte is zero, else 0
+ */
+static int state_empty(const State* state){
+    size_t i;
+    for (i=0 ; i < STATE_FILE_SIZE(state) ; i++){
+        if (state->map[i]!=0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * state_open - maps the state file, creating it if it doesn't exist, and restores the latest checkpoint
+ * @param *state - the state to initiate
+ * @param *path - the path of the state file
+ * @param *pcc_total - filled with the restored counters, zeros if the file is new
+ * @return int - 0 if successfull, else -1 (a file that exists but holds no valid checkpoint is not overwritten, unless it's all zeros,
+ * and a file that another server has open isn't used)
+ */
+int state_open(State* state, const char* path, unsigned long long pcc_total[NUM_PRINTABLE]){
+    struct stat st;
+    StateSlot* slot;
+    int i, best=-1;
+    memset(state, 0, sizeof(State));
+    memset(pcc_total, 0, NUM_PRINTABLE*sizeof(unsigned long long));
+    state->slot_size = (size_t)sysconf(_SC_PAGESIZE);
+    state->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (state->fd==-1){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (flock(state->fd, LOCK_EX | LOCK_NB)==-1){ /* taken before the file is looked at, and released when it's closed */
+        fprintf(stderr, "%s: %s\n", path, errno==EWOULDBLOCK ? "in use by another server" : strerror(errno));
+        close(state->fd);
+        return -1;
+    }
+    if (fstat(state->fd, &st)==-1){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(state->fd);
+        return -1;
+    }
+    if (st.st_size!=0 && (size_t)st.st_size!=STATE_FILE_SIZE(state)){
+        fprintf(stderr, "%s: not a state file of this page size\n", path);
+        close(state->fd);
+        return -1;
+    }
+    if (st.st_size==0 && (ftruncate(state->fd, STATE_FILE_SIZE(state))==-1 || fsync(state->fd)==-1)){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(state->fd);
+        return -1;
+    }
+    state->map = mmap(NULL, STATE_FILE_SIZE(state), PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, 0);
+    if (state->map==MAP_FAILED){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(state->fd);
+        return -1;
+    }
+    for (i=0 ; i < STATE_SLOTS ; i++){
+        slot = (StateSlot*)(state->map + i*state->slot_size);
+        if (slot_valid(slot) && (best==-1 || slot->generation > state->generation)){
+            best = i;
+            state->generation = slot->generation;
+        }
+    }
+    if (best==-1){
+        if (st.st_size!=0 && !state_empty(state)){
+            fprintf(stderr, "%s: no valid checkpoint (corrupted, or written by another version)\n", path);
+            state_close(state);
+            return -1;
+        }
+        state->current = STATE_SLOTS - 1; /* so the first checkpoint goes to slot 0 */
+        if (state_checkpoint(state, pcc_total)==-1){ /* a new file holds a valid checkpoint before the server runs */
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            state_close(state);
+            return -1;
+        }
+        return 0;
+    }
+    state->current = best;
+    slot = (StateSlot*)(state->map + best*state->slot_size);
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        pcc_total[i] = slot->pcc_total[i];
+    }
+    return 0;
+}
+
+/**
+ * state_checkpoint - writes the counters to the slot that doesn't hold the latest checkpoint and syncs it
+ * @param *state - the state
+ * @param *pcc_total - the counters
+ * @return int - 0 if successfull, else -1 and errno is set (the previous checkpoint stays the latest)
+ */
+int state_checkpoint(State* state, const unsigned long long pcc_total[NUM_PRINTABLE]){
+    int i, next = (state->current + 1) % STATE_SLOTS;
+    StateSlot* slot = (StateSlot*)(state->map + next*state->slot_size);
+    memset(slot, 0, sizeof(StateSlot));
+    memcpy(slot->magic, STATE_MAGIC, STATE_MAGIC_SIZE);
+    slot->version = STATE_VERSION;
+    slot->num_printable = NUM_PRINTABLE;
+    slot->generation = state->generation + 1;
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        slot->pcc_total[i] = pcc_total[i];
+    }
+    slot->checksum = slot_checksum(slot);
+    if (msync(slot, state->slot_size, MS_SYNC)==-1){
+        return -1;
+    }
+    state->generation++;
+    state->current = next;
+    return 0;
+}
+
+/**
+ * state_close - unmaps and closes the state file
+ * @param *state - the state
+ * @return void
+ */
+void state_close(State* state){
+    if (state->map!=NULL && state->map!=MAP_FAILED){
+        munmap(state->map, STATE_FILE_SIZE(state));
+    }
+    close(state->fd);
+}
@@ -0,0 +1,33 @@
+#ifndef PCC_STATE_H
+#define PCC_STATE_H
+#include <stdint.h>
+
+#include "pcc_analyze.h"
+
+#define STATE_MAGIC "PCCSTATE"
+#define STATE_MAGIC_SIZE 8
+#define STATE_VERSION 1
+#define STATE_SLOTS 2
+
+typedef struct state_slot{ /* a checkpoint of pcc_total, in the byte order of the machine */
+    char magic[STATE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t num_printable;
+    uint64_t generation; /* the slot with the highest valid generation is the latest checkpoint */
+    uint64_t pcc_total[NUM_PRINTABLE];
+    uint64_t checksum; /* of all the fields above */
+}StateSlot;
+
+typedef struct state{ /* the memory mapped state file */
+    int fd; /* flock'ed, so another server can't checkpoint to the same file */
+    char* map;
+    size_t slot_size; /* a page, so every slot is synced on its own */
+    uint64_t generation;
+    int current; /* the slot of the latest checkpoint, the next one goes to the other slot */
+}State;
+
+int state_open(State* state, const char* path, unsigned long long pcc_total[NUM_PRINTABLE]);
+int state_checkpoint(State* state, const unsigned long long pcc_total[NUM_PRINTABLE]);
+void state_close(State* state);
+
+#endif /* PCC_STATE_H */
@@ -0,0 +1,151 @@
+/*
+ * pcc_stats summary:
+ *
+ * The live statistics of pcc_server. Every worker counts into its own Stats without any synchronization, and publishes a copy of it
+ * with a seqlock before it blocks for events: the worker never waits for a reader, and a reader retries if the copy changed while it
+ * was read, so every snapshot is a consistent state of the worker.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include "pcc_stats.h"
+
+/**
+ * stats_publish - copies the worker's counters to the seqlock, called only by the worker that owns it
+ * @param *lock - the worker's seqlock
+ * @param *stats - the worker's counters
+ * @return void
+ */
+void stats_publish(StatsSeqlock* lock, const Stats* stats){
+    unsigned int sequence = lock->sequence;
+    __atomic_store_n(&lock->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); /* the odd sequence is visible before any of the new counters */
+    memcpy(&lock->stats, stats, sizeof(Stats));
+    __atomic_store_n(&lock->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * stats_snapshot - reads a consistent copy of the counters that were last published to the seqlock
+ * @param *lock - the worker's seqlock
+ * @param *stats - filled with the counters
+ * @return void
+ */
+void stats_snapshot(StatsSeqlock* lock, Stats* stats){
+    unsigned int begin, end;
+    while (1){
+        begin = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE);
+        if (begin & 1){ /* the worker is in the middle of publishing */
+            sched_yield();
+            continue;
+        }
+        memcpy(stats, &lock->stats, sizeof(Stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); /* the copy is done before the sequence is checked again */
+        end = __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED);
+        if (begin==end){
+            return;
+        }
+    }
+}
+
+/**
+ * stats_add - adds the counters of a worker to a total
+ * @param *total - the total
+ * @param *stats - the worker's counters
+ * @return void
+ */
+void stats_add(Stats* total, const Stats* stats){
+    int i;
+    for (i=0 ; i < NUM_PRINTABLE ; i++){
+        total->pcc_total[i]+=stats->pcc_total[i];
+    }
+    total->active_connections+=stats->active_connections;
+    total->bytes_received+=stats->bytes_received;
+    total->bytes_analyzed+=stats->bytes_analyzed;
+    total->requests+=stats->requests;
+    total->syscalls+=stats->syscalls;
+    total->rejected+=stats->rejected;
+    total->idle_timeouts+=stats->idle_timeouts;
+    total->total_timeouts+=stats->total_timeouts;
+    for (i=0 ; i < STATS_LATENCY_BUCKETS ; i++){
+        total->latency[i]+=stats->latency[i];
+    }
+}
+
+/**
+ * stats_latency_bucket - the latency bucket of a request
+ * @param nanoseconds - how long the request took
+ * @return unsigned int - the bucket
+ */
+unsigned int stats_latency_bucket(unsigned long long nanoseconds){
+    unsigned long long microseconds = nanoseconds / 1000;
+    unsigned int bucket = microseconds ? 64 - __builtin_clzll(microseconds) : 0;
+    return bucket < STATS_LATENCY_BUCKETS ? bucket : STATS_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * latency_percentile - the upper bound of the bucket that holds the given percentile of the requests
+ * @param *stats - the counters
+ * @param percentile - between 0 and 1
+ * @return unsigned long long - the bound in microseconds, 0 if there were no requests
+ */
+static unsigned long long latency_percentile(const Stats* stats, double percentile){
+    unsigned long long total=0, seen=0, target;
+    int i;
+    for (i=0 ; i < STATS_LATENCY_BUCKETS ; i++){
+        total+=stats->latency[i];
+    }
+    if (total==0){
+        return 0;
+    }
+    target = (unsigned long long)(percentile * total);
+    for (i=0 ; i < STATS_LATENCY_BUCKETS ; i++){
+        seen+=stats->latency[i];
+        if (seen > target){
+            break;
+        }
+    }
+    return 1ULL << (i < STATS_LATENCY_BUCKETS ? i : STATS_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * stats_format_json - formats the counters as a single line JSON object
+ * @param *stats - the counters
+ * @param workers - amount of workers that were summed up
+ * @param *buffer - filled with the object and a newline
+ * @param size - the size of the buffer
+ * @return int - the length of the object, or -1 if the buffer is too small
+ */
+int stats_format_json(const Stats* stats, int workers, char* buffer, size_t size){
+    size_t len;
+    int i, ret_val;
+    ret_val = snprintf(buffer, size, "{\"workers\": %d, \"active_connections\": %llu, \"bytes_received\": %llu, \"bytes_analyzed\": %llu, "
+                       "\"requests\": %llu, \"syscalls\": %llu, \"bytes_per_call\": %.1f, "
+                       "\"rejected\": %llu, \"idle_timeouts\": %llu, \"total_timeouts\": %llu, "
+                       "\"latency_us\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"buckets\": [",
+                       workers, stats->active_connections, stats->bytes_received, stats->bytes_analyzed, stats->requests, stats->syscalls,
+                       stats->syscalls ? (double)stats->bytes_received / stats->syscalls : 0.0,
+                       stats->rejected, stats->idle_timeouts, stats->total_timeouts,
+                       latency_percentile(stats, 0.5), latency_percentile(stats, 0.99), latency_percentile(stats, 0.999));
+    for (i=0 ; i < STATS_LATENCY_BUCKETS && ret_val >= 0 && (size_t)ret_val < size ; i++){
+        len = (size_t)ret_val;
+        ret_val+=snprintf(buffer + len, size - len, i ? ", %llu" : "%llu", stats->latency[i]);
+    }
+    if (ret_val >= 0 && (size_t)ret_val < size){
+        len = (size_t)ret_val;
+        ret_val+=snprintf(buffer + len, size - len, "]}, \"pcc_total\": [");
+    }
+    for (i=0 ; i < NUM_PRINTABLE && ret_val >= 0 && (size_t)ret_val < size ; i++){
+        len = (size_t)ret_val;
+        ret_val+=snprintf(buffer + len, size - len, i ? ", %llu" : "%llu", stats->pcc_total[i]);
+    }
+    if (ret_val >= 0 && (size_t)ret_val < size){
+        len = (size_t)ret_val;
+        ret_val+=snprintf(buffer + len, size - len, "]}\n");
+    }
+    if (ret_val < 0 || (size_t)ret_val >= size){
+        return -1;
+    }
+    return ret_val;
+}
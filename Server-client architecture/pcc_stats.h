@@ -0,0 +1,33 @@
+#ifndef PCC_STATS_H
+#define PCC_STATS_H
+#include <stddef.h>
+
+#include "pcc_analyze.h"
+
+#define STATS_LATENCY_BUCKETS 32 /* bucket i counts the requests that took less than 2^i microseconds (and at least 2^(i-1)) */
+
+typedef struct stats{ /* the counters of a worker, or the sum of all of them */
+    unsigned long long pcc_total[NUM_PRINTABLE];
+    unsigned long long active_connections;
+    unsigned long long bytes_received;
+    unsigned long long bytes_analyzed; /* the clients' data, without the protocol headers */
+    unsigned long long requests; /* framed requests and legacy connections that were answered */
+    unsigned long long syscalls; /* recv calls, or io_uring_enter calls with --uring */
+    unsigned long long rejected; /* clients that were closed right after accept, because of --max-connections */
+    unsigned long long idle_timeouts;
+    unsigned long long total_timeouts;
+    unsigned long long latency[STATS_LATENCY_BUCKETS];
+}Stats;
+
+typedef struct stats_seqlock{ /* a copy of a worker's Stats that other threads can read while the worker keeps running */
+    unsigned int sequence; /* odd while the copy is being written */
+    Stats stats;
+}StatsSeqlock;
+
+void stats_publish(StatsSeqlock* lock, const Stats* stats);
+void stats_snapshot(StatsSeqlock* lock, Stats* stats);
+void stats_add(Stats* total, const Stats* stats);
+unsigned int stats_latency_bucket(unsigned long long nanoseconds);
+int stats_format_json(const Stats* stats, int workers, char* buffer, size_t size);
+
+#endif /* PCC_STATS_H */
@@ -0,0 +1,109 @@
+/*
+ * pcc_timer summary:
+ *
+ * A hashed timing wheel for the deadlines of pcc_server's clients. A timer is put in the slot of its tick modulo WHEEL_SLOTS, so adding
+ * and removing one is O(1) no matter how many clients there are, and advancing the wheel only visits the slots of the ticks that passed.
+ * The owner is expected to keep a single timer per object and re-add it lazily (e.g. a client that was active since its timer was
+ * added just gets a new one when the old one expires), so the data path never touches the wheel.
+ */
+
+#include <stddef.h>
+
+#include "pcc_timer.h"
+
+/**
+ * wheel_init - initiates an empty wheel
+ * @param *wheel - the wheel
+ * @param now - the current tick
+ * @return void
+ */
+void wheel_init(TimerWheel* wheel, unsigned long long now){
+    int i;
+    for (i=0 ; i < WHEEL_SLOTS ; i++){
+        wheel->slots[i].next = &wheel->slots[i];
+        wheel->slots[i].prev = &wheel->slots[i];
+    }
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+/**
+ * wheel_add - adds a timer, which must not be pending
+ * @param *wheel - the wheel
+ * @param *entry - the timer
+ * @param expires - the tick it expires at, a tick that passed expires on the next advance
+ * @return void
+ */
+void wheel_add(TimerWheel* wheel, TimerEntry* entry, unsigned long long expires){
+    TimerEntry* head;
+    if (expires <= wheel->now){
+        expires = wheel->now + 1;
+    }
+    head = &wheel->slots[expires & (WHEEL_SLOTS - 1)];
+    entry->expires = expires;
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+    wheel->count++;
+}
+
+/**
+ * wheel_remove - removes a timer if it is pending
+ * @param *wheel - the wheel
+ * @param *entry - the timer
+ * @return void
+ */
+void wheel_remove(TimerWheel* wheel, TimerEntry* entry){
+    if (!wheel_pending(entry)){
+        return;
+    }
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+    wheel->count--;
+}
+
+/**
+ * wheel_pending - whether a timer is in the wheel
+ * @param *entry - the timer, zeroed before its first use
+ * @return int - 1 if pending, else 0
+ */
+int wheel_pending(const TimerEntry* entry){
+    return entry->prev!=NULL;
+}
+
+/**
+ * wheel_advance - advances the wheel and removes the timers that expired
+ * @param *wheel - the wheel
+ * @param now - the current tick
+ * @return TimerEntry* - the expired timers, linked by next and no longer pending (their prev is NULL), or NULL if none expired
+ */
+TimerEntry* wheel_advance(TimerWheel* wheel, unsigned long long now){
+    TimerEntry *expired=NULL, *entry, *next, *head;
+    unsigned long long tick, last = now;
+    if (now <= wheel->now){
+        return NULL;
+    }
+    if (now - wheel->now > WHEEL_SLOTS){ /* every slot is visited once */
+        last = wheel->now + WHEEL_SLOTS;
+    }
+    for (tick=wheel->now + 1 ; tick <= last ; tick++){
+        head = &wheel->slots[tick & (WHEEL_SLOTS - 1)];
+        for (entry=head->next ; entry!=head ; entry=next){
+            next = entry->next;
+            if (entry->expires > now){ /* due in a later round */
+                continue;
+            }
+            entry->prev->next = entry->next;
+            entry->next->prev = entry->prev;
+            entry->prev = NULL;
+            entry->next = expired;
+            expired = entry;
+            wheel->count--;
+        }
+    }
+    wheel->now = now;
+    return expired;
+}
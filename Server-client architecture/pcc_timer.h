@@ -0,0 +1,24 @@
+#ifndef PCC_TIMER_H
+#define PCC_TIMER_H
+
+#define WHEEL_SLOTS 1024 /* a power of 2, a timer further than WHEEL_SLOTS ticks stays in its slot for more than one round */
+
+typedef struct timer_entry{ /* embedded in the object that owns the timer */
+    struct timer_entry* next;
+    struct timer_entry* prev;
+    unsigned long long expires; /* the tick */
+}TimerEntry;
+
+typedef struct timer_wheel{ /* a hashed timing wheel, O(1) to add and remove a timer */
+    TimerEntry slots[WHEEL_SLOTS]; /* circular lists, the head is a sentinel */
+    unsigned long long now; /* the last tick that was advanced to */
+    unsigned int count;
+}TimerWheel;
+
+void wheel_init(TimerWheel* wheel, unsigned long long now);
+void wheel_add(TimerWheel* wheel, TimerEntry* entry, unsigned long long expires);
+void wheel_remove(TimerWheel* wheel, TimerEntry* entry);
+int wheel_pending(const TimerEntry* entry);
+TimerEntry* wheel_advance(TimerWheel* wheel, unsigned long long now);
+
+#endif /* PCC_TIMER_H */
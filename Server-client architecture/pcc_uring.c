@@ -0,0 +1,221 @@
+/*
+ * pcc_uring summary:
+ *
+ * A minimal io_uring wrapper for pcc_server, built directly on io_uring_setup/io_uring_enter/io_uring_register so no library is needed.
+ * Besides the submission and completion rings it manages a ring of provided buffers (IORING_REGISTER_PBUF_RING), so multishot recv
+ * requests take a buffer only when data actually arrives instead of pinning one per connection.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "pcc_uring.h"
+
+/**
+ * uring_init - creates an io_uring instance and maps its rings
+ * @param *ring - the ring to initiate
+ * @param entries - amount of submission queue entries
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int uring_init(Uring* ring, unsigned int entries){
+    struct io_uring_params params;
+    unsigned int i;
+    memset(ring, 0, sizeof(Uring));
+    memset(&params, 0, sizeof(params)); /* no IORING_SETUP_SINGLE_ISSUER, the ring is created by main but used by the worker thread */
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd==-1){
+        return -1;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP){ /* both rings share one mapping */
+        if (ring->cq_ring_size > ring->sq_ring_size){
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring==MAP_FAILED){
+        close(ring->fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring==MAP_FAILED){
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes==MAP_FAILED){
+        uring_exit(ring);
+        return -1;
+    }
+    ring->sq_head = (unsigned int*)((char*)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)((char*)ring->sq_ring + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int*)((char*)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+    for (i=0 ; i < ring->sq_entries ; i++){ /* sqe i is always in slot i */
+        ring->sq_array[i] = i;
+    }
+    return 0;
+}
+
+/**
+ * uring_setup_buffers - allocates the provided buffers and registers them as buffer group URING_BUFFER_GROUP
+ * @param *ring - the ring
+ * @param buf_count - amount of buffers, a power of 2
+ * @param buf_size - the size of every buffer
+ * @return int - 0 if successfull, else -1 and errno is set
+ */
+int uring_setup_buffers(Uring* ring, unsigned int buf_count, unsigned int buf_size){
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+    ring->buf_ring_size = buf_count*sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring==MAP_FAILED){
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    ring->buffers = mmap(NULL, (size_t)buf_count*buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers==MAP_FAILED){
+        ring->buffers = NULL;
+        return -1;
+    }
+    ring->buf_count = buf_count;
+    ring->buf_size = buf_size;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)==-1){
+        return -1;
+    }
+    for (i=0 ; i < buf_count ; i++){
+        uring_recycle_buffer(ring, (unsigned short)i);
+    }
+    return 0;
+}
+
+/**
+ * uring_buffer - the address of a provided buffer
+ * @param *ring - the ring
+ * @param bid - the buffer id, as reported in the cqe flags
+ * @return char* - the buffer
+ */
+char* uring_buffer(Uring* ring, unsigned short bid){
+    return ring->buffers + (size_t)bid*ring->buf_size;
+}
+
+/**
+ * uring_recycle_buffer - gives a provided buffer back to the kernel
+ * @param *ring - the ring
+ * @param bid - the buffer id
+ * @return void
+ */
+void uring_recycle_buffer(Uring* ring, unsigned short bid){
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+    buf->addr = (unsigned long)uring_buffer(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * uring_get_sqe - returns a cleared submission queue entry, submitting the prepared ones if the queue is full
+ * @param *ring - the ring
+ * @return struct io_uring_sqe* - the entry, or NULL if the queue stays full
+ */
+struct io_uring_sqe* uring_get_sqe(Uring* ring){
+    struct io_uring_sqe* sqe;
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries){
+        if (uring_submit_and_wait(ring, 0)==-1 ||
+            ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries){
+            return NULL;
+        }
+    }
+    sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * uring_submit_and_wait - publishes the prepared entries and waits for completions
+ * @param *ring - the ring
+ * @param wait_nr - amount of completions to wait for
+ * @return int - amount of submitted entries if successfull, else -1 and errno is set
+ */
+int uring_submit_and_wait(Uring* ring, unsigned int wait_nr){
+    unsigned int to_submit = ring->sq_local_tail - *ring->sq_tail;
+    int ret_val;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    if (to_submit==0 && wait_nr==0){
+        return 0;
+    }
+    ring->enter_calls++;
+    ret_val = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    return ret_val;
+}
+
+/**
+ * uring_peek_cqe - returns the next completion without waiting
+ * @param *ring - the ring
+ * @return struct io_uring_cqe* - the completion, or NULL if there is none
+ */
+struct io_uring_cqe* uring_peek_cqe(Uring* ring){
+    unsigned int head = *ring->cq_head;
+    if (head==__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+/**
+ * uring_cqe_seen - marks the completion returned by uring_peek_cqe as consumed
+ * @param *ring - the ring
+ * @return void
+ */
+void uring_cqe_seen(Uring* ring){
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * uring_exit - unmaps the rings and the buffers and closes the instance
+ * @param *ring - the ring
+ * @return void
+ */
+void uring_exit(Uring* ring){
+    if (ring->buffers!=NULL){
+        munmap(ring->buffers, (size_t)ring->buf_count*ring->buf_size);
+    }
+    if (ring->buf_ring!=NULL){
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    if (ring->sqes!=NULL && ring->sqes!=MAP_FAILED){
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring!=NULL && ring->cq_ring!=ring->sq_ring){
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring!=NULL){
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
@@ -0,0 +1,43 @@
+#ifndef PCC_URING_H
+#define PCC_URING_H
+#include <linux/io_uring.h>
+
+#define URING_BUFFER_GROUP 0
+
+typedef struct uring{ /* a minimal io_uring wrapper over the raw system calls */
+    int fd;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail; /* sqes that were prepared but not published yet */
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring* buf_ring; /* provided buffers, the kernel picks one for every recv completion */
+    size_t buf_ring_size;
+    char* buffers;
+    unsigned int buf_count;
+    unsigned int buf_size;
+    unsigned long long enter_calls;
+}Uring;
+
+int uring_init(Uring* ring, unsigned int entries);
+int uring_setup_buffers(Uring* ring, unsigned int buf_count, unsigned int buf_size);
+void uring_recycle_buffer(Uring* ring, unsigned short bid);
+char* uring_buffer(Uring* ring, unsigned short bid);
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+int uring_submit_and_wait(Uring* ring, unsigned int wait_nr);
+struct io_uring_cqe* uring_peek_cqe(Uring* ring);
+void uring_cqe_seen(Uring* ring);
+void uring_exit(Uring* ring);
+
+#endif /* PCC_URING_H */